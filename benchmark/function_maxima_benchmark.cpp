@@ -0,0 +1,523 @@
+// Self-contained benchmark of FunctionMaxima (and FlatFunctionMaxima, ConcurrentFunctionMaxima for reads,
+// ShardedFunctionMaxima for parallel writers, PersistentFunctionMaxima for versions, BTreeFunctionMaxima).
+// Build: g++ -std=c++17 -O2 -DNDEBUG -pthread benchmark/function_maxima_benchmark.cpp -o function_maxima_benchmark
+// (add -mavx2 for the AVX2 version of LocalExtremaKernel, SSE2 is used otherwise).
+// Usage: ./function_maxima_benchmark [max_size (default 1000000)] [filter (substring of a row name)]
+// With -DFUNCTION_MAXIMA_STATS counters per operation of set_value and erase are reported as well.
+
+#include "../function_maxima.h"
+#include "../flat_function_maxima.h"
+#include "../concurrent_function_maxima.h"
+#include "../sharded_function_maxima.h"
+#include "../persistent_function_maxima.h"
+#include "../btree_function_maxima.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    // Sum of everything read by the benchmarks, printed at the end so that nothing is optimized out.
+    size_t checksum = 0;
+
+    // Expensive to copy value type.
+    struct BigValue {
+        std::array<long, 32> data;
+
+        explicit BigValue(long x) {
+            data.fill(x);
+        }
+    };
+
+    bool operator<(const BigValue &lk, const BigValue &rk) {
+        return lk.data[0] < rk.data[0];
+    }
+
+    template<typename T>
+    T make(long x);
+
+    template<>
+    int make<int>(long x) {
+        return static_cast<int>(x);
+    }
+
+    template<>
+    int64_t make<int64_t>(long x) {
+        return static_cast<int64_t>(x);
+    }
+
+    template<>
+    double make<double>(long x) {
+        return static_cast<double>(x);
+    }
+
+    // Zero padded, so the order of strings is the order of numbers.
+    template<>
+    std::string make<std::string>(long x) {
+        auto s = std::to_string(x);
+        return std::string(24 - s.size(), '0') + s;
+    }
+
+    template<>
+    BigValue make<BigValue>(long x) {
+        return BigValue(x);
+    }
+
+    size_t digest(int x) {
+        return static_cast<size_t>(x);
+    }
+
+    size_t digest(double x) {
+        return static_cast<size_t>(x);
+    }
+
+    size_t digest(const std::string &x) {
+        return x.size() + static_cast<size_t>(x.back());
+    }
+
+    size_t digest(const BigValue &x) {
+        return static_cast<size_t>(x.data[0]);
+    }
+
+    // Aggregate policy summing digests of values.
+    template<typename A, typename V>
+    struct DigestSum {
+        using value_type = size_t;
+
+        static size_t identity() {
+            return 0;
+        }
+
+        static size_t of(const A &, const V &v) {
+            return digest(v);
+        }
+
+        static size_t combine(size_t lk, size_t rk) {
+            return lk + rk;
+        }
+    };
+
+    enum class Pattern {
+        random, monotone, sawtooth, plateau
+    };
+
+    const char *pattern_name(Pattern pattern) {
+        switch (pattern) {
+            case Pattern::random:
+                return "random";
+            case Pattern::monotone:
+                return "monotone";
+            case Pattern::sawtooth:
+                return "sawtooth";
+            default:
+                return "plateau";
+        }
+    }
+
+    // Value of the i-th argument (arguments are 0, 1, ..., n - 1).
+    long value_of(Pattern pattern, long i, std::mt19937_64 &rng) {
+        switch (pattern) {
+            case Pattern::random:
+                return static_cast<long>(rng() % 1000000);
+            case Pattern::monotone:
+                return i;
+            case Pattern::sawtooth:
+                return i % 64;
+            default:
+                return (i / 1000) % 4;
+        }
+    }
+
+    template<typename F>
+    double seconds(F f) {
+        auto start = Clock::now();
+        f();
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    std::string filter;
+
+    void report(const std::string &name, long n, double time, long operations) {
+        if (name.find(filter) == std::string::npos)
+            return;
+        std::printf("%-52s %10ld %12.1f ns/op\n", name.c_str(), n, time * 1e9 / static_cast<double>(operations));
+    }
+
+#ifdef FUNCTION_MAXIMA_STATS
+    template<typename F>
+    void report_stats(const std::string &name, long n, const F &f) {
+        if (name.find(filter) == std::string::npos)
+            return;
+        const auto &stats = f.stats();
+        auto per_operation = [&](size_t counter) {
+            return static_cast<double>(counter) / static_cast<double>(std::max<size_t>(1, stats.operations));
+        };
+        std::printf("%-52s %10ld %8.2f allocs %8.1f bytes %6.2f descents %6.1f comparisons /op\n", name.c_str(), n,
+                    per_operation(stats.allocations), per_operation(stats.allocated_bytes),
+                    per_operation(stats.tree_descents), per_operation(stats.comparisons));
+    }
+#endif
+
+    template<typename A, typename V>
+    void run(const char *types, long n, Pattern pattern) {
+        auto prefix = std::string(types) + "/" + pattern_name(pattern) + "/";
+        std::mt19937_64 rng(n);
+
+        std::vector<long> order(n);
+        std::iota(order.begin(), order.end(), 0L);
+        std::shuffle(order.begin(), order.end(), rng);
+
+        std::vector<std::pair<A, V>> points;
+        points.reserve(n);
+        for (long i = 0; i < n; ++i)
+            points.emplace_back(make<A>(i), make<V>(value_of(pattern, i, rng)));
+
+        // Insertion in random order of arguments.
+        FunctionMaxima<A, V> f;
+        report(prefix + "set_value (insert)", n, seconds([&] {
+            for (long i : order)
+                f.set_value(points[i].first, points[i].second);
+        }), n);
+
+#ifdef FUNCTION_MAXIMA_STATS
+        report_stats(prefix + "set_value (insert) stats", n, f);
+        f.reset_stats();
+#endif
+
+        // The same insertion with arguments and values moved into the points.
+        {
+            auto moved = points;
+            FunctionMaxima<A, V> g;
+            report(prefix + "set_value (insert, moved)", n, seconds([&] {
+                for (long i : order)
+                    g.set_value(std::move(moved[i].first), std::move(moved[i].second));
+            }), n);
+        }
+
+        // Updates of existing arguments, every one changes the value.
+        long updates = std::min(n, 1000000L);
+        report(prefix + "set_value (update)", n, seconds([&] {
+            for (long k = 0; k < updates; ++k) {
+                long i = order[k];
+                f.set_value(points[i].first, make<V>(value_of(pattern, i, rng) + 1));
+            }
+        }), updates);
+#ifdef FUNCTION_MAXIMA_STATS
+        report_stats(prefix + "set_value (update) stats", n, f);
+#endif
+
+        long lookups = std::min(n * 4, 4000000L);
+        report(prefix + "value_at", n, seconds([&] {
+            for (long k = 0; k < lookups; ++k)
+                checksum += digest(f.value_at(points[order[k % n]].first));
+        }), lookups);
+
+        report(prefix + "find", n, seconds([&] {
+            for (long k = 0; k < lookups; ++k)
+                checksum += f.find(points[order[k % n]].first) != f.end();
+        }), lookups);
+
+        long rounds = std::max(1L, 4000000L / n);
+        report(prefix + "iterate", n, seconds([&] {
+            for (long r = 0; r < rounds; ++r) {
+                for (const auto &point : f)
+                    checksum += digest(point.value());
+            }
+        }), rounds * n);
+
+        long maxima = static_cast<long>(std::distance(f.mx_begin(), f.mx_end()));
+        report(prefix + "mx iterate", n, seconds([&] {
+            for (long r = 0; r < rounds; ++r) {
+                for (auto it = f.mx_begin(); it != f.mx_end(); ++it)
+                    checksum += digest((*it).value());
+            }
+        }), std::max(1L, rounds * maxima));
+
+        report(prefix + "global_max", n, seconds([&] {
+            for (long k = 0; k < lookups; ++k)
+                checksum += digest(f.global_max());
+        }), lookups);
+
+        report(prefix + "top_k_maxima(10)", n, seconds([&] {
+            for (long k = 0; k < lookups; ++k) {
+                for (const auto &point : f.top_k_maxima(10))
+                    checksum += digest(point.value());
+            }
+        }), lookups);
+
+        report(prefix + "maxima_above (first one)", n, seconds([&] {
+            for (long k = 0; k < lookups; ++k) {
+                auto range = f.maxima_above(points[order[k % n]].second);
+                checksum += range.empty() ? 0 : digest((*range.begin()).value());
+            }
+        }), lookups);
+
+#ifdef FUNCTION_MAXIMA_STATS
+        f.reset_stats();
+#endif
+        report(prefix + "erase", n, seconds([&] {
+            for (long i : order)
+                f.erase(points[i].first);
+        }), n);
+#ifdef FUNCTION_MAXIMA_STATS
+        report_stats(prefix + "erase stats", n, f);
+#endif
+
+        // Bulk operations on sorted input.
+        report(prefix + "bulk construction", n, seconds([&] {
+            FunctionMaxima<A, V> g(points.begin(), points.end());
+            checksum += g.size();
+        }), n);
+
+        // The same with teardown released at once by an arena (for trivially destructible types).
+        using ArenaAllocator = FunctionMaximaArenaAllocator<std::pair<A, V>>;
+        report(prefix + "arena bulk construction", n, seconds([&] {
+            FunctionMaximaArena arena;
+            FunctionMaxima<A, V, AtomicRefCount, ArenaAllocator> g(points.begin(), points.end(), ArenaAllocator(arena));
+            checksum += g.size();
+        }), n);
+
+        // Detection of local maxima over an array of arithmetic values, SIMD against scalar.
+        if constexpr (std::is_arithmetic<V>::value) {
+            auto values = std::vector<V>();
+            for (const auto &point : points)
+                values.push_back(point.second);
+            auto flags = std::vector<unsigned char>(values.size());
+
+            report(prefix + "local maxima kernel", n, seconds([&] {
+                for (long r = 0; r < rounds; ++r) {
+                    LocalExtremaKernel<V>::maxima(values.data(), values.size(), flags.data());
+                    checksum += flags[r % n];
+                }
+            }), rounds * n);
+
+            report(prefix + "local maxima kernel (scalar)", n, seconds([&] {
+                for (long r = 0; r < rounds; ++r) {
+                    LocalExtremaKernel<V>::scalar_maxima(values.data(), values.size(), flags.data());
+                    checksum += flags[r % n];
+                }
+            }), rounds * n);
+        }
+
+        // Updates and queries of windows of n / 100 arguments, with the index ordered by arguments.
+        using Indexed = FunctionMaxima<A, V, AtomicRefCount, std::allocator<std::pair<A, V>>, RangeIndex>;
+        Indexed indexed;
+        report(prefix + "indexed set_value (insert)", n, seconds([&] {
+            for (long i : order)
+                indexed.set_value(points[i].first, points[i].second);
+        }), n);
+
+        long width = std::max(1L, n / 100);
+        report(prefix + "indexed max_in_range", n, seconds([&] {
+            for (long k = 0; k < lookups; ++k) {
+                long i = order[k % n];
+                auto it = indexed.max_in_range(points[i].first, points[std::min(n - 1, i + width)].first);
+                checksum += digest((*it).value());
+            }
+        }), lookups);
+
+        report(prefix + "indexed maxima_in_range (first one)", n, seconds([&] {
+            for (long k = 0; k < lookups; ++k) {
+                long i = order[k % n];
+                auto range = indexed.maxima_in_range(points[i].first, points[std::min(n - 1, i + width)].first);
+                checksum += range.empty() ? 0 : digest((*range.begin()).value());
+            }
+        }), lookups);
+
+        report(prefix + "indexed rank + select", n, seconds([&] {
+            for (long k = 0; k < lookups; ++k) {
+                auto rank = indexed.rank(points[order[k % n]].first);
+                checksum += rank + digest((*indexed.select(rank)).value());
+            }
+        }), lookups);
+
+        report(prefix + "indexed count_in_range", n, seconds([&] {
+            for (long k = 0; k < lookups; ++k) {
+                long i = order[k % n];
+                checksum += indexed.count_in_range(points[i].first, points[std::min(n - 1, i + width)].first);
+            }
+        }), lookups);
+
+        // Sums over windows of n / 100 arguments, the same index with summaries of subtrees.
+        using Aggregated = FunctionMaxima<A, V, AtomicRefCount, std::allocator<std::pair<A, V>>,
+                                          AggregateIndex<DigestSum<A, V>>>;
+        Aggregated aggregated(points.begin(), points.end());
+        report(prefix + "aggregate (window of n / 100)", n, seconds([&] {
+            for (long k = 0; k < lookups; ++k) {
+                long i = order[k % n];
+                checksum += aggregated.aggregate(points[i].first, points[std::min(n - 1, i + width)].first);
+            }
+        }), lookups);
+
+        report(prefix + "aggregate by scanning (window)", n, seconds([&] {
+            for (long k = 0; k < std::max(1L, lookups / width); ++k) {
+                long i = order[k % n];
+                auto last = aggregated.find(points[std::min(n - 1, i + width)].first);
+                for (auto it = aggregated.find(points[i].first); it != last; ++it)
+                    checksum += digest((*it).value());
+            }
+        }), std::max(1L, lookups / width));
+
+        // Local minima kept together with local maxima.
+        using WithMinima = FunctionMaxima<A, V, AtomicRefCount, std::allocator<std::pair<A, V>>, NoRangeIndex,
+                                          LocalMinima>;
+        WithMinima with_minima;
+        report(prefix + "minima set_value (insert)", n, seconds([&] {
+            for (long i : order)
+                with_minima.set_value(points[i].first, points[i].second);
+        }), n);
+
+        report(prefix + "minima global_max + global_min", n, seconds([&] {
+            for (long k = 0; k < lookups; ++k)
+                checksum += digest(with_minima.global_max()) + digest(with_minima.global_min());
+        }), lookups);
+
+        report(prefix + "minima mn iterate", n, seconds([&] {
+            for (long r = 0; r < rounds; ++r) {
+                for (auto it = with_minima.mn_begin(); it != with_minima.mn_end(); ++it)
+                    checksum += digest((*it).value());
+            }
+        }), std::max(1L, rounds * static_cast<long>(std::distance(with_minima.mn_begin(), with_minima.mn_end()))));
+
+        report(prefix + "set_values (batches of 1000)", n, seconds([&] {
+            FunctionMaxima<A, V> g;
+            for (long i = 0; i < n; i += 1000)
+                g.set_values(points.begin() + i, points.begin() + std::min(n, i + 1000));
+            checksum += g.size();
+        }), n);
+
+        // value_at of 4 reader threads running together with one writer updating the same arguments.
+        ConcurrentFunctionMaxima<A, V> concurrent(points.begin(), points.end());
+        long readers = 4;
+        report(prefix + "concurrent value_at (4 + writer)", n, seconds([&] {
+            std::vector<std::thread> threads;
+            std::vector<size_t> sums(readers, 0);
+            for (long t = 0; t < readers; ++t) {
+                threads.emplace_back([&, t] {
+                    for (long k = t; k < lookups; k += readers)
+                        sums[t] += digest(concurrent.value_at(points[order[k % n]].first));
+                });
+            }
+            for (long k = 0; k < updates; ++k) {
+                long i = order[k];
+                concurrent.set_value(points[i].first, points[i].second);
+            }
+            for (auto &thread : threads)
+                thread.join();
+            checksum += std::accumulate(sums.begin(), sums.end(), size_t(0));
+        }), lookups);
+
+        report(prefix + "concurrent snapshot", n, seconds([&] {
+            for (long k = 0; k < lookups; ++k)
+                checksum += concurrent.snapshot()->size();
+        }), lookups);
+
+        // Insertion by 4 writer threads, each one into its own shard (a quarter of the arguments).
+        long writers = 4;
+        std::vector<std::vector<long>> shard_orders(writers);
+        for (long i : order)
+            shard_orders[i * writers / n].push_back(i);
+        report(prefix + "sharded set_value (4 writers)", n, seconds([&] {
+            ShardedFunctionMaxima<A, V> sharded({points[n / 4].first, points[n / 2].first, points[3 * n / 4].first});
+            std::vector<std::thread> threads;
+            for (long t = 0; t < writers; ++t) {
+                threads.emplace_back([&, t] {
+                    for (long i : shard_orders[t])
+                        sharded.set_value(points[i].first, points[i].second);
+                });
+            }
+            for (auto &thread : threads)
+                thread.join();
+            checksum += sharded.maxima().size();
+        }), n);
+
+        // Versions of the persistent backend, every update is made on a new copy of the previous version.
+        PersistentFunctionMaxima<A, V> persistent;
+        report(prefix + "persistent set_value (insert)", n, seconds([&] {
+            for (long i : order)
+                persistent.set_value(points[i].first, points[i].second);
+        }), n);
+
+        report(prefix + "persistent copy + set_value", n, seconds([&] {
+            std::vector<PersistentFunctionMaxima<A, V>> versions(1, persistent);
+            for (long k = 0; k < updates; ++k) {
+                long i = order[k];
+                versions.push_back(versions.back());
+                versions.back().set_value(points[i].first, make<V>(value_of(pattern, i, rng) + 1));
+            }
+            checksum += versions.back().size();
+        }), updates);
+
+        // The B-tree backend, to be compared with set_value (insert), value_at, find and erase above.
+        BTreeFunctionMaxima<A, V> btree;
+        report(prefix + "btree set_value (insert)", n, seconds([&] {
+            for (long i : order)
+                btree.set_value(points[i].first, points[i].second);
+        }), n);
+
+        report(prefix + "btree value_at", n, seconds([&] {
+            for (long k = 0; k < lookups; ++k)
+                checksum += digest(btree.value_at(points[order[k % n]].first));
+        }), lookups);
+
+        report(prefix + "btree find", n, seconds([&] {
+            for (long k = 0; k < lookups; ++k)
+                checksum += btree.find(points[order[k % n]].first) != btree.end();
+        }), lookups);
+
+        report(prefix + "btree erase", n, seconds([&] {
+            for (long i : order)
+                btree.erase(points[i].first);
+        }), n);
+
+        // Reads of the flat backend.
+        FlatFunctionMaxima<A, V> flat(points.begin(), points.end());
+
+        report(prefix + "flat value_at", n, seconds([&] {
+            for (long k = 0; k < lookups; ++k)
+                checksum += digest(flat.value_at(points[order[k % n]].first));
+        }), lookups);
+
+        report(prefix + "flat iterate", n, seconds([&] {
+            for (long r = 0; r < rounds; ++r) {
+                for (const auto &point : flat)
+                    checksum += digest(point.value());
+            }
+        }), rounds * n);
+
+        report(prefix + "flat mx iterate", n, seconds([&] {
+            for (long r = 0; r < rounds; ++r) {
+                for (auto it = flat.mx_begin(); it != flat.mx_end(); ++it)
+                    checksum += digest((*it).value());
+            }
+        }), std::max(1L, rounds * maxima));
+    }
+}
+
+int main(int argc, char *argv[]) {
+    long max_size = (argc > 1 ? std::atol(argv[1]) : 1000000L);
+    filter = (argc > 2 ? argv[2] : "");
+
+    std::printf("%-52s %10s %15s\n", "benchmark", "size", "time");
+    for (long n = 100; n <= max_size; n *= 10) {
+        for (auto pattern : {Pattern::random, Pattern::monotone, Pattern::sawtooth, Pattern::plateau}) {
+            run<int, int>("int,int", n, pattern);
+            run<int64_t, double>("int64,double", n, pattern);
+            run<std::string, std::string>("string,string", n, pattern);
+            run<int, BigValue>("int,big", n, pattern);
+        }
+    }
+
+    std::printf("checksum %zu\n", checksum);
+    return 0;
+}
@@ -0,0 +1,1408 @@
+#ifndef BTREE_FUNCTION_MAXIMA_H
+#define BTREE_FUNCTION_MAXIMA_H
+
+#include "function_maxima.h"
+
+#include <memory>
+#include <iterator>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+#include <new>
+#include <set>
+
+/* Sequence of T kept in a B+ tree of nodes of NodeBytes bytes. Inner nodes keep sizes of their subtrees
+ * and copies of the first items of their children, so searching is done with a comparator given to the query,
+ * while updates are given positions (ranks) only and never compare anything.
+ * Nodes come from Alloc (rebound to them), the ones needed by insertions are reserved first,
+ * after that insert and erase do not throw.
+ * Leaves are linked, iterators are bidirectional and they are invalidated by any update.
+ */
+template<typename T, size_t NodeBytes = 256, typename Alloc = std::allocator<T>>
+class FunctionMaximaBTree {
+    static_assert(std::is_nothrow_move_constructible<T>::value && std::is_nothrow_move_assignable<T>::value &&
+                  std::is_nothrow_copy_constructible<T>::value && std::is_nothrow_copy_assignable<T>::value,
+                  "Items of FunctionMaximaBTree are moved and copied inside nodes, it must not throw.");
+
+public:
+    using size_type = size_t;
+
+    class iterator;
+
+    explicit FunctionMaximaBTree(const Alloc &alloc = Alloc()) noexcept : alloc(alloc) {}
+
+    FunctionMaximaBTree(const FunctionMaximaBTree &other, const Alloc &alloc);
+
+    FunctionMaximaBTree(FunctionMaximaBTree &&other) noexcept;
+
+    FunctionMaximaBTree &operator=(const FunctionMaximaBTree &other) = delete;
+
+    // Allocators are swapped too, nodes are always released with the allocator they came from.
+    void swap(FunctionMaximaBTree &other) noexcept;
+
+    Alloc get_allocator() const noexcept {
+        return alloc;
+    }
+
+    size_type size() const noexcept {
+        return items_count;
+    }
+
+    iterator begin() const noexcept;
+
+    iterator end() const noexcept;
+
+    // Iterator to the item at position rank, end() if there is none.
+    iterator at(size_type rank) const noexcept;
+
+    /* Number of the first items for which pred is true (pred has to be true for a prefix of the items)
+     * and the iterator to the next one, found by one descent.
+     */
+    template<typename Pred>
+    std::pair<size_type, iterator> partition_point(Pred pred) const;
+
+    // Makes sure that the next insertions insert calls do not allocate. Nothing changes if it throws.
+    void reserve(size_type insertions);
+
+    // Inserts value at position rank, nodes have to be reserved.
+    void insert(size_type rank, const T &value) noexcept;
+
+    void replace(size_type rank, const T &value) noexcept;
+
+    void erase(size_type rank) noexcept;
+
+    ~FunctionMaximaBTree() noexcept;
+
+private:
+    struct Leaf;
+
+    struct Inner;
+
+    static constexpr size_type leaf_capacity =
+            std::max<size_type>(4, (NodeBytes - 2 * sizeof(void *) - sizeof(size_type)) / sizeof(T));
+
+    static constexpr size_type inner_capacity =
+            std::max<size_type>(4, (NodeBytes - sizeof(size_type)) / (sizeof(void *) + sizeof(size_type) + sizeof(T)));
+
+    static constexpr size_type max_height = 64;
+
+    using alloc_traits = std::allocator_traits<Alloc>;
+
+    using leaf_allocator = typename alloc_traits::template rebind_alloc<Leaf>;
+
+    using inner_allocator = typename alloc_traits::template rebind_alloc<Inner>;
+
+    // Items living in raw storage, only the first count of them are constructed.
+    static void insert_item(T *items, size_type count, size_type pos, const T &value) noexcept;
+
+    static void erase_item(T *items, size_type count, size_type pos) noexcept;
+
+    // Moves n items into uninitialised storage.
+    static void move_items(T *from, size_type n, T *to) noexcept;
+
+    static const T &first_of(void *node, size_type level) noexcept;
+
+    static size_type size_of(void *node, size_type level) noexcept;
+
+    // Whether a node has fewer items (children) than it should.
+    static bool underflows(void *node, size_type level) noexcept;
+
+    // Nodes are allocated with items left unconstructed.
+    Leaf *new_leaf();
+
+    Inner *new_inner();
+
+    void delete_node(Leaf *leaf) noexcept;
+
+    void delete_node(Inner *inner) noexcept;
+
+    Leaf *take_leaf() noexcept;
+
+    Inner *take_inner() noexcept;
+
+    // Inserts a child (with its size) into parent at pos, returns the new right half if parent was split.
+    Inner *insert_child(Inner *parent, size_type pos, void *child, size_type size, size_type level) noexcept;
+
+    // Child i of parent has too few items, it borrows one from a neighbour or it is merged with it.
+    void rebalance(Inner *parent, size_type i, size_type level) noexcept;
+
+    // Moves the contents of node right into left (its left neighbour) and releases right.
+    void merge(void *left, void *right, size_type level) noexcept;
+
+    void release(void *node, size_type level) noexcept;
+
+    Alloc alloc;
+    void *root = nullptr;
+    size_type height = 0; // Number of levels of inner nodes.
+    size_type items_count = 0;
+    Leaf *first_leaf = nullptr, *last_leaf = nullptr;
+
+    // Reserved nodes, linked through next (leaves) or children[0] (inner nodes).
+    Leaf *spare_leaves = nullptr;
+    Inner *spare_inners = nullptr;
+    size_type spare_leaves_count = 0, spare_inners_count = 0;
+};
+
+template<typename T, size_t NodeBytes, typename Alloc>
+struct FunctionMaximaBTree<T, NodeBytes, Alloc>::Leaf {
+    T *items() noexcept {
+        return std::launder(reinterpret_cast<T *>(storage));
+    }
+
+    Leaf *prev = nullptr, *next = nullptr;
+    size_type count = 0;
+    alignas(T) unsigned char storage[leaf_capacity * sizeof(T)];
+};
+
+template<typename T, size_t NodeBytes, typename Alloc>
+struct FunctionMaximaBTree<T, NodeBytes, Alloc>::Inner {
+    T *firsts() noexcept {
+        return std::launder(reinterpret_cast<T *>(storage));
+    }
+
+    size_type count = 0;
+    size_type sizes[inner_capacity];
+    void *children[inner_capacity];
+    alignas(T) unsigned char storage[inner_capacity * sizeof(T)]; // First items of the children.
+};
+
+template<typename T, size_t NodeBytes, typename Alloc>
+class FunctionMaximaBTree<T, NodeBytes, Alloc>::iterator {
+public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const T *;
+    using reference = const T &;
+
+    iterator() noexcept : tree(nullptr), leaf(nullptr), index(0) {}
+
+    reference operator*() const noexcept {
+        return leaf->items()[index];
+    }
+
+    pointer operator->() const noexcept {
+        return leaf->items() + index;
+    }
+
+    iterator &operator++() noexcept {
+        if (++index == leaf->count) {
+            leaf = leaf->next;
+            index = 0;
+        }
+        return *this;
+    }
+
+    iterator operator++(int) noexcept {
+        auto copy = *this;
+        ++*this;
+        return copy;
+    }
+
+    iterator &operator--() noexcept {
+        if (leaf == nullptr) {
+            leaf = tree->last_leaf;
+            index = leaf->count - 1;
+        } else if (index == 0) {
+            leaf = leaf->prev;
+            index = leaf->count - 1;
+        } else {
+            --index;
+        }
+        return *this;
+    }
+
+    iterator operator--(int) noexcept {
+        auto copy = *this;
+        --*this;
+        return copy;
+    }
+
+    friend bool operator==(const iterator &lk, const iterator &rk) noexcept {
+        return lk.leaf == rk.leaf && lk.index == rk.index;
+    }
+
+    friend bool operator!=(const iterator &lk, const iterator &rk) noexcept {
+        return !(lk == rk);
+    }
+
+private:
+    friend class FunctionMaximaBTree;
+
+    iterator(const FunctionMaximaBTree *tree, Leaf *leaf, size_type index) noexcept
+            : tree(tree), leaf(leaf), index(index) {}
+
+    const FunctionMaximaBTree *tree; // Used for stepping back from end().
+    Leaf *leaf; // nullptr for end().
+    size_type index;
+};
+
+// If copying throws, the delegated constructor has finished, so the destructor releases what has been copied.
+template<typename T, size_t NodeBytes, typename Alloc>
+FunctionMaximaBTree<T, NodeBytes, Alloc>::FunctionMaximaBTree(const FunctionMaximaBTree &other, const Alloc &alloc)
+        : FunctionMaximaBTree(alloc) {
+    for (const auto &item : other) {
+        reserve(1);
+        insert(items_count, item);
+    }
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+FunctionMaximaBTree<T, NodeBytes, Alloc>::FunctionMaximaBTree(FunctionMaximaBTree &&other) noexcept
+        : alloc(other.alloc) {
+    swap(other);
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+void FunctionMaximaBTree<T, NodeBytes, Alloc>::swap(FunctionMaximaBTree &other) noexcept {
+    using std::swap;
+    swap(alloc, other.alloc);
+    std::swap(root, other.root);
+    std::swap(height, other.height);
+    std::swap(items_count, other.items_count);
+    std::swap(first_leaf, other.first_leaf);
+    std::swap(last_leaf, other.last_leaf);
+    std::swap(spare_leaves, other.spare_leaves);
+    std::swap(spare_inners, other.spare_inners);
+    std::swap(spare_leaves_count, other.spare_leaves_count);
+    std::swap(spare_inners_count, other.spare_inners_count);
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+typename FunctionMaximaBTree<T, NodeBytes, Alloc>::iterator
+FunctionMaximaBTree<T, NodeBytes, Alloc>::begin() const noexcept {
+    return iterator(this, first_leaf, 0);
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+typename FunctionMaximaBTree<T, NodeBytes, Alloc>::iterator
+FunctionMaximaBTree<T, NodeBytes, Alloc>::end() const noexcept {
+    return iterator(this, nullptr, 0);
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+typename FunctionMaximaBTree<T, NodeBytes, Alloc>::iterator
+FunctionMaximaBTree<T, NodeBytes, Alloc>::at(size_type rank) const noexcept {
+    if (rank >= items_count)
+        return end();
+
+    void *node = root;
+    for (size_type level = height; level > 0; --level) {
+        auto inner = static_cast<Inner *>(node);
+        size_type i = 0;
+        for (; rank >= inner->sizes[i]; ++i)
+            rank -= inner->sizes[i];
+        node = inner->children[i];
+    }
+    return iterator(this, static_cast<Leaf *>(node), rank);
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+template<typename Pred>
+std::pair<typename FunctionMaximaBTree<T, NodeBytes, Alloc>::size_type,
+          typename FunctionMaximaBTree<T, NodeBytes, Alloc>::iterator>
+FunctionMaximaBTree<T, NodeBytes, Alloc>::partition_point(Pred pred) const {
+    if (root == nullptr)
+        return {0, end()};
+
+    size_type rank = 0;
+    void *node = root;
+    for (size_type level = height; level > 0; --level) {
+        // The last child whose first item satisfies pred, its items are the only ones that might not.
+        auto inner = static_cast<Inner *>(node);
+        auto firsts = inner->firsts();
+        size_type i = static_cast<size_type>(std::partition_point(firsts + 1, firsts + inner->count, pred) - firsts) - 1;
+        for (size_type j = 0; j < i; ++j)
+            rank += inner->sizes[j];
+        node = inner->children[i];
+    }
+
+    auto leaf = static_cast<Leaf *>(node);
+    auto index = static_cast<size_type>(std::partition_point(leaf->items(), leaf->items() + leaf->count, pred) -
+                                        leaf->items());
+    // If pred is true for the whole leaf, the next item is the first one of the next leaf.
+    if (index == leaf->count)
+        return {rank + index, iterator(this, leaf->next, 0)};
+    return {rank + index, iterator(this, leaf, index)};
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+void FunctionMaximaBTree<T, NodeBytes, Alloc>::reserve(size_type insertions) {
+    // Every insertion takes at most one leaf, and it might split every inner node on its path and add a root.
+    while (spare_leaves_count < insertions) {
+        auto leaf = new_leaf();
+        leaf->next = spare_leaves;
+        spare_leaves = leaf;
+        ++spare_leaves_count;
+    }
+    while (spare_inners_count < insertions * (height + insertions)) {
+        auto inner = new_inner();
+        inner->children[0] = spare_inners;
+        spare_inners = inner;
+        ++spare_inners_count;
+    }
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+void FunctionMaximaBTree<T, NodeBytes, Alloc>::insert(size_type rank, const T &value) noexcept {
+    if (root == nullptr) {
+        root = first_leaf = last_leaf = take_leaf();
+        height = 0;
+    }
+
+    Inner *path[max_height];
+    size_type indices[max_height];
+    void *node = root;
+    for (size_type level = height; level > 0; --level) {
+        auto inner = static_cast<Inner *>(node);
+        size_type i = 0;
+        for (; i + 1 < inner->count && rank > inner->sizes[i]; ++i)
+            rank -= inner->sizes[i];
+        ++inner->sizes[i];
+        path[level - 1] = inner;
+        indices[level - 1] = i;
+        node = inner->children[i];
+    }
+
+    auto leaf = static_cast<Leaf *>(node);
+    Leaf *target = leaf;
+    void *split = nullptr; // New right neighbour of the node on the current level.
+    if (leaf->count == leaf_capacity) {
+        auto right = take_leaf();
+        size_type half = leaf_capacity / 2;
+        move_items(leaf->items() + half, leaf->count - half, right->items());
+        right->count = leaf->count - half;
+        leaf->count = half;
+
+        right->prev = leaf;
+        right->next = leaf->next;
+        (leaf->next != nullptr ? leaf->next->prev : last_leaf) = right;
+        leaf->next = right;
+
+        if (rank > half) {
+            rank -= half;
+            target = right;
+        }
+        split = right;
+    }
+    insert_item(target->items(), target->count, rank, value);
+    ++target->count;
+    ++items_count;
+
+    // Sizes and first items are refreshed bottom up, the split nodes are inserted into their parents.
+    node = leaf;
+    for (size_type level = 0; level < height; ++level) {
+        Inner *parent = path[level];
+        size_type i = indices[level];
+        Inner *parent_split = nullptr;
+        if (split != nullptr) {
+            parent->sizes[i] = size_of(node, level);
+            parent_split = insert_child(parent, i + 1, split, size_of(split, level), level);
+        }
+
+        // The child might have moved to the new right half of the parent.
+        if (parent_split != nullptr && i >= parent->count) {
+            i -= parent->count;
+            parent = parent_split;
+        }
+        parent->firsts()[i] = first_of(parent->children[i], level);
+
+        node = path[level];
+        split = parent_split;
+    }
+
+    if (split != nullptr) {
+        auto new_root = take_inner();
+        auto old_root = root;
+        new_root->count = 0;
+        insert_child(new_root, 0, old_root, size_of(old_root, height), height);
+        insert_child(new_root, 1, split, size_of(split, height), height);
+        root = new_root;
+        ++height;
+    }
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+void FunctionMaximaBTree<T, NodeBytes, Alloc>::replace(size_type rank, const T &value) noexcept {
+    Inner *path[max_height];
+    size_type indices[max_height];
+    void *node = root;
+    for (size_type level = height; level > 0; --level) {
+        auto inner = static_cast<Inner *>(node);
+        size_type i = 0;
+        for (; rank >= inner->sizes[i]; ++i)
+            rank -= inner->sizes[i];
+        path[level - 1] = inner;
+        indices[level - 1] = i;
+        node = inner->children[i];
+    }
+
+    static_cast<Leaf *>(node)->items()[rank] = value;
+    for (size_type level = 0; level < height; ++level)
+        path[level]->firsts()[indices[level]] = first_of(path[level]->children[indices[level]], level);
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+void FunctionMaximaBTree<T, NodeBytes, Alloc>::erase(size_type rank) noexcept {
+    Inner *path[max_height];
+    size_type indices[max_height];
+    void *node = root;
+    for (size_type level = height; level > 0; --level) {
+        auto inner = static_cast<Inner *>(node);
+        size_type i = 0;
+        for (; rank >= inner->sizes[i]; ++i)
+            rank -= inner->sizes[i];
+        --inner->sizes[i];
+        path[level - 1] = inner;
+        indices[level - 1] = i;
+        node = inner->children[i];
+    }
+
+    auto leaf = static_cast<Leaf *>(node);
+    erase_item(leaf->items(), leaf->count, rank);
+    --leaf->count;
+    --items_count;
+
+    for (size_type level = 0; level < height; ++level) {
+        Inner *parent = path[level];
+        size_type i = indices[level];
+        if (underflows(parent->children[i], level))
+            rebalance(parent, i, level);
+        else
+            parent->firsts()[i] = first_of(parent->children[i], level);
+    }
+
+    // The root is replaced by its only child, or released if the last item is gone.
+    while (height > 0 && static_cast<Inner *>(root)->count == 1) {
+        auto old_root = static_cast<Inner *>(root);
+        root = old_root->children[0];
+        old_root->firsts()[0].~T();
+        delete_node(old_root);
+        --height;
+    }
+    if (height == 0 && items_count == 0 && root != nullptr) {
+        delete_node(static_cast<Leaf *>(root));
+        root = first_leaf = last_leaf = nullptr;
+    }
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+FunctionMaximaBTree<T, NodeBytes, Alloc>::~FunctionMaximaBTree() noexcept {
+    if (root != nullptr)
+        release(root, height);
+
+    while (spare_leaves != nullptr) {
+        Leaf *next = spare_leaves->next;
+        delete_node(spare_leaves);
+        spare_leaves = next;
+    }
+    while (spare_inners != nullptr) {
+        auto next = static_cast<Inner *>(spare_inners->children[0]);
+        delete_node(spare_inners);
+        spare_inners = next;
+    }
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+void FunctionMaximaBTree<T, NodeBytes, Alloc>::insert_item(T *items, size_type count, size_type pos,
+                                                    const T &value) noexcept {
+    if (pos == count) {
+        new(items + count) T(value);
+        return;
+    }
+
+    new(items + count) T(std::move(items[count - 1]));
+    std::move_backward(items + pos, items + count - 1, items + count);
+    items[pos] = value;
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+void FunctionMaximaBTree<T, NodeBytes, Alloc>::erase_item(T *items, size_type count, size_type pos) noexcept {
+    std::move(items + pos + 1, items + count, items + pos);
+    items[count - 1].~T();
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+void FunctionMaximaBTree<T, NodeBytes, Alloc>::move_items(T *from, size_type n, T *to) noexcept {
+    for (size_type j = 0; j < n; ++j) {
+        new(to + j) T(std::move(from[j]));
+        from[j].~T();
+    }
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+const T &FunctionMaximaBTree<T, NodeBytes, Alloc>::first_of(void *node, size_type level) noexcept {
+    return (level == 0 ? static_cast<Leaf *>(node)->items()[0] : static_cast<Inner *>(node)->firsts()[0]);
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+typename FunctionMaximaBTree<T, NodeBytes, Alloc>::size_type
+FunctionMaximaBTree<T, NodeBytes, Alloc>::size_of(void *node, size_type level) noexcept {
+    if (level == 0)
+        return static_cast<Leaf *>(node)->count;
+
+    auto inner = static_cast<Inner *>(node);
+    size_type result = 0;
+    for (size_type i = 0; i < inner->count; ++i)
+        result += inner->sizes[i];
+    return result;
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+bool FunctionMaximaBTree<T, NodeBytes, Alloc>::underflows(void *node, size_type level) noexcept {
+    return (level == 0 ? static_cast<Leaf *>(node)->count < leaf_capacity / 2
+                       : static_cast<Inner *>(node)->count < inner_capacity / 2);
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+typename FunctionMaximaBTree<T, NodeBytes, Alloc>::Leaf *FunctionMaximaBTree<T, NodeBytes, Alloc>::new_leaf() {
+    auto leaf_alloc = leaf_allocator(alloc);
+    Leaf *leaf = std::allocator_traits<leaf_allocator>::allocate(leaf_alloc, 1);
+    return new(leaf) Leaf; // Default initialisation leaves the storage of items as it is.
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+typename FunctionMaximaBTree<T, NodeBytes, Alloc>::Inner *FunctionMaximaBTree<T, NodeBytes, Alloc>::new_inner() {
+    auto inner_alloc = inner_allocator(alloc);
+    Inner *inner = std::allocator_traits<inner_allocator>::allocate(inner_alloc, 1);
+    return new(inner) Inner;
+}
+
+// Items of the node have been destroyed already.
+template<typename T, size_t NodeBytes, typename Alloc>
+void FunctionMaximaBTree<T, NodeBytes, Alloc>::delete_node(Leaf *leaf) noexcept {
+    auto leaf_alloc = leaf_allocator(alloc);
+    leaf->~Leaf();
+    std::allocator_traits<leaf_allocator>::deallocate(leaf_alloc, leaf, 1);
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+void FunctionMaximaBTree<T, NodeBytes, Alloc>::delete_node(Inner *inner) noexcept {
+    auto inner_alloc = inner_allocator(alloc);
+    inner->~Inner();
+    std::allocator_traits<inner_allocator>::deallocate(inner_alloc, inner, 1);
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+typename FunctionMaximaBTree<T, NodeBytes, Alloc>::Leaf *
+FunctionMaximaBTree<T, NodeBytes, Alloc>::take_leaf() noexcept {
+    Leaf *leaf = spare_leaves;
+    spare_leaves = leaf->next;
+    --spare_leaves_count;
+    leaf->prev = leaf->next = nullptr;
+    leaf->count = 0;
+    return leaf;
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+typename FunctionMaximaBTree<T, NodeBytes, Alloc>::Inner *
+FunctionMaximaBTree<T, NodeBytes, Alloc>::take_inner() noexcept {
+    Inner *inner = spare_inners;
+    spare_inners = static_cast<Inner *>(inner->children[0]);
+    --spare_inners_count;
+    inner->count = 0;
+    return inner;
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+typename FunctionMaximaBTree<T, NodeBytes, Alloc>::Inner *
+FunctionMaximaBTree<T, NodeBytes, Alloc>::insert_child(Inner *parent, size_type pos, void *child, size_type size,
+                                                size_type level) noexcept {
+    Inner *target = parent, *split = nullptr;
+    if (parent->count == inner_capacity) {
+        split = take_inner();
+        size_type half = inner_capacity / 2;
+        split->count = parent->count - half;
+        std::copy(parent->sizes + half, parent->sizes + parent->count, split->sizes);
+        std::copy(parent->children + half, parent->children + parent->count, split->children);
+        move_items(parent->firsts() + half, split->count, split->firsts());
+        parent->count = half;
+
+        if (pos > half) {
+            pos -= half;
+            target = split;
+        }
+    }
+
+    std::copy_backward(target->sizes + pos, target->sizes + target->count, target->sizes + target->count + 1);
+    std::copy_backward(target->children + pos, target->children + target->count,
+                       target->children + target->count + 1);
+    target->sizes[pos] = size;
+    target->children[pos] = child;
+    insert_item(target->firsts(), target->count, pos, first_of(child, level));
+    ++target->count;
+    return split;
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+void FunctionMaximaBTree<T, NodeBytes, Alloc>::rebalance(Inner *parent, size_type i, size_type level) noexcept {
+    size_type l = (i > 0 ? i - 1 : i), r = l + 1;
+    void *left = parent->children[l], *right = parent->children[r];
+    size_type capacity = (level == 0 ? leaf_capacity : inner_capacity);
+    auto count = [level](void *node) {
+        return (level == 0 ? static_cast<Leaf *>(node)->count : static_cast<Inner *>(node)->count);
+    };
+
+    if (count(left) + count(right) <= capacity) {
+        merge(left, right, level);
+        parent->sizes[l] += parent->sizes[r];
+        std::copy(parent->sizes + r + 1, parent->sizes + parent->count, parent->sizes + r);
+        std::copy(parent->children + r + 1, parent->children + parent->count, parent->children + r);
+        erase_item(parent->firsts(), parent->count, r);
+        --parent->count;
+        parent->firsts()[l] = first_of(left, level);
+        return;
+    }
+
+    // One item (child) goes from the fuller node to its neighbour.
+    bool to_left = count(left) < count(right);
+    if (level == 0) {
+        auto left_leaf = static_cast<Leaf *>(left), right_leaf = static_cast<Leaf *>(right);
+        if (to_left) {
+            insert_item(left_leaf->items(), left_leaf->count, left_leaf->count, right_leaf->items()[0]);
+            erase_item(right_leaf->items(), right_leaf->count, 0);
+            ++left_leaf->count;
+            --right_leaf->count;
+        } else {
+            insert_item(right_leaf->items(), right_leaf->count, 0, left_leaf->items()[left_leaf->count - 1]);
+            erase_item(left_leaf->items(), left_leaf->count, left_leaf->count - 1);
+            ++right_leaf->count;
+            --left_leaf->count;
+        }
+    } else {
+        auto left_inner = static_cast<Inner *>(left), right_inner = static_cast<Inner *>(right);
+        if (to_left) {
+            insert_child(left_inner, left_inner->count, right_inner->children[0], right_inner->sizes[0], level - 1);
+            std::copy(right_inner->sizes + 1, right_inner->sizes + right_inner->count, right_inner->sizes);
+            std::copy(right_inner->children + 1, right_inner->children + right_inner->count, right_inner->children);
+            erase_item(right_inner->firsts(), right_inner->count, 0);
+            --right_inner->count;
+        } else {
+            size_type last = left_inner->count - 1;
+            insert_child(right_inner, 0, left_inner->children[last], left_inner->sizes[last], level - 1);
+            left_inner->firsts()[last].~T();
+            --left_inner->count;
+        }
+    }
+
+    parent->sizes[l] = size_of(left, level);
+    parent->sizes[r] = size_of(right, level);
+    parent->firsts()[l] = first_of(left, level);
+    parent->firsts()[r] = first_of(right, level);
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+void FunctionMaximaBTree<T, NodeBytes, Alloc>::merge(void *left, void *right, size_type level) noexcept {
+    if (level == 0) {
+        auto left_leaf = static_cast<Leaf *>(left), right_leaf = static_cast<Leaf *>(right);
+        move_items(right_leaf->items(), right_leaf->count, left_leaf->items() + left_leaf->count);
+        left_leaf->count += right_leaf->count;
+        left_leaf->next = right_leaf->next;
+        (right_leaf->next != nullptr ? right_leaf->next->prev : last_leaf) = left_leaf;
+        delete_node(right_leaf);
+    } else {
+        auto left_inner = static_cast<Inner *>(left), right_inner = static_cast<Inner *>(right);
+        std::copy(right_inner->sizes, right_inner->sizes + right_inner->count, left_inner->sizes + left_inner->count);
+        std::copy(right_inner->children, right_inner->children + right_inner->count,
+                  left_inner->children + left_inner->count);
+        move_items(right_inner->firsts(), right_inner->count, left_inner->firsts() + left_inner->count);
+        left_inner->count += right_inner->count;
+        delete_node(right_inner);
+    }
+}
+
+template<typename T, size_t NodeBytes, typename Alloc>
+void FunctionMaximaBTree<T, NodeBytes, Alloc>::release(void *node, size_type level) noexcept {
+    if (level == 0) {
+        auto leaf = static_cast<Leaf *>(node);
+        std::destroy(leaf->items(), leaf->items() + leaf->count);
+        delete_node(leaf);
+        return;
+    }
+
+    auto inner = static_cast<Inner *>(node);
+    for (size_type i = 0; i < inner->count; ++i)
+        release(inner->children[i], level - 1);
+    std::destroy(inner->firsts(), inner->firsts() + inner->count);
+    delete_node(inner);
+}
+
+
+// Storage policy of an index of BTreeFunctionMaxima: a FunctionMaximaBTree with nodes of NodeBytes bytes.
+template<size_t NodeBytes = 256>
+struct BTreeStorage {};
+
+// Storage policy of an index of BTreeFunctionMaxima: a std::set, as in FunctionMaxima.
+struct SetStorage {};
+
+/* Items of T ordered by Compare, kept as chosen by Storage. Updates are given positions found by lower_bound
+ * before the update, so everything that compares is done before anything changes.
+ * apply() erases the items at removed positions and inserts inserted items (sorted by Compare) at theirs,
+ * all the positions found before it, with strong exception guarantee.
+ */
+template<typename T, typename Compare, typename Alloc, typename Storage>
+class FunctionMaximaStore;
+
+/* Positions are ranks, so updates never compare, and insertions use nodes reserved beforehand,
+ * so they do not throw.
+ */
+template<typename T, typename Compare, typename Alloc, size_t NodeBytes>
+class FunctionMaximaStore<T, Compare, Alloc, BTreeStorage<NodeBytes>> {
+    using tree_type = FunctionMaximaBTree<T, NodeBytes, Alloc>;
+
+public:
+    using size_type = size_t;
+
+    using iterator = typename tree_type::iterator;
+
+    struct position {
+        size_type rank;
+        iterator it; // Invalidated by any update.
+    };
+
+    struct Insertion {
+        position pos;
+        const T *item;
+    };
+
+    static constexpr bool nothrow_insert = true;
+
+    explicit FunctionMaximaStore(const Alloc &alloc) noexcept : tree(alloc) {}
+
+    FunctionMaximaStore(const FunctionMaximaStore &other, const Alloc &alloc) : tree(other.tree, alloc) {}
+
+    FunctionMaximaStore(FunctionMaximaStore &&other) noexcept = default;
+
+    void swap(FunctionMaximaStore &other) noexcept {
+        tree.swap(other.tree);
+    }
+
+    Alloc get_allocator() const noexcept {
+        return tree.get_allocator();
+    }
+
+    size_type size() const noexcept {
+        return tree.size();
+    }
+
+    iterator begin() const noexcept {
+        return tree.begin();
+    }
+
+    iterator end() const noexcept {
+        return tree.end();
+    }
+
+    // Position of the first item not less than key, found by one descent.
+    template<typename Key>
+    position lower_bound(const Key &key) const {
+        auto found = tree.partition_point([&key](const T &item) { return Compare()(item, key); });
+        return position{found.first, found.second};
+    }
+
+    static iterator at(const position &pos) noexcept {
+        return pos.it;
+    }
+
+    void reserve(size_type insertions) {
+        tree.reserve(insertions);
+    }
+
+    // The position of the inserted item has only its rank, iterators are invalidated.
+    position insert(const position &pos, const T &item) noexcept {
+        tree.insert(pos.rank, item);
+        return position{pos.rank, iterator()};
+    }
+
+    void replace(const position &pos, const T &item) noexcept {
+        tree.replace(pos.rank, item);
+    }
+
+    void erase(const position &pos) noexcept {
+        tree.erase(pos.rank);
+    }
+
+    // Removed items are erased from the last one, then the insertions are moved back by the removed items before them.
+    void apply(position *removed, size_type removed_count, Insertion *inserted, size_type inserted_count) noexcept {
+        auto by_rank = [](const position &lk, const position &rk) { return lk.rank < rk.rank; };
+        std::sort(removed, removed + removed_count, by_rank);
+        for (size_type k = removed_count; k-- > 0;)
+            tree.erase(removed[k].rank);
+
+        for (size_type k = 0; k < inserted_count; ++k) {
+            auto rank = inserted[k].pos.rank;
+            auto before = static_cast<size_type>(std::partition_point(removed, removed + removed_count,
+                                                                      [rank](const position &pos) {
+                                                                          return pos.rank < rank;
+                                                                      }) - removed);
+            tree.insert(rank - before + k, *inserted[k].item);
+        }
+    }
+
+private:
+    tree_type tree;
+};
+
+/* Positions are iterators, which stay valid until their items are erased.
+ * Insertions allocate nodes and compare, so they might throw.
+ */
+template<typename T, typename Compare, typename Alloc>
+class FunctionMaximaStore<T, Compare, Alloc, SetStorage> {
+    using set_allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<T>;
+
+    using set_type = std::set<T, Compare, set_allocator>;
+
+public:
+    using size_type = size_t;
+
+    using iterator = typename set_type::const_iterator;
+
+    using position = iterator;
+
+    struct Insertion {
+        position pos;
+        const T *item;
+    };
+
+    static constexpr bool nothrow_insert = false;
+
+    explicit FunctionMaximaStore(const Alloc &alloc) : items(Compare(), set_allocator(alloc)) {}
+
+    FunctionMaximaStore(const FunctionMaximaStore &other, const Alloc &alloc)
+            : items(other.items, set_allocator(alloc)) {}
+
+    FunctionMaximaStore(FunctionMaximaStore &&other) noexcept = default;
+
+    void swap(FunctionMaximaStore &other) noexcept {
+        items.swap(other.items); // Swapping sets is noexcept.
+    }
+
+    Alloc get_allocator() const noexcept {
+        return Alloc(items.get_allocator());
+    }
+
+    size_type size() const noexcept {
+        return items.size();
+    }
+
+    iterator begin() const noexcept {
+        return items.begin();
+    }
+
+    iterator end() const noexcept {
+        return items.end();
+    }
+
+    template<typename Key>
+    position lower_bound(const Key &key) const {
+        return items.lower_bound(key);
+    }
+
+    static iterator at(const position &pos) noexcept {
+        return pos;
+    }
+
+    // Nodes of the set are allocated by insertions.
+    void reserve(size_type) noexcept {}
+
+    // Strong exception guarantee.
+    position insert(const position &pos, const T &item) {
+        return items.insert(pos, item);
+    }
+
+    // The item keeps its place in the order, so it is assigned inside its node.
+    void replace(const position &pos, const T &item) noexcept {
+        const_cast<T &>(*pos) = item;
+    }
+
+    void erase(const position &pos) noexcept {
+        items.erase(pos);
+    }
+
+    // Positions of insertions are replaced by the inserted items, which are erased again if one of them throws.
+    void apply(position *removed, size_type removed_count, Insertion *inserted, size_type inserted_count) {
+        size_type k = 0;
+        try {
+            for (; k < inserted_count; ++k)
+                inserted[k].pos = items.insert(inserted[k].pos, *inserted[k].item);
+        } catch (...) {
+            while (k > 0)
+                items.erase(inserted[--k].pos);
+            throw;
+        }
+
+        for (k = 0; k < removed_count; ++k)
+            items.erase(removed[k]);
+    }
+
+private:
+    set_type items;
+};
+
+/* Alternative to FunctionMaxima for big functions looked up by arguments. Points and local maxima are kept
+ * in two indices chosen separately by PointsStorage and MaximaStorage: B+ trees (BTreeStorage) with nodes
+ * of a few cache lines, so a lookup visits O(log_B n) nodes instead of O(log n) nodes of a red-black tree,
+ * or std::sets (SetStorage). Points of A and V chosen by InlinePoints are kept in the nodes themselves,
+ * so a search compares items lying next to each other, other ones share blocks allocated with Alloc,
+ * which allocates the nodes of both indices as well.
+ * Public interface is the same as the one of FunctionMaxima, with strong exception guarantee of updates:
+ * everything which might throw (comparisons, allocations of the point and of B-tree nodes) is done before
+ * the indices are changed, only insertions into std::sets might throw later and they are undone then.
+ * Unlike in FunctionMaxima, set_value and erase invalidate all iterators of B-tree indices.
+ */
+template<typename A, typename V, typename Alloc = std::allocator<std::pair<A, V>>,
+        typename PointsStorage = BTreeStorage<>, typename MaximaStorage = BTreeStorage<>>
+class BTreeFunctionMaxima {
+private:
+    class PointsComparator; // Orders points by arguments, compares them with arguments as well.
+
+    class MaximaComparator; // Orders local maxima by values descending, then by arguments.
+
+    class MaximaUpdate; // Changes of local maxima gathered before anything is modified.
+
+public:
+    class PointType;
+
+    using point_type = PointType;
+
+    using allocator_type = Alloc;
+
+private:
+    using alloc_traits = std::allocator_traits<Alloc>;
+
+    using points_store = FunctionMaximaStore<PointType, PointsComparator, Alloc, PointsStorage>;
+
+    using maxima_store = FunctionMaximaStore<PointType, MaximaComparator, Alloc, MaximaStorage>;
+
+    // Indices might be swapped only if their allocators are swapped with them or are always equal.
+    static constexpr bool allocators_swappable = alloc_traits::propagate_on_container_swap::value ||
+                                                 alloc_traits::is_always_equal::value;
+
+public:
+    BTreeFunctionMaxima() : BTreeFunctionMaxima(Alloc()) {}
+
+    explicit BTreeFunctionMaxima(const Alloc &alloc);
+
+    BTreeFunctionMaxima(const BTreeFunctionMaxima &other);
+
+    BTreeFunctionMaxima(const BTreeFunctionMaxima &other, const Alloc &alloc);
+
+    BTreeFunctionMaxima(BTreeFunctionMaxima &&other) noexcept = default;
+
+    BTreeFunctionMaxima &operator=(BTreeFunctionMaxima other) noexcept(allocators_swappable);
+
+    void swap(BTreeFunctionMaxima &other) noexcept;
+
+    Alloc get_allocator() const noexcept;
+
+    V const &value_at(A const &a) const;
+
+    // Strong exception guarantee.
+    void set_value(A const &a, V const &v);
+
+    // Strong exception guarantee.
+    void erase(A const &a);
+
+    using iterator = typename points_store::iterator;
+
+    iterator begin() const noexcept;
+
+    iterator end() const noexcept;
+
+    iterator find(A const &a) const;
+
+    using mx_iterator = typename maxima_store::iterator;
+
+    mx_iterator mx_begin() const noexcept;
+
+    mx_iterator mx_end() const noexcept;
+
+    using size_type = size_t;
+
+    size_type size() const noexcept;
+
+    ~BTreeFunctionMaxima() noexcept = default;
+
+private:
+    // Returns true only if a point with value v between left and right (null if missing) is a local maximum.
+    static bool is_local_maximum(const V &v, const PointType *left, const PointType *right);
+
+    // Used for storing all the points sorted by their arguments.
+    points_store function_points;
+
+    // Used for storing local maxima.
+    maxima_store local_maxima;
+};
+
+template<typename A, typename V, typename Alloc, typename PointsStorage, typename MaximaStorage>
+class BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::PointType {
+public:
+    // Copying enabled.
+    PointType(const PointType &other) noexcept = default;
+
+    // Assigning enabled.
+    PointType &operator=(PointType other) noexcept {
+        std::swap(point_data, other.point_data);
+        return *this;
+    }
+
+    A const &arg() const noexcept {
+        if constexpr (stored_inline)
+            return point_data.argument;
+        else
+            return point_data->argument;
+    }
+
+    V const &value() const noexcept {
+        if constexpr (stored_inline)
+            return point_data.value;
+        else
+            return point_data->value;
+    }
+
+private:
+    friend class BTreeFunctionMaxima;
+
+    struct PointData {
+        PointData(const A &arg, const V &val) : argument(arg), value(val) {}
+
+        const A argument;
+        const V value;
+    };
+
+    // A and V of inline points.
+    struct InlineData {
+        A argument;
+        V value;
+    };
+
+    static constexpr bool stored_inline = InlinePoints<A, V>::value;
+
+    // InlinePoints might be specialised, points are copied and swapped inside nodes without throwing.
+    static_assert(!stored_inline || (std::is_nothrow_copy_constructible<InlineData>::value &&
+                                     std::is_nothrow_move_constructible<InlineData>::value &&
+                                     std::is_nothrow_move_assignable<InlineData>::value),
+                  "A and V of inline points have to be copied and moved without throwing.");
+
+    using data_allocator = typename alloc_traits::template rebind_alloc<PointData>;
+
+    using data_type = std::conditional_t<stored_inline, InlineData, std::shared_ptr<const PointData>>;
+
+    // Creating new points is disabled for interface users.
+    PointType(const A &arg, const V &val, const Alloc &alloc) : point_data(make_data(arg, val, alloc)) {}
+
+    static data_type make_data(const A &arg, const V &val, const Alloc &alloc) {
+        if constexpr (stored_inline)
+            return InlineData{arg, val};
+        else
+            return std::allocate_shared<PointData>(data_allocator(alloc), arg, val);
+    }
+
+    data_type point_data;
+};
+
+template<typename A, typename V, typename Alloc, typename PointsStorage, typename MaximaStorage>
+class BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::PointsComparator {
+public:
+    using is_transparent = std::true_type;
+
+    bool operator()(const PointType &lk, const PointType &rk) const {
+        return lk.arg() < rk.arg();
+    }
+
+    bool operator()(const PointType &lk, const A &rk) const {
+        return lk.arg() < rk;
+    }
+
+    bool operator()(const A &lk, const PointType &rk) const {
+        return lk < rk.arg();
+    }
+};
+
+template<typename A, typename V, typename Alloc, typename PointsStorage, typename MaximaStorage>
+class BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::MaximaComparator {
+public:
+    bool operator()(const PointType &lk, const PointType &rk) const {
+        if (lk.value() < rk.value() || rk.value() < lk.value())
+            return rk.value() < lk.value();
+        return lk.arg() < rk.arg();
+    }
+};
+
+/* Stores at most three removed and at most three inserted local maxima,
+ * given by their positions inside local_maxima before the update.
+ */
+template<typename A, typename V, typename Alloc, typename PointsStorage, typename MaximaStorage>
+class BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::MaximaUpdate {
+    using position = typename maxima_store::position;
+
+    using Insertion = typename maxima_store::Insertion;
+
+public:
+    MaximaUpdate() noexcept : removed_count(0), inserted_count(0) {}
+
+    void remove(const position &pos) noexcept {
+        removed[removed_count++] = pos;
+    }
+
+    // Point has to stay alive until apply() is called.
+    void insert(const position &pos, const PointType &point) noexcept {
+        inserted[inserted_count++] = Insertion{pos, &point};
+    }
+
+    size_type inserted_size() const noexcept {
+        return inserted_count;
+    }
+
+    // Sorts the insertions in the order of local_maxima. Has to be called before anything is modified.
+    void order() {
+        // Insertion sort, there are at most three of them.
+        for (size_type i = 1; i < inserted_count; ++i) {
+            for (size_type j = i; j > 0 && MaximaComparator()(*inserted[j].item, *inserted[j - 1].item); --j)
+                std::swap(inserted[j], inserted[j - 1]);
+        }
+    }
+
+    // Strong exception guarantee, nothing throws if local_maxima is a B-tree with nodes reserved.
+    void apply(maxima_store &local_maxima) {
+        local_maxima.apply(removed, removed_count, inserted, inserted_count);
+    }
+
+private:
+    position removed[3];
+    Insertion inserted[3];
+    size_type removed_count, inserted_count;
+};
+
+template<typename A, typename V, typename Alloc, typename PointsStorage, typename MaximaStorage>
+BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::BTreeFunctionMaxima(const Alloc &alloc)
+        : function_points(alloc), local_maxima(alloc) {}
+
+template<typename A, typename V, typename Alloc, typename PointsStorage, typename MaximaStorage>
+BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::BTreeFunctionMaxima(const BTreeFunctionMaxima &other)
+        : BTreeFunctionMaxima(other, alloc_traits::select_on_container_copy_construction(other.get_allocator())) {}
+
+/* Indices are copied as they are if points are inline or come from the same allocator,
+ * otherwise the points are created again with alloc, so none of them is released with the allocator of other.
+ */
+template<typename A, typename V, typename Alloc, typename PointsStorage, typename MaximaStorage>
+BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::BTreeFunctionMaxima(
+        const BTreeFunctionMaxima &other, const Alloc &alloc)
+        : function_points(alloc), local_maxima(alloc) {
+    if (PointType::stored_inline || alloc == other.get_allocator()) {
+        auto points_copy = points_store(other.function_points, alloc);
+        auto maxima_copy = maxima_store(other.local_maxima, alloc);
+        function_points.swap(points_copy); // Allocators are equal.
+        local_maxima.swap(maxima_copy);
+        return;
+    }
+
+    for (const auto &point : other) {
+        function_points.reserve(1);
+        function_points.insert(function_points.lower_bound(point.arg()), PointType(point.arg(), point.value(), alloc));
+    }
+    for (auto it = other.mx_begin(); it != other.mx_end(); ++it) {
+        const PointType &point = *function_points.at(function_points.lower_bound(it->arg()));
+        local_maxima.reserve(1);
+        local_maxima.insert(local_maxima.lower_bound(point), point);
+    }
+}
+
+template<typename A, typename V, typename Alloc, typename PointsStorage, typename MaximaStorage>
+BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage> &
+BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::operator=(BTreeFunctionMaxima other)
+noexcept(allocators_swappable) {
+    if (!allocators_swappable && !(get_allocator() == other.get_allocator())) {
+        // Indices with different allocators might not be swapped, points are copied into ours first.
+        auto copy = BTreeFunctionMaxima(other, get_allocator());
+        swap(copy);
+    } else {
+        swap(other);
+    }
+
+    return *this;
+}
+
+template<typename A, typename V, typename Alloc, typename PointsStorage, typename MaximaStorage>
+void BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::swap(BTreeFunctionMaxima &other) noexcept {
+    function_points.swap(other.function_points);
+    local_maxima.swap(other.local_maxima);
+}
+
+template<typename A, typename V, typename Alloc, typename PointsStorage, typename MaximaStorage>
+Alloc BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::get_allocator() const noexcept {
+    return function_points.get_allocator();
+}
+
+template<typename A, typename V, typename Alloc, typename PointsStorage, typename MaximaStorage>
+V const &BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::value_at(const A &a) const {
+    // If a does not belong to the domain - InvalidArg is thrown.
+    auto it = find(a);
+    if (it != end())
+        return (*it).value();
+    throw InvalidArg();
+}
+
+template<typename A, typename V, typename Alloc, typename PointsStorage, typename MaximaStorage>
+void BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::set_value(const A &a, const V &v) {
+    auto pos = function_points.lower_bound(a);
+    auto it = function_points.at(pos);
+    const PointType *old_point = (it != end() && !(a < (*it).arg()) ? &*it : nullptr);
+    if (old_point != nullptr && !(v < old_point->value()) && !(old_point->value() < v))
+        return; // Nothing changes if we set the same value for a.
+
+    // Neighbours and their outer neighbours, reached by stepping through the leaves.
+    const PointType *left = nullptr, *left_left = nullptr, *right = nullptr, *right_right = nullptr;
+    if (it != begin()) {
+        auto left_it = std::prev(it);
+        left = &*left_it;
+        left_left = (left_it != begin() ? &*std::prev(left_it) : nullptr);
+    }
+    auto right_it = (old_point != nullptr ? std::next(it) : it);
+    if (right_it != end()) {
+        right = &*right_it;
+        right_right = (std::next(right_it) != end() ? &*std::next(right_it) : nullptr);
+    }
+
+    auto new_point = PointType(a, v, get_allocator());
+
+    bool was_maximum = old_point != nullptr && is_local_maximum(old_point->value(), left, right);
+    bool left_was_maximum = left != nullptr &&
+                            is_local_maximum(left->value(), left_left, old_point != nullptr ? old_point : right);
+    bool right_was_maximum = right != nullptr &&
+                             is_local_maximum(right->value(), old_point != nullptr ? old_point : left, right_right);
+    bool is_maximum = is_local_maximum(v, left, right);
+    bool left_is_maximum = left != nullptr && is_local_maximum(left->value(), left_left, &new_point);
+    bool right_is_maximum = right != nullptr && is_local_maximum(right->value(), &new_point, right_right);
+
+    // Positions are found (all the comparisons are done) before anything is modified.
+    MaximaUpdate update;
+    if (was_maximum)
+        update.remove(local_maxima.lower_bound(*old_point));
+    if (left_was_maximum && !left_is_maximum)
+        update.remove(local_maxima.lower_bound(*left));
+    if (right_was_maximum && !right_is_maximum)
+        update.remove(local_maxima.lower_bound(*right));
+    if (is_maximum)
+        update.insert(local_maxima.lower_bound(new_point), new_point);
+    if (left_is_maximum && !left_was_maximum)
+        update.insert(local_maxima.lower_bound(*left), *left);
+    if (right_is_maximum && !right_was_maximum)
+        update.insert(local_maxima.lower_bound(*right), *right);
+    update.order();
+
+    // Nodes of B-tree indices are reserved, only insertions into std::sets might throw from here on.
+    function_points.reserve(old_point != nullptr ? 0 : 1);
+    local_maxima.reserve(update.inserted_size());
+
+    if (old_point != nullptr) {
+        // Points of the update are copied into local_maxima before the old one is replaced in function_points.
+        update.apply(local_maxima);
+        function_points.replace(pos, new_point);
+    } else if constexpr (points_store::nothrow_insert) {
+        // Inserting into a B-tree moves its items, so the neighbours are copied into local_maxima first.
+        update.apply(local_maxima);
+        function_points.insert(pos, new_point);
+    } else {
+        // Items of a std::set stay in place, the point is erased again if updating local_maxima throws.
+        auto inserted = function_points.insert(pos, new_point);
+        try {
+            update.apply(local_maxima);
+        } catch (...) {
+            function_points.erase(inserted);
+            throw;
+        }
+    }
+}
+
+template<typename A, typename V, typename Alloc, typename PointsStorage, typename MaximaStorage>
+void BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::erase(const A &a) {
+    auto pos = function_points.lower_bound(a);
+    auto it = function_points.at(pos);
+    if (it == end() || a < (*it).arg())
+        return;
+    const PointType &old_point = *it;
+
+    const PointType *left = nullptr, *left_left = nullptr, *right = nullptr, *right_right = nullptr;
+    if (it != begin()) {
+        auto left_it = std::prev(it);
+        left = &*left_it;
+        left_left = (left_it != begin() ? &*std::prev(left_it) : nullptr);
+    }
+    auto right_it = std::next(it);
+    if (right_it != end()) {
+        right = &*right_it;
+        right_right = (std::next(right_it) != end() ? &*std::next(right_it) : nullptr);
+    }
+
+    bool was_maximum = is_local_maximum(old_point.value(), left, right);
+    bool left_was_maximum = left != nullptr && is_local_maximum(left->value(), left_left, &old_point);
+    bool right_was_maximum = right != nullptr && is_local_maximum(right->value(), &old_point, right_right);
+    bool left_is_maximum = left != nullptr && is_local_maximum(left->value(), left_left, right);
+    bool right_is_maximum = right != nullptr && is_local_maximum(right->value(), left, right_right);
+
+    MaximaUpdate update;
+    if (was_maximum)
+        update.remove(local_maxima.lower_bound(old_point));
+    if (left_was_maximum && !left_is_maximum)
+        update.remove(local_maxima.lower_bound(*left));
+    if (right_was_maximum && !right_is_maximum)
+        update.remove(local_maxima.lower_bound(*right));
+    if (left_is_maximum && !left_was_maximum)
+        update.insert(local_maxima.lower_bound(*left), *left);
+    if (right_is_maximum && !right_was_maximum)
+        update.insert(local_maxima.lower_bound(*right), *right);
+    update.order();
+
+    local_maxima.reserve(update.inserted_size());
+
+    // The neighbours are copied into local_maxima before the point is erased from function_points.
+    update.apply(local_maxima);
+    function_points.erase(pos);
+}
+
+template<typename A, typename V, typename Alloc, typename PointsStorage, typename MaximaStorage>
+typename BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::iterator
+BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::begin() const noexcept {
+    return function_points.begin();
+}
+
+template<typename A, typename V, typename Alloc, typename PointsStorage, typename MaximaStorage>
+typename BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::iterator
+BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::end() const noexcept {
+    return function_points.end();
+}
+
+template<typename A, typename V, typename Alloc, typename PointsStorage, typename MaximaStorage>
+typename BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::iterator
+BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::find(const A &a) const {
+    auto it = function_points.at(function_points.lower_bound(a));
+    return (it != end() && !(a < (*it).arg()) ? it : end());
+}
+
+template<typename A, typename V, typename Alloc, typename PointsStorage, typename MaximaStorage>
+typename BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::mx_iterator
+BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::mx_begin() const noexcept {
+    return local_maxima.begin();
+}
+
+template<typename A, typename V, typename Alloc, typename PointsStorage, typename MaximaStorage>
+typename BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::mx_iterator
+BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::mx_end() const noexcept {
+    return local_maxima.end();
+}
+
+template<typename A, typename V, typename Alloc, typename PointsStorage, typename MaximaStorage>
+typename BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::size_type
+BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::size() const noexcept {
+    return function_points.size();
+}
+
+template<typename A, typename V, typename Alloc, typename PointsStorage, typename MaximaStorage>
+bool BTreeFunctionMaxima<A, V, Alloc, PointsStorage, MaximaStorage>::is_local_maximum(const V &v,
+                                                                                     const PointType *left,
+                                                                                     const PointType *right) {
+    return (left == nullptr || !(v < left->value())) && (right == nullptr || !(v < right->value()));
+}
+
+#endif // BTREE_FUNCTION_MAXIMA_H
@@ -0,0 +1,286 @@
+#ifndef CONCURRENT_FUNCTION_MAXIMA_H
+#define CONCURRENT_FUNCTION_MAXIMA_H
+
+#include "function_maxima.h"
+
+#include <mutex>
+#include <shared_mutex>
+#include <optional>
+#include <memory>
+#include <atomic>
+#include <vector>
+#include <utility>
+
+/* FunctionMaxima shared between threads. Readers (value_at, find, maxima, ...) hold a shared lock,
+ * writers (set_value, erase, ...) hold an exclusive one. Every call takes the lock, so short reads are
+ * dominated by its contention: read() and snapshot() amortise it over many of them.
+ * Nothing returned refers to the function itself: values are copied and points are handles sharing
+ * their blocks with the function (so the counter is always atomic), or copies of small A and V kept inline
+ * (see InlinePoints), they stay valid after later updates.
+ * Local maxima are iterated over a copy of their points taken under one lock (maxima()),
+ * anything else might be done by read() holding the lock for a whole callback.
+ * snapshot() gives an immutable version of the function, iterated without any locks while writers continue.
+ * Versions are copied on write: the first update after a snapshot copies the function (sharing the blocks
+ * of the points), until then taking more snapshots costs O(1).
+ * Strong exception guarantee of all the updates is kept.
+ * It might be used with FUNCTION_MAXIMA_STATS: const methods of the function count only into the counters
+ * of their own threads, stats() of the function sums the updates, which are made under the exclusive lock.
+ */
+template<typename A, typename V, typename Alloc = std::allocator<std::pair<A, V>>,
+        typename Index = NoRangeIndex, typename Minima = NoLocalMinima>
+class ConcurrentFunctionMaxima {
+public:
+    using function_type = FunctionMaxima<A, V, AtomicRefCount, Alloc, Index, Minima>;
+
+    using point_type = typename function_type::point_type;
+
+    using size_type = typename function_type::size_type;
+
+    ConcurrentFunctionMaxima();
+
+    explicit ConcurrentFunctionMaxima(const Alloc &alloc);
+
+    explicit ConcurrentFunctionMaxima(function_type function);
+
+    template<typename ForwardIt>
+    ConcurrentFunctionMaxima(ForwardIt first, ForwardIt last, const Alloc &alloc = Alloc());
+
+    // Instances are neither copied nor moved, copy() gives a consistent copy of the function.
+    ConcurrentFunctionMaxima(const ConcurrentFunctionMaxima &other) = delete;
+
+    ConcurrentFunctionMaxima &operator=(const ConcurrentFunctionMaxima &other) = delete;
+
+    function_type copy() const;
+
+    using snapshot_type = std::shared_ptr<const function_type>;
+
+    /* The function at this moment, it never changes and it might be kept and read without locks for as long
+     * as needed, from many threads at once (except for aggregate(), see FunctionMaxima).
+     */
+    snapshot_type snapshot() const;
+
+    V value_at(A const &a) const;
+
+    // The point with argument a, if there is one.
+    std::optional<point_type> find(A const &a) const;
+
+    size_type size() const;
+
+    // Local maxima in the order of mx_begin() - mx_end() of the function at one moment.
+    std::vector<point_type> maxima() const;
+
+    // The first local maximum (global_max() and argmax() of one moment), InvalidArg is thrown if there are no points.
+    point_type maximum() const;
+
+    // The same as maximum() for global_min() and argmin().
+    point_type minimum() const;
+
+    // Requires Index = RangeIndex, the point returned by max_in_range(lo, hi) of the function, if there is one.
+    std::optional<point_type> max_in_range(const A &lo, const A &hi) const;
+
+    void set_value(A const &a, V const &v);
+
+    void erase(A const &a);
+
+    template<typename ForwardIt>
+    void set_values(ForwardIt first, ForwardIt last);
+
+    template<typename Range>
+    void set_values(const Range &points);
+
+    template<typename ForwardIt>
+    void erase_many(ForwardIt first, ForwardIt last);
+
+    template<typename Range>
+    void erase_many(const Range &arguments);
+
+    /* Calls f(const function_type &) under the shared lock and returns its result. Iterators must not leave f,
+     * and f must not call aggregate() (see FunctionMaxima).
+     */
+    template<typename F>
+    decltype(auto) read(F &&f) const;
+
+    // Calls f(function_type &) under the exclusive lock and returns its result.
+    template<typename F>
+    decltype(auto) write(F &&f);
+
+private:
+    using shared_lock = std::shared_lock<std::shared_mutex>;
+
+    using unique_lock = std::unique_lock<std::shared_mutex>;
+
+    // Version of the function with the number of snapshots still reading it.
+    struct Version {
+        template<typename... Args>
+        explicit Version(Args &&... args) : function(std::forward<Args>(args)...) {}
+
+        function_type function;
+        mutable std::atomic<size_t> snapshots{0}; // Released snapshots decrement it with release ordering.
+    };
+
+    // The current version, copied first if any snapshot still reads it. Requires the exclusive lock.
+    function_type &writable();
+
+    mutable std::shared_mutex mutex;
+
+    std::shared_ptr<Version> current;
+};
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::ConcurrentFunctionMaxima()
+        : current(std::make_shared<Version>()) {}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::ConcurrentFunctionMaxima(const Alloc &alloc)
+        : current(std::make_shared<Version>(alloc)) {}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::ConcurrentFunctionMaxima(function_type function)
+        : current(std::make_shared<Version>(std::move(function))) {}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+template<typename ForwardIt>
+ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::ConcurrentFunctionMaxima(ForwardIt first, ForwardIt last,
+                                                                               const Alloc &alloc)
+        : current(std::make_shared<Version>(first, last, alloc)) {}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+typename ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::function_type
+ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::copy() const {
+    auto lock = shared_lock(mutex);
+    return current->function;
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+typename ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::snapshot_type
+ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::snapshot() const {
+    auto lock = shared_lock(mutex);
+    // If creating the snapshot throws, the deleter is called anyway, so the counter stays balanced.
+    current->snapshots.fetch_add(1, std::memory_order_relaxed);
+    return snapshot_type(&current->function, [version = current](const function_type *) {
+        version->snapshots.fetch_sub(1, std::memory_order_release);
+    });
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+V ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::value_at(const A &a) const {
+    auto lock = shared_lock(mutex);
+    return current->function.value_at(a);
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+std::optional<typename ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::point_type>
+ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::find(const A &a) const {
+    auto lock = shared_lock(mutex);
+    auto it = current->function.find(a);
+    if (it == current->function.end())
+        return std::nullopt;
+    return point_type(*it);
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+typename ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::size_type
+ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::size() const {
+    auto lock = shared_lock(mutex);
+    return current->function.size();
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+std::vector<typename ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::point_type>
+ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::maxima() const {
+    auto result = std::vector<point_type>();
+    auto lock = shared_lock(mutex);
+    // Copying points only shares their blocks, A and V are not copied.
+    result.assign(current->function.mx_begin(), current->function.mx_end());
+    return result;
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+typename ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::point_type
+ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::maximum() const {
+    auto lock = shared_lock(mutex);
+    if (current->function.mx_begin() == current->function.mx_end())
+        throw InvalidArg();
+    return *current->function.mx_begin();
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+typename ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::point_type
+ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::minimum() const {
+    auto lock = shared_lock(mutex);
+    // argmin() throws InvalidArg if there are no points.
+    return *current->function.find(current->function.argmin());
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+std::optional<typename ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::point_type>
+ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::max_in_range(const A &lo, const A &hi) const {
+    auto lock = shared_lock(mutex);
+    auto it = current->function.max_in_range(lo, hi);
+    if (it == current->function.end())
+        return std::nullopt;
+    return point_type(*it);
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+void ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::set_value(const A &a, const V &v) {
+    auto lock = unique_lock(mutex);
+    writable().set_value(a, v);
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+void ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::erase(const A &a) {
+    auto lock = unique_lock(mutex);
+    writable().erase(a);
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+template<typename ForwardIt>
+void ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::set_values(ForwardIt first, ForwardIt last) {
+    auto lock = unique_lock(mutex);
+    writable().set_values(first, last);
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+template<typename Range>
+void ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::set_values(const Range &points) {
+    set_values(std::begin(points), std::end(points));
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+template<typename ForwardIt>
+void ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::erase_many(ForwardIt first, ForwardIt last) {
+    auto lock = unique_lock(mutex);
+    writable().erase_many(first, last);
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+template<typename Range>
+void ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::erase_many(const Range &arguments) {
+    erase_many(std::begin(arguments), std::end(arguments));
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+template<typename F>
+decltype(auto) ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::read(F &&f) const {
+    auto lock = shared_lock(mutex);
+    return std::forward<F>(f)(static_cast<const function_type &>(current->function));
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+template<typename F>
+decltype(auto) ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::write(F &&f) {
+    auto lock = unique_lock(mutex);
+    return std::forward<F>(f)(writable());
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+typename ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::function_type &
+ConcurrentFunctionMaxima<A, V, Alloc, Index, Minima>::writable() {
+    // Snapshots are taken under the shared lock, so none is taken now. If copying throws, nothing has changed.
+    if (current->snapshots.load(std::memory_order_acquire) != 0)
+        current = std::make_shared<Version>(static_cast<const function_type &>(current->function));
+    return current->function;
+}
+
+#endif // CONCURRENT_FUNCTION_MAXIMA_H
@@ -0,0 +1,572 @@
+#ifndef FLAT_FUNCTION_MAXIMA_H
+#define FLAT_FUNCTION_MAXIMA_H
+
+#include "function_maxima.h"
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <type_traits>
+
+/* Alternative to FunctionMaxima for workloads with rare updates and heavy scans.
+ * Points are kept in one contiguous array sorted by arguments and local maxima are kept
+ * as an array of indices into it, sorted in the same order as FunctionMaxima::mx_begin() - mx_end().
+ * Public interface is the same as the one of FunctionMaxima, but set_value and erase cost O(n)
+ * and (as for std::vector) they invalidate all iterators.
+ */
+template<typename A, typename V>
+class FlatFunctionMaxima {
+private:
+    class MaximaIterator; // Iterator over local maxima, dereferences indices stored in local_maxima.
+
+    class MaximaUpdate; // Changes of local maxima gathered before anything is modified.
+
+public:
+    class PointType;
+
+    using point_type = PointType;
+
+    FlatFunctionMaxima() = default;
+
+    FlatFunctionMaxima(const FlatFunctionMaxima<A, V> &other) = default;
+
+    /* Builds a function from pairs (argument, value), if an argument repeats, the last value is taken.
+     * Takes O(n) for a range sorted by arguments (plus sorting local maxima), otherwise the range is sorted first.
+     */
+    template<typename ForwardIt>
+    FlatFunctionMaxima(ForwardIt first, ForwardIt last);
+
+    FlatFunctionMaxima(FlatFunctionMaxima<A, V> &&other) noexcept = default;
+
+    FlatFunctionMaxima &operator=(FlatFunctionMaxima<A, V> other) noexcept;
+
+    V const &value_at(A const &a) const;
+
+    // Strong exception guarantee.
+    void set_value(A const &a, V const &v);
+
+    // Strong exception guarantee.
+    void erase(A const &a);
+
+    using iterator = typename std::vector<point_type>::const_iterator;
+
+    iterator begin() const noexcept;
+
+    iterator end() const noexcept;
+
+    iterator find(A const &a) const;
+
+    using mx_iterator = MaximaIterator;
+
+    mx_iterator mx_begin() const noexcept;
+
+    mx_iterator mx_end() const noexcept;
+
+    using size_type = size_t;
+
+    size_type size() const noexcept;
+
+    ~FlatFunctionMaxima() noexcept = default;
+
+private:
+    // Points might be moved inside the array in place only if moving them never throws.
+    static constexpr bool nothrow_relocatable =
+            std::is_nothrow_move_constructible<A>::value && std::is_nothrow_move_assignable<A>::value &&
+            std::is_nothrow_move_constructible<V>::value && std::is_nothrow_move_assignable<V>::value;
+
+    // Otherwise points might be shifted inside the array by swapping them, if swapping never throws.
+    static constexpr bool nothrow_swappable = std::is_nothrow_swappable<A>::value && std::is_nothrow_swappable<V>::value;
+
+    // Returns the index of the first point with argument not less than a.
+    size_type lower_bound(const A &a) const;
+
+    // Returns true only if the point at index i is a local maximum.
+    bool is_local_maximum(size_type i) const;
+
+    // Returns true only if a point with value v placed between indices left and right would be a local maximum.
+    bool would_be_local_maximum(const V &v, size_type left, size_type right) const;
+
+    // Returns the position of the index of point i inside local_maxima (point i has to be a local maximum).
+    size_type mx_position(size_type i) const;
+
+    // Returns the number of local maxima preceding a point (a, v) in the order of local_maxima.
+    size_type mx_slot(const A &a, const V &v) const;
+
+    /* Replaces the point at pos (when replace is true), inserts new_point at pos (when new_point is not null)
+     * or erases the point at pos (otherwise). Changes nothing if an exception is thrown.
+     */
+    void update_points(size_type pos, bool replace, PointType *new_point);
+
+    // Used for storing all the points sorted by their arguments.
+    std::vector<point_type> function_points;
+
+    // Used for storing indices of local maxima.
+    std::vector<size_type> local_maxima;
+};
+
+template<typename A, typename V>
+class FlatFunctionMaxima<A, V>::PointType {
+public:
+    A const &arg() const noexcept {
+        return point_argument;
+    }
+
+    V const &value() const noexcept {
+        return point_value;
+    }
+
+private:
+    friend class FlatFunctionMaxima;
+
+    // Creating new points is disabled for interface users.
+    PointType(const A &arg, const V &val) : point_argument(arg), point_value(val) {}
+
+    friend void swap(PointType &lk, PointType &rk) noexcept(nothrow_swappable) {
+        using std::swap;
+        swap(lk.point_argument, rk.point_argument);
+        swap(lk.point_value, rk.point_value);
+    }
+
+    A point_argument; // Stored in place, scanning the points does not chase pointers.
+    V point_value;
+};
+
+template<typename A, typename V>
+class FlatFunctionMaxima<A, V>::MaximaIterator {
+public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = point_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const point_type *;
+    using reference = const point_type &;
+
+    MaximaIterator() noexcept : m_points(nullptr), m_it() {}
+
+    reference operator*() const noexcept {
+        return m_points[*m_it];
+    }
+
+    pointer operator->() const noexcept {
+        return m_points + *m_it;
+    }
+
+    reference operator[](difference_type n) const noexcept {
+        return m_points[m_it[n]];
+    }
+
+    MaximaIterator &operator++() noexcept {
+        ++m_it;
+        return *this;
+    }
+
+    MaximaIterator operator++(int) noexcept {
+        auto copy = *this;
+        ++m_it;
+        return copy;
+    }
+
+    MaximaIterator &operator--() noexcept {
+        --m_it;
+        return *this;
+    }
+
+    MaximaIterator operator--(int) noexcept {
+        auto copy = *this;
+        --m_it;
+        return copy;
+    }
+
+    MaximaIterator &operator+=(difference_type n) noexcept {
+        m_it += n;
+        return *this;
+    }
+
+    MaximaIterator &operator-=(difference_type n) noexcept {
+        m_it -= n;
+        return *this;
+    }
+
+    friend MaximaIterator operator+(MaximaIterator it, difference_type n) noexcept {
+        return it += n;
+    }
+
+    friend MaximaIterator operator-(MaximaIterator it, difference_type n) noexcept {
+        return it -= n;
+    }
+
+    friend difference_type operator-(const MaximaIterator &lk, const MaximaIterator &rk) noexcept {
+        return lk.m_it - rk.m_it;
+    }
+
+    friend bool operator==(const MaximaIterator &lk, const MaximaIterator &rk) noexcept {
+        return lk.m_it == rk.m_it;
+    }
+
+    friend bool operator!=(const MaximaIterator &lk, const MaximaIterator &rk) noexcept {
+        return lk.m_it != rk.m_it;
+    }
+
+    friend bool operator<(const MaximaIterator &lk, const MaximaIterator &rk) noexcept {
+        return lk.m_it < rk.m_it;
+    }
+
+    friend bool operator<=(const MaximaIterator &lk, const MaximaIterator &rk) noexcept {
+        return lk.m_it <= rk.m_it;
+    }
+
+    friend bool operator>(const MaximaIterator &lk, const MaximaIterator &rk) noexcept {
+        return lk.m_it > rk.m_it;
+    }
+
+    friend bool operator>=(const MaximaIterator &lk, const MaximaIterator &rk) noexcept {
+        return lk.m_it >= rk.m_it;
+    }
+
+private:
+    friend class FlatFunctionMaxima;
+
+    using index_iterator = typename std::vector<size_type>::const_iterator;
+
+    MaximaIterator(const point_type *points, index_iterator it) noexcept : m_points(points), m_it(it) {}
+
+    const point_type *m_points;
+    index_iterator m_it;
+};
+
+/* Stores at most three removed and at most three inserted local maxima.
+ * Removed ones are given by their positions inside local_maxima,
+ * inserted ones by their slots (see mx_slot), their points and their indices after the update.
+ */
+template<typename A, typename V>
+class FlatFunctionMaxima<A, V>::MaximaUpdate {
+public:
+    MaximaUpdate() noexcept : removed_count(0), inserted_count(0) {}
+
+    void remove(size_type position) noexcept {
+        removed[removed_count++] = position;
+    }
+
+    // Point (a, v) has to stay alive until order() is called.
+    void insert(size_type slot, const A &a, const V &v, size_type index) noexcept {
+        inserted[inserted_count++] = Insertion{slot, &a, &v, index};
+    }
+
+    size_type inserted_size() const noexcept {
+        return inserted_count;
+    }
+
+    // Sorts the insertions in the order of local_maxima. Has to be called before anything is modified.
+    void order() {
+        // Insertion sort, there are at most three of them.
+        for (size_type i = 1; i < inserted_count; ++i) {
+            for (size_type j = i; j > 0 && precedes(inserted[j], inserted[j - 1]); --j)
+                std::swap(inserted[j], inserted[j - 1]);
+        }
+    }
+
+    /* Writes the updated local maxima into result (with enough capacity reserved). Indices not less than pos
+     * are moved by shift, because a point was inserted or erased there.
+     */
+    void apply(const std::vector<size_type> &old_maxima, std::vector<size_type> &result,
+               size_type pos, std::ptrdiff_t shift) const noexcept {
+        size_type next_inserted = 0;
+        for (size_type k = 0; k <= old_maxima.size(); ++k) {
+            while (next_inserted < inserted_count && inserted[next_inserted].slot == k)
+                result.push_back(inserted[next_inserted++].index);
+
+            if (k == old_maxima.size() || std::find(removed, removed + removed_count, k) != removed + removed_count)
+                continue;
+
+            result.push_back(old_maxima[k] >= pos ? old_maxima[k] + shift : old_maxima[k]);
+        }
+    }
+
+private:
+    struct Insertion {
+        size_type slot;
+        const A *arg;
+        const V *value;
+        size_type index;
+    };
+
+    static bool precedes(const Insertion &lk, const Insertion &rk) {
+        if (lk.slot != rk.slot)
+            return lk.slot < rk.slot;
+        if (*rk.value < *lk.value || *lk.value < *rk.value)
+            return *rk.value < *lk.value;
+        return *lk.arg < *rk.arg;
+    }
+
+    size_type removed[3];
+    Insertion inserted[3];
+    size_type removed_count, inserted_count;
+};
+
+template<typename A, typename V>
+template<typename ForwardIt>
+FlatFunctionMaxima<A, V>::FlatFunctionMaxima(ForwardIt first, ForwardIt last) {
+    auto batch = sorted_function_maxima_batch<A>(first, last, [](const auto &point) -> const auto & {
+        return point.first;
+    });
+    function_points.reserve(batch.size());
+    for (const auto &entry : batch)
+        function_points.push_back(PointType(entry.arg(), (*entry.it).second));
+
+    if constexpr (std::is_arithmetic<V>::value) {
+        // Values are copied out of the points, so that the kernel checks all of them at once.
+        auto values = std::vector<V>();
+        values.reserve(size());
+        for (const auto &point : function_points)
+            values.push_back(point.value());
+
+        auto is_maximum = std::vector<unsigned char>(size());
+        LocalExtremaKernel<V>::maxima(values.data(), size(), is_maximum.data());
+        for (size_type i = 0; i < size(); ++i) {
+            if (is_maximum[i])
+                local_maxima.push_back(i);
+        }
+    } else {
+        for (size_type i = 0; i < size(); ++i) {
+            if (is_local_maximum(i))
+                local_maxima.push_back(i);
+        }
+    }
+
+    // Maxima are sorted by arguments, a stable sort by values gives the order of local_maxima.
+    std::stable_sort(local_maxima.begin(), local_maxima.end(), [&](size_type lk, size_type rk) {
+        return function_points[rk].value() < function_points[lk].value();
+    });
+}
+
+template<typename A, typename V>
+FlatFunctionMaxima<A, V> &FlatFunctionMaxima<A, V>::operator=(FlatFunctionMaxima<A, V> other) noexcept {
+    function_points.swap(other.function_points); // Swapping vectors is noexcept.
+    local_maxima.swap(other.local_maxima); // Swapping vectors is noexcept.
+
+    return *this;
+}
+
+template<typename A, typename V>
+V const &FlatFunctionMaxima<A, V>::value_at(const A &a) const {
+    // If a does not belong to the domain - InvalidArg is thrown.
+    auto it = find(a);
+    if (it != end())
+        return (*it).value();
+    throw InvalidArg();
+}
+
+template<typename A, typename V>
+void FlatFunctionMaxima<A, V>::set_value(const A &a, const V &v) {
+    auto pos = lower_bound(a);
+    bool found = pos != size() && !(a < function_points[pos].arg());
+
+    if (found && !(v < function_points[pos].value() || function_points[pos].value() < v))
+        return; // Nothing changes if we set the same value for a.
+
+    // Neighbours before the update, size() stands for a missing one.
+    auto left = (pos != 0 ? pos - 1 : size());
+    auto right = (found ? pos + 1 : pos);
+    std::ptrdiff_t shift = (found ? 0 : 1);
+
+    // Everything that might throw is done before any of the arrays changes.
+    bool p_was = found && is_local_maximum(pos);
+    bool ln_was = left != size() && is_local_maximum(left);
+    bool rn_was = right != size() && is_local_maximum(right);
+
+    bool p_will = would_be_local_maximum(v, left, right);
+    bool ln_will = left != size() && !(function_points[left].value() < v) &&
+                   (left == 0 || !(function_points[left].value() < function_points[left - 1].value()));
+    bool rn_will = right != size() && !(function_points[right].value() < v) &&
+                   (right + 1 == size() ||
+                    !(function_points[right].value() < function_points[right + 1].value()));
+
+    auto update = MaximaUpdate();
+    if (p_was)
+        update.remove(mx_position(pos));
+    if (ln_was && !ln_will)
+        update.remove(mx_position(left));
+    if (rn_was && !rn_will)
+        update.remove(mx_position(right));
+
+    if (p_will)
+        update.insert(mx_slot(a, v), a, v, pos);
+    if (!ln_was && ln_will) {
+        const auto &ln = function_points[left];
+        update.insert(mx_slot(ln.arg(), ln.value()), ln.arg(), ln.value(), left);
+    }
+    if (!rn_was && rn_will) {
+        const auto &rn = function_points[right];
+        update.insert(mx_slot(rn.arg(), rn.value()), rn.arg(), rn.value(), right + shift);
+    }
+    update.order();
+
+    auto new_maxima = std::vector<size_type>();
+    new_maxima.reserve(local_maxima.size() + update.inserted_size());
+    auto new_point = PointType(a, v);
+
+    update_points(pos, found, &new_point); // Last operation that might throw.
+    update.apply(local_maxima, new_maxima, pos, shift);
+    local_maxima.swap(new_maxima);
+}
+
+template<typename A, typename V>
+void FlatFunctionMaxima<A, V>::erase(const A &a) {
+    auto pos = lower_bound(a);
+    if (pos == size() || a < function_points[pos].arg())
+        return;
+
+    // Neighbours before the update, size() stands for a missing one.
+    auto left = (pos != 0 ? pos - 1 : size());
+    auto right = (pos + 1 != size() ? pos + 1 : size());
+
+    // Everything that might throw is done before any of the arrays changes.
+    bool p_was = is_local_maximum(pos);
+    bool ln_was = left != size() && is_local_maximum(left);
+    bool rn_was = right != size() && is_local_maximum(right);
+
+    bool ln_will = left != size() &&
+                   (left == 0 || !(function_points[left].value() < function_points[left - 1].value())) &&
+                   (right == size() || !(function_points[left].value() < function_points[right].value()));
+    bool rn_will = right != size() &&
+                   (left == size() || !(function_points[right].value() < function_points[left].value())) &&
+                   (right + 1 == size() ||
+                    !(function_points[right].value() < function_points[right + 1].value()));
+
+    auto update = MaximaUpdate();
+    if (p_was)
+        update.remove(mx_position(pos));
+    if (ln_was && !ln_will)
+        update.remove(mx_position(left));
+    if (rn_was && !rn_will)
+        update.remove(mx_position(right));
+
+    if (!ln_was && ln_will) {
+        const auto &ln = function_points[left];
+        update.insert(mx_slot(ln.arg(), ln.value()), ln.arg(), ln.value(), left);
+    }
+    if (!rn_was && rn_will) {
+        const auto &rn = function_points[right];
+        update.insert(mx_slot(rn.arg(), rn.value()), rn.arg(), rn.value(), right - 1);
+    }
+    update.order();
+
+    auto new_maxima = std::vector<size_type>();
+    new_maxima.reserve(local_maxima.size() + update.inserted_size());
+
+    update_points(pos, false, nullptr); // Last operation that might throw.
+    update.apply(local_maxima, new_maxima, pos, -1);
+    local_maxima.swap(new_maxima);
+}
+
+template<typename A, typename V>
+typename FlatFunctionMaxima<A, V>::iterator FlatFunctionMaxima<A, V>::begin() const noexcept {
+    return function_points.begin();
+}
+
+template<typename A, typename V>
+typename FlatFunctionMaxima<A, V>::iterator FlatFunctionMaxima<A, V>::end() const noexcept {
+    return function_points.end();
+}
+
+template<typename A, typename V>
+typename FlatFunctionMaxima<A, V>::iterator FlatFunctionMaxima<A, V>::find(const A &a) const {
+    auto pos = lower_bound(a);
+    if (pos != size() && !(a < function_points[pos].arg()))
+        return begin() + pos;
+    return end();
+}
+
+template<typename A, typename V>
+typename FlatFunctionMaxima<A, V>::mx_iterator FlatFunctionMaxima<A, V>::mx_begin() const noexcept {
+    return MaximaIterator(function_points.data(), local_maxima.begin());
+}
+
+template<typename A, typename V>
+typename FlatFunctionMaxima<A, V>::mx_iterator FlatFunctionMaxima<A, V>::mx_end() const noexcept {
+    return MaximaIterator(function_points.data(), local_maxima.end());
+}
+
+template<typename A, typename V>
+typename FlatFunctionMaxima<A, V>::size_type FlatFunctionMaxima<A, V>::size() const noexcept {
+    return function_points.size();
+}
+
+template<typename A, typename V>
+typename FlatFunctionMaxima<A, V>::size_type FlatFunctionMaxima<A, V>::lower_bound(const A &a) const {
+    auto it = std::lower_bound(function_points.begin(), function_points.end(), a,
+                               [](const point_type &point, const A &arg) { return point.arg() < arg; });
+    return it - function_points.begin();
+}
+
+template<typename A, typename V>
+bool FlatFunctionMaxima<A, V>::is_local_maximum(size_type i) const {
+    return would_be_local_maximum(function_points[i].value(), i != 0 ? i - 1 : size(),
+                                  i + 1 != size() ? i + 1 : size());
+}
+
+template<typename A, typename V>
+bool FlatFunctionMaxima<A, V>::would_be_local_maximum(const V &v, size_type left, size_type right) const {
+    return (left == size() || !(v < function_points[left].value())) &&
+           (right == size() || !(v < function_points[right].value()));
+}
+
+template<typename A, typename V>
+typename FlatFunctionMaxima<A, V>::size_type FlatFunctionMaxima<A, V>::mx_position(size_type i) const {
+    return mx_slot(function_points[i].arg(), function_points[i].value());
+}
+
+template<typename A, typename V>
+typename FlatFunctionMaxima<A, V>::size_type FlatFunctionMaxima<A, V>::mx_slot(const A &a, const V &v) const {
+    auto it = std::partition_point(local_maxima.begin(), local_maxima.end(), [&](size_type i) {
+        const auto &point = function_points[i];
+        if (v < point.value() || point.value() < v)
+            return v < point.value();
+        return point.arg() < a;
+    });
+    return it - local_maxima.begin();
+}
+
+template<typename A, typename V>
+void FlatFunctionMaxima<A, V>::update_points(size_type pos, bool replace, PointType *new_point) {
+    if (nothrow_relocatable) {
+        // Capacity is reserved first, so nothing below throws.
+        if (!replace && new_point != nullptr)
+            function_points.reserve(size() + 1);
+
+        if (replace)
+            function_points[pos] = std::move(*new_point);
+        else if (new_point != nullptr)
+            function_points.insert(function_points.begin() + pos, std::move(*new_point));
+        else
+            function_points.erase(function_points.begin() + pos);
+    } else if (nothrow_swappable) {
+        /* A new point is copied to the end and swapped back to pos, an erased one is swapped to the end
+         * and popped. Only the copy (with capacity reserved first) might throw, before anything changes.
+         */
+        if (replace) {
+            swap(function_points[pos], *new_point);
+        } else if (new_point != nullptr) {
+            function_points.reserve(size() + 1);
+            function_points.push_back(*new_point);
+            for (size_type i = size() - 1; i > pos; --i)
+                swap(function_points[i], function_points[i - 1]);
+        } else {
+            for (size_type i = pos; i + 1 < size(); ++i)
+                swap(function_points[i], function_points[i + 1]);
+            function_points.pop_back();
+        }
+    } else {
+        // Neither moving nor swapping points is safe, so the updated array is built aside and swapped.
+        auto new_points = std::vector<point_type>();
+        new_points.reserve(size() + 1);
+        new_points.insert(new_points.end(), function_points.begin(), function_points.begin() + pos);
+        if (new_point != nullptr)
+            new_points.push_back(*new_point);
+        new_points.insert(new_points.end(), function_points.begin() + pos + (replace || new_point == nullptr),
+                          function_points.end());
+        function_points.swap(new_points);
+    }
+}
+
+#endif // FLAT_FUNCTION_MAXIMA_H
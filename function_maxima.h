@@ -7,42 +7,555 @@
 #include <exception>
 #include <type_traits>
 #include <tuple>
+#include <utility>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <cstddef>
+#include <cstdint>
+
+#include "function_maxima_simd.h"
+
+#ifdef FUNCTION_MAXIMA_STATS
+
+// Counters gathered when FUNCTION_MAXIMA_STATS is defined, otherwise the instrumentation is compiled out.
+struct FunctionMaximaStats {
+    size_t operations = 0; // Number of operations counted (always 1 for a single operation).
+    size_t allocations = 0; // Tree nodes and point blocks.
+    size_t allocated_bytes = 0;
+    size_t tree_descents = 0; // Searches from the root of function_points or local_maxima.
+    size_t comparisons = 0; // Invocations of the comparators of both sets.
+
+    FunctionMaximaStats &operator+=(const FunctionMaximaStats &other) noexcept {
+        operations += other.operations;
+        allocations += other.allocations;
+        allocated_bytes += other.allocated_bytes;
+        tree_descents += other.tree_descents;
+        comparisons += other.comparisons;
+        return *this;
+    }
+
+    FunctionMaximaStats &operator-=(const FunctionMaximaStats &other) noexcept {
+        operations -= other.operations;
+        allocations -= other.allocations;
+        allocated_bytes -= other.allocated_bytes;
+        tree_descents -= other.tree_descents;
+        comparisons -= other.comparisons;
+        return *this;
+    }
+
+    /* Counters of the current thread, gathered by all operations. Updates attribute their differences to the instance
+     * they were called on, const methods only add to these.
+     */
+    static FunctionMaximaStats &thread_counters() noexcept {
+        static thread_local FunctionMaximaStats counters;
+        return counters;
+    }
+};
+
+#define FUNCTION_MAXIMA_COUNT(counter, n) (FunctionMaximaStats::thread_counters().counter += (n))
+
+// Allocator counting allocations of the underlying one.
+template<typename Alloc>
+class FunctionMaximaStatsAllocator : public Alloc {
+private:
+    using traits = std::allocator_traits<Alloc>;
+
+public:
+    using value_type = typename traits::value_type;
+
+    template<typename U>
+    struct rebind {
+        using other = FunctionMaximaStatsAllocator<typename traits::template rebind_alloc<U>>;
+    };
+
+    FunctionMaximaStatsAllocator() = default;
+
+    FunctionMaximaStatsAllocator(const Alloc &alloc) noexcept : Alloc(alloc) {}
+
+    template<typename OtherAlloc>
+    FunctionMaximaStatsAllocator(const FunctionMaximaStatsAllocator<OtherAlloc> &other) noexcept
+            : Alloc(static_cast<const OtherAlloc &>(other)) {}
+
+    value_type *allocate(size_t n) {
+        auto p = traits::allocate(*this, n);
+        FUNCTION_MAXIMA_COUNT(allocations, 1);
+        FUNCTION_MAXIMA_COUNT(allocated_bytes, n * sizeof(value_type));
+        return p;
+    }
+
+    void deallocate(value_type *p, size_t n) noexcept {
+        traits::deallocate(*this, p, n);
+    }
+
+    template<typename OtherAlloc>
+    bool operator==(const FunctionMaximaStatsAllocator<OtherAlloc> &other) const noexcept {
+        return static_cast<const Alloc &>(*this) == static_cast<const OtherAlloc &>(other);
+    }
+
+    template<typename OtherAlloc>
+    bool operator!=(const FunctionMaximaStatsAllocator<OtherAlloc> &other) const noexcept {
+        return !(*this == other);
+    }
+};
+
+#else
+
+#define FUNCTION_MAXIMA_COUNT(counter, n) ((void) 0)
+
+#endif // FUNCTION_MAXIMA_STATS
+
+// Reference counting policy for points shared between copies, safe to use from many threads.
+struct AtomicRefCount {
+    using counter_type = std::atomic<size_t>;
+
+    static void increment(counter_type &counter) noexcept {
+        counter.fetch_add(1, std::memory_order_relaxed);
+    }
 
+    // Returns true only if the last reference was released.
+    static bool decrement(counter_type &counter) noexcept {
+        return counter.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+};
+
+// Reference counting policy for instances (and copies of their points) confined to one thread.
+struct NonAtomicRefCount {
+    using counter_type = size_t;
+
+    static void increment(counter_type &counter) noexcept {
+        ++counter;
+    }
+
+    // Returns true only if the last reference was released.
+    static bool decrement(counter_type &counter) noexcept {
+        return --counter == 0;
+    }
+};
+
+/* Whether points keep A and V inline (in the nodes of both sets) instead of sharing a counted block.
+ * Small A and V copied, moved and swapped without throwing (int64_t and double, for example) are kept inline,
+ * so creating a point allocates nothing and the counter is not needed. The noexcept assignment of points swaps
+ * their A and V, which moves them. It might be specialised to choose otherwise.
+ */
 template<typename A, typename V>
+struct InlinePoints : std::bool_constant<sizeof(A) + sizeof(V) <= 2 * sizeof(void *) &&
+                                         std::is_nothrow_copy_constructible<A>::value &&
+                                         std::is_nothrow_copy_constructible<V>::value &&
+                                         std::is_nothrow_move_constructible<A>::value &&
+                                         std::is_nothrow_move_constructible<V>::value &&
+                                         std::is_nothrow_move_assignable<A>::value &&
+                                         std::is_nothrow_move_assignable<V>::value &&
+                                         std::is_nothrow_swappable<A>::value && std::is_nothrow_swappable<V>::value> {};
+
+/* Monotonic memory resource: allocations are carved from chunks growing geometrically, nothing is freed
+ * separately and all chunks are released at once by release() or the destructor.
+ * It is not synchronised, so it should be used by instances confined to one thread.
+ */
+class FunctionMaximaArena {
+public:
+    explicit FunctionMaximaArena(size_t initial_chunk_size = 4096) noexcept
+            : chunks(nullptr), current(nullptr), limit(nullptr), next_chunk_size(initial_chunk_size) {}
+
+    FunctionMaximaArena(const FunctionMaximaArena &other) = delete;
+
+    FunctionMaximaArena &operator=(const FunctionMaximaArena &other) = delete;
+
+    void *allocate(size_t bytes, size_t alignment);
+
+    // Everything allocated from the arena is released, it must not be used anymore.
+    void release() noexcept;
+
+    ~FunctionMaximaArena() noexcept {
+        release();
+    }
+
+private:
+    struct Chunk {
+        Chunk *next;
+    };
+
+    // Chunk headers are followed by the memory given out, so they keep its alignment.
+    static constexpr size_t header_size = (sizeof(Chunk) + alignof(std::max_align_t) - 1) /
+                                          alignof(std::max_align_t) * alignof(std::max_align_t);
+
+    Chunk *chunks;
+    char *current, *limit;
+    size_t next_chunk_size;
+};
+
+inline void *FunctionMaximaArena::allocate(size_t bytes, size_t alignment) {
+    auto aligned = [alignment](char *p) {
+        auto address = reinterpret_cast<std::uintptr_t>(p);
+        return p + (alignment - address % alignment) % alignment;
+    };
+
+    if (current == nullptr || bytes > size_t(limit - aligned(current))) {
+        size_t size = std::max(next_chunk_size, header_size + bytes + alignment);
+        auto chunk = static_cast<Chunk *>(::operator new(size)); // Nothing has changed if it throws.
+        chunk->next = chunks;
+        chunks = chunk;
+        current = reinterpret_cast<char *>(chunk) + header_size;
+        limit = reinterpret_cast<char *>(chunk) + size;
+        next_chunk_size = 2 * size;
+    }
+
+    char *result = aligned(current);
+    current = result + bytes;
+    return result;
+}
+
+inline void FunctionMaximaArena::release() noexcept {
+    while (chunks != nullptr) {
+        Chunk *next = chunks->next;
+        ::operator delete(chunks);
+        chunks = next;
+    }
+    current = limit = nullptr;
+}
+
+/* Allocator taking memory from a FunctionMaximaArena, deallocate does nothing.
+ * It declares is_monotonic, so FunctionMaxima with trivially destructible A and V skips the teardown of its
+ * nodes entirely, the memory is given back when the arena is released. Neither the instances nor any points
+ * copied out of them may outlive the arena.
+ */
+template<typename T>
+class FunctionMaximaArenaAllocator {
+public:
+    using value_type = T;
+    using is_monotonic = std::true_type;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    explicit FunctionMaximaArenaAllocator(FunctionMaximaArena &arena) noexcept : arena(&arena) {}
+
+    template<typename U>
+    FunctionMaximaArenaAllocator(const FunctionMaximaArenaAllocator<U> &other) noexcept : arena(other.arena) {}
+
+    T *allocate(size_t n) {
+        return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *, size_t) noexcept {}
+
+    template<typename U>
+    bool operator==(const FunctionMaximaArenaAllocator<U> &other) const noexcept {
+        return arena == other.arena;
+    }
+
+    template<typename U>
+    bool operator!=(const FunctionMaximaArenaAllocator<U> &other) const noexcept {
+        return arena != other.arena;
+    }
+
+private:
+    template<typename U>
+    friend class FunctionMaximaArenaAllocator;
+
+    FunctionMaximaArena *arena; // It should be a pointer, so the allocator stays copyable.
+};
+
+// Allocators declaring is_monotonic as true only release their memory all at once.
+template<typename Alloc, typename = void>
+struct IsMonotonicAllocator : std::false_type {};
+
+template<typename Alloc>
+struct IsMonotonicAllocator<Alloc, std::void_t<typename Alloc::is_monotonic>> : Alloc::is_monotonic {};
+
+/* Element of a range of a batch update with its argument as A. If the range holds lvalues of A itself,
+ * the argument is referred to, otherwise it is converted to A once (so comparisons never convert again).
+ */
+template<typename A, typename ForwardIt, bool Converted>
+class FunctionMaximaBatchEntry {
+public:
+    // Key is the argument to convert, or a pointer to it if it is not converted.
+    template<typename Key>
+    FunctionMaximaBatchEntry(ForwardIt it, Key &&key) : it(it), stored(std::forward<Key>(key)) {}
+
+    const A &arg() const noexcept {
+        if constexpr (Converted)
+            return stored;
+        else
+            return *stored;
+    }
+
+    ForwardIt it;
+
+private:
+    std::conditional_t<Converted, A, const A *> stored;
+};
+
+// Arguments of the elements of ForwardIt given by KeyOf are referred to only if they are lvalues of A.
+template<typename A, typename ForwardIt, typename KeyOf>
+constexpr bool function_maxima_batch_converted =
+        !(std::is_lvalue_reference<typename std::iterator_traits<ForwardIt>::reference>::value &&
+          std::is_same<std::decay_t<std::invoke_result_t<KeyOf, typename std::iterator_traits<ForwardIt>::reference>>,
+                       A>::value);
+
+template<typename A, typename ForwardIt, typename KeyOf>
+using function_maxima_batch =
+        std::vector<FunctionMaximaBatchEntry<A, ForwardIt, function_maxima_batch_converted<A, ForwardIt, KeyOf>>>;
+
+/* Sorts a batch of elements by their arguments (given as references by key_of and compared as A) and leaves
+ * only the last one for each argument. Takes O(n) if the batch is already sorted. Used by batch updates
+ * and constructors from ranges of pairs (argument, value) of all the backends.
+ */
+template<typename A, typename ForwardIt, typename KeyOf>
+function_maxima_batch<A, ForwardIt, KeyOf> sorted_function_maxima_batch(ForwardIt first, ForwardIt last,
+                                                                        KeyOf key_of) {
+    using entry = typename function_maxima_batch<A, ForwardIt, KeyOf>::value_type;
+    auto batch = function_maxima_batch<A, ForwardIt, KeyOf>();
+    for (; first != last; ++first) {
+        if constexpr (function_maxima_batch_converted<A, ForwardIt, KeyOf>)
+            batch.emplace_back(first, key_of(*first));
+        else
+            batch.emplace_back(first, &key_of(*first));
+    }
+
+    auto less = [](const entry &lk, const entry &rk) {
+        return lk.arg() < rk.arg();
+    };
+    if (!std::is_sorted(batch.begin(), batch.end(), less))
+        std::stable_sort(batch.begin(), batch.end(), less);
+
+    // Among the equal arguments the last one given wins.
+    auto result = function_maxima_batch<A, ForwardIt, KeyOf>();
+    result.reserve(batch.size());
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (i + 1 == batch.size() || less(batch[i], batch[i + 1]))
+            result.push_back(std::move(batch[i]));
+    }
+
+    return result;
+}
+
+// Index policy of instances answering only the queries about all points or local maxima.
+struct NoRangeIndex {};
+
+/* Index policy linking the points also into a balanced tree ordered by arguments, which answers queries about
+ * ranges of arguments and positions of points (rank, select) in O(log n). The tree is threaded through the nodes
+ * holding the points, so nothing more is allocated, but every update takes O(log n) more.
+ */
+struct RangeIndex {};
+
+/* Index policy of RangeIndex keeping also summaries of Aggregate over subtrees of the tree, for aggregate(lo, hi)
+ * in O(log n). Aggregate gives a monoid over points:
+ * - value_type, the type of summaries,
+ * - static value_type identity(),
+ * - static value_type of(const A &a, const V &v), the summary of a single point,
+ * - static value_type combine(const value_type &lk, const value_type &rk), associative, lk is before rk.
+ * Any of them might throw. Summaries are recomputed lazily (by queries) on the paths changed by updates.
+ */
+template<typename Aggregate>
+struct AggregateIndex {};
+
+// Aggregate policy of an index policy (void if it has none).
+template<typename Index>
+struct IndexAggregate {
+    using type = void;
+    using value_type = void;
+};
+
+template<typename Aggregate>
+struct IndexAggregate<AggregateIndex<Aggregate>> {
+    using type = Aggregate;
+    using value_type = typename Aggregate::value_type;
+};
+
+// Minima policy of instances keeping only local maxima.
+struct NoLocalMinima {};
+
+/* Minima policy keeping also local minima (mn_begin() - mn_end()), updated by the same analysis of neighbours
+ * as local maxima, with the same guarantees.
+ */
+struct LocalMinima {};
+
+/* RefCount selects how points shared between both sets (and copies of the whole object) are counted.
+ * NonAtomicRefCount might be used only if an instance and all of its copies are confined to one thread.
+ * Alloc (rebound to the needed types) is used for nodes of both sets and for the blocks of points.
+ * Points of A and V chosen by InlinePoints have no blocks (nor counters), each copy holds its own A and V.
+ * Index selects whether range and order statistic queries (maxima_in_range, rank, ...) are available,
+ * and whether aggregates over ranges are kept as well.
+ * Minima selects whether local minima are kept as well.
+ */
+template<typename A, typename V, typename RefCount = AtomicRefCount,
+        typename Alloc = std::allocator<std::pair<A, V>>, typename Index = NoRangeIndex,
+        typename Minima = NoLocalMinima>
 class FunctionMaxima {
 private:
     class FunctionPointsComparator; // Comparator used for storing function points inside a set.
 
     class LocalMaximaComparator; // Comparator used for storing local maximas inside a set.
 
-    class PointConstructionGuard; // Guard used when constructing a point.
+    class LocalMinimaComparator; // Comparator used for storing local minima inside a set.
 
     class PointInsertionGuard; // Guard used when inserting a point.
 
-    class LocalMaximaUpdateGuard; // Guard used when updating set with local maximas.
+    template<typename Set>
+    class LocalExtremaUpdateGuard; // Guard used when updating set with local maximas (or minima).
+
+    class FunctionPoint; // Point stored inside function_points, linked with its entry in local_maxima.
+
+    class BatchUpdateGuard; // Guard used when updating many points at once.
+
+#ifdef FUNCTION_MAXIMA_STATS
+    class StatsScope; // Attributes counters gathered during an update to the instance.
+#endif
+
+    class PointConstructionGuard; // Guard used when constructing a point.
+
+    struct ValueBound; // Key used for searching local_maxima by a value only.
+
+    class IndexHook; // Links of a point in the index ordered by arguments.
+
+    class NoIndexHook {};
+
+    class ArgumentIndex; // Balanced tree of points ordered by arguments, threaded through FunctionPoints.
+
+    class NoArgumentIndex; // Used instead of ArgumentIndex if there is no index, does nothing.
+
+    using aggregate_policy = typename IndexAggregate<Index>::type;
+
+    using aggregate_type = typename IndexAggregate<Index>::value_type;
+
+    static constexpr bool aggregated = !std::is_void<aggregate_policy>::value;
+
+    static constexpr bool indexed = std::is_same<Index, RangeIndex>::value || aggregated;
+
+    class SummaryHook; // Summary of Aggregate over the subtree of a point in the index.
+
+    class NoSummaryHook {};
+
+    using summary_hook = std::conditional_t<aggregated, SummaryHook, NoSummaryHook>;
+
+    using index_hook = std::conditional_t<indexed, IndexHook, NoIndexHook>;
+
+    using argument_index = std::conditional_t<indexed, ArgumentIndex, NoArgumentIndex>;
+
+    class MinimaHook; // Link of a point with its entry in local_minima.
+
+    class NoMinimaHook {};
+
+    static constexpr bool with_minima = std::is_same<Minima, LocalMinima>::value;
+
+    using minima_hook = std::conditional_t<with_minima, MinimaHook, NoMinimaHook>;
 
 public:
     class PointType;
 
     using point_type = PointType;
 
-    FunctionMaxima() = default;
+    template<typename Iterator>
+    class SubRange; // Pair of iterators, nothing is copied.
+
+    class ArgumentMaximaIterator; // Iterator over local maxima in the order of arguments.
+
+    using allocator_type = Alloc;
+
+private:
+    using alloc_traits = std::allocator_traits<Alloc>;
+
+    // Alloc rebound to T, used for both sets and for blocks of points.
+    template<typename T>
+#ifdef FUNCTION_MAXIMA_STATS
+    using allocator_for = FunctionMaximaStatsAllocator<typename alloc_traits::template rebind_alloc<T>>;
+#else
+    using allocator_for = typename alloc_traits::template rebind_alloc<T>;
+#endif
 
-    FunctionMaxima(const FunctionMaxima<A, V> &other) = default;
+    template<typename T>
+    static allocator_for<T> rebind(const Alloc &alloc) noexcept;
 
-    FunctionMaxima(FunctionMaxima<A, V> &&other) noexcept = default;
+    // Sets might be swapped only if their allocators are swapped with them or are always equal.
+    static constexpr bool allocators_swappable = alloc_traits::propagate_on_container_swap::value ||
+                                                 alloc_traits::is_always_equal::value;
 
-    FunctionMaxima &operator=(FunctionMaxima<A, V> other) noexcept;
+    using function_points_set = std::set<FunctionPoint, FunctionPointsComparator, allocator_for<FunctionPoint>>;
+
+    /* Entries of local maxima are FunctionPoints as well (their own links are not used), so that mx_iterator
+     * is the same type as iterator, as it has always been.
+     */
+    using local_maxima_set = std::set<FunctionPoint, LocalMaximaComparator, allocator_for<FunctionPoint>>;
+
+    using local_minima_set = std::set<PointType, LocalMinimaComparator, allocator_for<PointType>>;
+
+    using LocalMaximaUpdateGuard = LocalExtremaUpdateGuard<local_maxima_set>;
+
+    using LocalMinimaUpdateGuard = LocalExtremaUpdateGuard<local_minima_set>;
+
+    static_assert(!alloc_traits::propagate_on_container_copy_assignment::value || allocators_swappable,
+                  "An allocator propagated on copy assignment has to be propagated on swap as well.");
+
+public:
+    FunctionMaxima() : FunctionMaxima(Alloc()) {}
+
+    explicit FunctionMaxima(const Alloc &alloc);
+
+    FunctionMaxima(const FunctionMaxima<A, V, RefCount, Alloc, Index, Minima> &other);
+
+    FunctionMaxima(const FunctionMaxima<A, V, RefCount, Alloc, Index, Minima> &other, const Alloc &alloc);
+
+    /* Builds a function from pairs (argument, value), if an argument repeats, the last value is taken.
+     * Takes O(n) for a range sorted by arguments (plus sorting local maxima), otherwise the range is sorted first.
+     */
+    template<typename ForwardIt>
+    FunctionMaxima(ForwardIt first, ForwardIt last, const Alloc &alloc = Alloc());
+
+    FunctionMaxima(FunctionMaxima<A, V, RefCount, Alloc, Index, Minima> &&other) noexcept;
+
+    /* If allocators are neither swapped nor always equal and other uses a different one,
+     * points are copied into the allocator of this instance first (so then it might throw).
+     */
+    FunctionMaxima &operator=(FunctionMaxima<A, V, RefCount, Alloc, Index, Minima> other)
+    noexcept(allocators_swappable);
+
+    // Allocators have to be swapped with the sets (propagate_on_container_swap) or be equal.
+    void swap(FunctionMaxima<A, V, RefCount, Alloc, Index, Minima> &other) noexcept;
+
+    Alloc get_allocator() const noexcept;
 
     V const &value_at(A const &a) const;
 
     // Strong exception guarantee.
     void set_value(A const &a, V const &v);
 
+    /* The same, but a and v are moved into the point instead of being copied. They are moved only when the value
+     * is going to change, then if the update throws the function is unchanged, but a and v might be moved from.
+     */
+    void set_value(A &&a, V &&v);
+
+    /* Sets the value of a point whose argument and value are constructed in place (in the block of the point)
+     * from arg_args and value_args, as by the piecewise constructor of std::pair. The point is constructed first,
+     * so the arguments of both tuples are consumed even if the value does not change.
+     * Strong exception guarantee.
+     */
+    template<typename... ArgArgs, typename... ValueArgs>
+    void emplace_value(std::piecewise_construct_t, std::tuple<ArgArgs...> arg_args,
+                       std::tuple<ValueArgs...> value_args);
+
     // Strong exception guarantee.
     void erase(A const &a);
 
-    using iterator = typename std::set<point_type, FunctionPointsComparator>::iterator;
+    /* Sets values of many points at once, the range holds pairs (argument, value) in any order.
+     * If an argument repeats, the last value is set. Local maxima are recomputed once for all points
+     * affected by the batch. Strong exception guarantee for the whole batch.
+     */
+    template<typename ForwardIt>
+    void set_values(ForwardIt first, ForwardIt last);
+
+    template<typename Range>
+    void set_values(const Range &points);
+
+    // Erases many arguments at once, the same as set_values. Strong exception guarantee for the whole batch.
+    template<typename ForwardIt>
+    void erase_many(ForwardIt first, ForwardIt last);
+
+    template<typename Range>
+    void erase_many(const Range &arguments);
+
+    using iterator = typename function_points_set::iterator;
 
     iterator begin() const noexcept;
 
@@ -50,38 +563,128 @@ public:
 
     iterator find(A const &a) const;
 
-    using mx_iterator = iterator;
+    // Iterators of both sets are of the same type, points of local maxima are read as any others.
+    using mx_iterator = typename local_maxima_set::iterator;
+
+    static_assert(std::is_same<mx_iterator, iterator>::value, "mx_iterator has to be the same type as iterator.");
 
     mx_iterator mx_begin() const noexcept;
 
     mx_iterator mx_end() const noexcept;
 
+    using mx_range = SubRange<mx_iterator>; // Subrange of mx_begin() - mx_end().
+
+    /* Local minima (require Minima = LocalMinima), sorted by values ascending, then by arguments.
+     * A point might be both a local maximum and a local minimum.
+     */
+    using mn_iterator = typename local_minima_set::iterator;
+
+    mn_iterator mn_begin() const noexcept;
+
+    mn_iterator mn_end() const noexcept;
+
+    using arg_mx_iterator = ArgumentMaximaIterator;
+
+    using arg_mx_range = SubRange<arg_mx_iterator>;
+
     using size_type = size_t;
 
     size_type size() const noexcept;
 
+    // At most k largest local maxima (in the order of mx_begin() - mx_end()), takes O(k).
+    mx_range top_k_maxima(size_type k) const noexcept;
+
+    // Local maxima with values greater than threshold (in the order of mx_begin() - mx_end()), takes O(log n).
+    mx_range maxima_above(const V &threshold) const;
+
+    /* The greatest value and its argument (the first one, as at mx_begin()), read from a cached point in O(1).
+     * If there are no points InvalidArg is thrown.
+     */
+    V const &global_max() const;
+
+    A const &argmax() const;
+
+    /* The smallest value and its argument (the first one if there are many). With LocalMinima it is the first
+     * local minimum, read from a cached point in O(1). Otherwise the point is found by the first call in O(n)
+     * and then kept by updates (at the cost of a comparison) until it is erased or raised, then it is found again
+     * by the next call. It is published atomically, so like other const methods these might be called
+     * concurrently with const methods (but not with updates). If there are no points InvalidArg is thrown.
+     */
+    V const &global_min() const;
+
+    A const &argmin() const;
+
+    /* Queries below require Index = RangeIndex (or AggregateIndex).
+     * Local maxima with arguments in [lo, hi] in the order of arguments, each step takes O(log n).
+     */
+    arg_mx_range maxima_in_range(const A &lo, const A &hi) const;
+
+    /* Point with the greatest value among the ones with arguments in [lo, hi] (the first one if there are many),
+     * end() if there is none, takes O(log n). It fills lazily computed data of the index, published atomically,
+     * so like other const methods it might be called concurrently with const methods (but not with updates).
+     */
+    iterator max_in_range(const A &lo, const A &hi) const;
+
+    // Number of points with arguments less than a, takes O(log n).
+    size_type rank(const A &a) const;
+
+    // The k-th point in the order of arguments (counting from 0), end() if k >= size(), takes O(log n).
+    iterator select(size_type k) const;
+
+    // Number of points with arguments in [lo, hi], takes O(log n).
+    size_type count_in_range(const A &lo, const A &hi) const;
+
+    /* Requires Index = AggregateIndex<Aggregate>. Combined summaries of the points with arguments in [lo, hi],
+     * in the order of arguments (identity() if there are none), takes O(log n). Like max_in_range it fills
+     * lazily computed data of the index, but summaries are not published atomically, so unlike other const methods
+     * it must not be called concurrently with any other method.
+     */
+    aggregate_type aggregate(const A &lo, const A &hi) const;
+
     ~FunctionMaxima() noexcept;
 
+#ifdef FUNCTION_MAXIMA_STATS
+    /* Counters summed over all updates (and constructions) of this instance, copies start from zero.
+     * Const methods are not attributed to the instance, so they might still be called from many threads at once,
+     * their counters are gathered only by FunctionMaximaStats::thread_counters() of the calling thread.
+     */
+    const FunctionMaximaStats &stats() const noexcept;
+
+    // Counters of the last update only.
+    const FunctionMaximaStats &last_operation_stats() const noexcept;
+
+    void reset_stats() noexcept;
+#endif
+
 private:
     /* It is being used in a following way:
      * - iterator stores the iterator to a point,
      * - first bool is true only if before updates the point was a local maximum,
      * - second bool is true only if after updates it is gonna be a local maximum,
      * - mx_iterator stores the (before updates) mx_iterator
-     * to a point (mx_end() if it is not a local maximum before updates)
+     * to a point (mx_end() if it is not a local maximum before updates),
+     * - the last three are the same for local minima (only if they are kept).
      */
-    using tpl = typename std::tuple<iterator, bool, bool, mx_iterator>;
+    using tpl = typename std::tuple<iterator, bool, bool, mx_iterator, bool, bool, mn_iterator>;
 
-    // Used for obtaining data about points that might change during setting values.
-    void get_info_for_set_value(tpl &p_info,
-                                tpl &ln_info, tpl &rn_info, const A &a, const V &v) const;
+    /* Used for obtaining data about points that might change during setting values.
+     * Position is function_points.lower_bound(a), so the point and its neighbours are found without another descent.
+     */
+    void get_info_for_set_value(tpl &p_info, tpl &ln_info, tpl &rn_info,
+                                const iterator &position, const A &a, const V &v) const;
 
     // Used for obtaining data about points that might change during erasing values.
     void get_info_for_erase(tpl &p_info,
                             tpl &ln_info, tpl &rn_info);
 
-    // Returns true when there is already a point (a, v) inside function_points, false otherwise.
-    bool check_whether_the_same(const A &a, const V &v) const;
+    // Returns true when position (function_points.lower_bound(a)) already points to (a, v), false otherwise.
+    bool check_whether_the_same(const iterator &position, const A &a, const V &v) const;
+
+    /* Common part of set_value and emplace_value, a and v are used only for finding the point and its neighbours,
+     * then make_new_point() creates the point inserted.
+     */
+    template<typename MakePoint>
+    void set_value_with(const A &a, const V &v, MakePoint make_new_point);
 
     // Auxiliary function for set_value. Uses information gathered in get_info_for_set_value.
     void set_value_aux(const tpl &p_info, const tpl &ln_info, const tpl &rn_info,
@@ -90,11 +693,103 @@ private:
     // Auxiliary function for erase. Uses information gathered in get_info_for_erase.
     void erase_aux(const tpl &p_info, const tpl &ln_info, const tpl &rn_info);
 
-    // Used for storing all the points.
-    std::set<point_type, FunctionPointsComparator> function_points;
+    // Creates a point with its block allocated by the allocator of this instance, a and v are forwarded into it.
+    template<typename Arg, typename Value>
+    PointType make_point(Arg &&a, Value &&v) const;
+
+    // Creates a point with A and V constructed in place from the elements of both tuples.
+    template<typename ArgTuple, typename ValueTuple>
+    PointType make_point(std::piecewise_construct_t, ArgTuple &&arg_args, ValueTuple &&value_args) const;
+
+    // Inserts a point which has just become a local minimum into local_minima.
+    mn_iterator insert_local_minimum(const PointType &point);
+
+    // Inserts a point which has just become a local maximum into local_maxima.
+    mx_iterator insert_local_maximum(const PointType &point);
+
+    // Updates the link of a neighbour after its entry in local_maxima was inserted (mx_it) or erased.
+    static void update_link(const tpl &info, const mx_iterator &mx_it) noexcept;
+
+    static void update_minimum_link(const tpl &info, const mn_iterator &mn_it) noexcept;
 
-    // Used for storing local maximas.
-    std::set<point_type, LocalMaximaComparator> local_maxima;
+    // Erases local minima of the point and its neighbours which are not going to be local minima anymore.
+    void erase_outdated_minima(const tpl &p_info, const tpl &ln_info, const tpl &rn_info) noexcept;
+
+    // After update_link, counters of the index are updated if the point has changed whether it is a local maximum.
+    void refresh_index(const tpl &info) noexcept;
+
+    // Number of points before it in function_points (size() for end()), read from the index.
+    size_type rank_of(const iterator &it) const noexcept;
+
+    // Called when an operation is committed, the first local maximum (and minimum) might have changed.
+    void update_extrema() noexcept;
+
+    // Whether a point with argument a and value v would become the kept minimum (never if there is no kept one).
+    bool precedes_minimum(const A &a, const V &v) const;
+
+    // Without LocalMinima, the minimum is going to be found again by the next call, it is not kept until then.
+    void mark_minimum_outdated() noexcept;
+
+    const PointType &minimum_point() const;
+
+    // Neighbours of a point skipping the ones which are going to be erased by a batch update.
+    iterator next_present(iterator it) const noexcept;
+
+    iterator prev_present(iterator it) const noexcept;
+
+    // Computes local maxima (and minima) of all the points in a single sweep, both sets have to be empty.
+    void build_local_maxima();
+
+    /* Sets maxima[i] (minima[i]) to 1 only if points[i] is going to be a local maximum (minimum) among its present
+     * neighbours. Arithmetic values are gathered and checked at once by LocalExtremaKernel.
+     */
+    void find_local_extrema(const std::vector<iterator> &points, std::vector<unsigned char> &maxima,
+                            std::vector<unsigned char> &minima) const;
+
+    /* Second part of a batch update. Inserted and outdated points are already gathered by the guard,
+     * local maxima of the affected points are recomputed and the batch is committed.
+     */
+    void batch_update_aux(BatchUpdateGuard &guard);
+
+    /* Nodes with nothing to destroy, taken from a monotonic allocator, are not visited by the destructor at all,
+     * their memory is released together with the allocator's arena.
+     */
+    static constexpr bool skips_teardown = IsMonotonicAllocator<Alloc>::value &&
+                                           std::is_trivially_destructible<A>::value &&
+                                           std::is_trivially_destructible<V>::value &&
+                                           std::is_trivially_destructible<typename RefCount::counter_type>::value;
+
+    // Both sets are destroyed explicitly (or not at all, see skips_teardown).
+    union {
+        // Used for storing all the points.
+        function_points_set function_points;
+    };
+
+    union {
+        // Used for storing local maximas.
+        local_maxima_set local_maxima;
+    };
+
+    union {
+        // Used for storing local minima, empty unless Minima is LocalMinima.
+        local_minima_set local_minima;
+    };
+
+    // Links points of function_points ordered by arguments (if Index is RangeIndex or AggregateIndex).
+    argument_index arguments;
+
+    // The first local maximum, nullptr if there are no points.
+    const PointType *maximum = nullptr;
+
+    /* The first point with the smallest value, nullptr if there are no points or minimum_outdated is set.
+     * Instances start with it outdated, so updates of the ones never asked for the minimum compare nothing for it.
+     */
+    mutable std::atomic<const PointType *> minimum{nullptr};
+    mutable std::atomic<bool> minimum_outdated{!with_minima};
+
+#ifdef FUNCTION_MAXIMA_STATS
+    FunctionMaximaStats total_stats, last_stats;
+#endif
 };
 
 namespace {
@@ -107,47 +802,210 @@ namespace {
     };
 }
 
-template<typename A, typename V>
-FunctionMaxima<A, V>::~FunctionMaxima() noexcept {
-    // Containers cleared.
-    function_points.clear();
-    local_maxima.clear();
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::FunctionMaxima(const Alloc &alloc)
+        : function_points(FunctionPointsComparator(), rebind<FunctionPoint>(alloc)),
+          local_maxima(LocalMaximaComparator(), rebind<FunctionPoint>(alloc)),
+          local_minima(LocalMinimaComparator(), rebind<PointType>(alloc)) {}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::FunctionMaxima(
+        const FunctionMaxima<A, V, RefCount, Alloc, Index, Minima> &other)
+        : FunctionMaxima(other, alloc_traits::select_on_container_copy_construction(other.get_allocator())) {}
+
+/* Sets are filled only after the delegated constructor, so the destructor releases them if copying throws.
+ * Points are shared with other only if they come from the same allocator, otherwise they are copied.
+ */
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::FunctionMaxima(
+        const FunctionMaxima<A, V, RefCount, Alloc, Index, Minima> &other, const Alloc &alloc)
+        : FunctionMaxima(alloc) {
+    if (get_allocator() == other.get_allocator()) {
+        auto copy = function_points_set(other.function_points, function_points.get_allocator());
+        function_points.swap(copy); // Allocators are equal.
+    } else {
+        for (auto &point : other.function_points) {
+            auto it = function_points.emplace_hint(end(), make_point(point.arg(), point.value()));
+            it->is_local_maximum = point.is_local_maximum;
+            if constexpr (with_minima)
+                it->is_local_minimum = point.is_local_minimum;
+        }
+    }
+
+    // Copied links point to the local extrema and the index of other, they are rebuilt for the copy.
+    for (auto &point : function_points) {
+        if (point.is_local_maximum)
+            point.mx_it = insert_local_maximum(point);
+        if constexpr (with_minima) {
+            if (point.is_local_minimum)
+                point.mn_it = insert_local_minimum(point);
+        }
+    }
+    arguments.build(function_points);
+    update_extrema();
 }
 
-template<typename A, typename V>
-FunctionMaxima<A, V> &FunctionMaxima<A, V>::operator=(FunctionMaxima<A, V> other) noexcept {
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+template<typename ForwardIt>
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::FunctionMaxima(ForwardIt first, ForwardIt last,
+                                                                     const Alloc &alloc)
+        : FunctionMaxima(alloc) {
+#ifdef FUNCTION_MAXIMA_STATS
+    auto stats_scope = StatsScope(this);
+#endif
+    // Every point goes to the end of function_points, so the hint makes insertions amortized O(1).
+    auto batch = sorted_function_maxima_batch<A>(first, last, [](const auto &point) -> const auto & {
+        return point.first;
+    });
+    for (const auto &entry : batch)
+        function_points.emplace_hint(end(), make_point(entry.arg(), (*entry.it).second));
+
+    build_local_maxima();
+    arguments.build(function_points);
+    update_extrema();
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::FunctionMaxima(
+        FunctionMaxima<A, V, RefCount, Alloc, Index, Minima> &&other)
+noexcept
+        : function_points(std::move(other.function_points)), local_maxima(std::move(other.local_maxima)),
+          local_minima(std::move(other.local_minima)), arguments(std::move(other.arguments)),
+          maximum(other.maximum), minimum(other.minimum.load(std::memory_order_relaxed)),
+          minimum_outdated(other.minimum_outdated.load(std::memory_order_relaxed))
+#ifdef FUNCTION_MAXIMA_STATS
+        , total_stats(other.total_stats), last_stats(other.last_stats)
+#endif
+{
+    // Nodes are taken from other, so are its cached points.
+    other.maximum = nullptr;
+    other.minimum.store(nullptr, std::memory_order_relaxed);
+    other.minimum_outdated.store(!with_minima, std::memory_order_relaxed);
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::~FunctionMaxima() noexcept {
+    if (!skips_teardown) {
+        // Containers cleared.
+        function_points.clear();
+        local_maxima.clear();
+        local_minima.clear();
+        local_minima.~local_minima_set();
+        local_maxima.~local_maxima_set();
+        function_points.~function_points_set();
+    }
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima> &
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::operator=(
+        FunctionMaxima<A, V, RefCount, Alloc, Index, Minima> other)
+noexcept(allocators_swappable) {
+    if (!allocators_swappable && !(get_allocator() == other.get_allocator())) {
+        // Sets with different allocators might not be swapped, points are copied into ours first.
+        auto copy = FunctionMaxima(other, get_allocator());
+        swap(copy);
+    } else {
+        swap(other);
+    }
+
+    return *this;
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::swap(
+        FunctionMaxima<A, V, RefCount, Alloc, Index, Minima> &other) noexcept {
     function_points.swap(other.function_points); // Swapping sets is noexcept.
     local_maxima.swap(other.local_maxima); // Swapping sets is noexcept.
+    local_minima.swap(other.local_minima);
+    arguments.swap(other.arguments);
+    std::swap(maximum, other.maximum);
+    minimum.store(other.minimum.exchange(minimum.load(std::memory_order_relaxed), std::memory_order_relaxed),
+                  std::memory_order_relaxed);
+    minimum_outdated.store(other.minimum_outdated.exchange(minimum_outdated.load(std::memory_order_relaxed),
+                                                           std::memory_order_relaxed), std::memory_order_relaxed);
+}
 
-    return *this;
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+Alloc FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::get_allocator() const noexcept {
+    using base_allocator = typename alloc_traits::template rebind_alloc<FunctionPoint>;
+    return Alloc(static_cast<const base_allocator &>(function_points.get_allocator()));
 }
 
-template<typename A, typename V>
-V const &FunctionMaxima<A, V>::value_at(const A &a) const {
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+template<typename T>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::template allocator_for<T>
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::rebind(const Alloc &alloc) noexcept {
+    return allocator_for<T>(typename alloc_traits::template rebind_alloc<T>(alloc));
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+V const &FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::value_at(const A &a) const {
+    FUNCTION_MAXIMA_COUNT(tree_descents, 1);
+
     // If a does not belong to the domain - InvalidArg is thrown.
-    if (function_points.find(a) != function_points.end())
-        return (*function_points.find(a)).value();
+    auto it = function_points.find(a);
+    if (it != function_points.end())
+        return (*it).value();
     throw InvalidArg();
 }
 
-template<typename A, typename V>
-void FunctionMaxima<A, V>::set_value(const A &a, const V &v) {
-    if (check_whether_the_same(a, v))
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::set_value(const A &a, const V &v) {
+#ifdef FUNCTION_MAXIMA_STATS
+    auto stats_scope = StatsScope(this);
+#endif
+    set_value_with(a, v, [&] { return make_point(a, v); });
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::set_value(A &&a, V &&v) {
+#ifdef FUNCTION_MAXIMA_STATS
+    auto stats_scope = StatsScope(this);
+#endif
+    // After make_new_point() is called, a and v are not read anymore.
+    set_value_with(a, v, [&] { return make_point(std::move(a), std::move(v)); });
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+template<typename... ArgArgs, typename... ValueArgs>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::emplace_value(std::piecewise_construct_t,
+                                                                         std::tuple<ArgArgs...> arg_args,
+                                                                         std::tuple<ValueArgs...> value_args) {
+#ifdef FUNCTION_MAXIMA_STATS
+    auto stats_scope = StatsScope(this);
+#endif
+    auto new_point = make_point(std::piecewise_construct, std::move(arg_args), std::move(value_args));
+    set_value_with(new_point.arg(), new_point.value(), [&] { return new_point; });
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+template<typename MakePoint>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::set_value_with(const A &a, const V &v, MakePoint make_new_point) {
+    // The only descent in function_points, both the point and its neighbours are reached from here.
+    FUNCTION_MAXIMA_COUNT(tree_descents, 1);
+    auto position = function_points.lower_bound(a);
+
+    if (check_whether_the_same(position, a, v))
         return; // Nothing changes if we set the same value for a.
 
     // Storing info for the points that might change during updates.
     tpl point_info, left_neighbour_info, right_neighbour_info;
-    get_info_for_set_value(point_info, left_neighbour_info, right_neighbour_info, a, v);
+    get_info_for_set_value(point_info, left_neighbour_info, right_neighbour_info, position, a, v);
 
-    auto new_point = PointType(a, v);
+    auto new_point = make_new_point();
     set_value_aux(point_info, left_neighbour_info, right_neighbour_info, new_point);
 }
 
-template<typename A, typename V>
-void FunctionMaxima<A, V>::erase(const A &a) {
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::erase(const A &a) {
+#ifdef FUNCTION_MAXIMA_STATS
+    auto stats_scope = StatsScope(this);
+#endif
     using std::get;
     tpl point_info, left_neighbour_info, right_neighbour_info;
 
+    FUNCTION_MAXIMA_COUNT(tree_descents, 1);
     if ((get<0>(point_info) = function_points.find(a)) != end()) {
         get_info_for_erase(point_info, left_neighbour_info, right_neighbour_info);
     } else {
@@ -157,65 +1015,178 @@ void FunctionMaxima<A, V>::erase(const A &a) {
     erase_aux(point_info, left_neighbour_info, right_neighbour_info);
 }
 
-template<typename A, typename V>
-typename FunctionMaxima<A, V>::iterator FunctionMaxima<A, V>::begin() const noexcept {
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::iterator
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::begin() const noexcept {
     return function_points.begin();
 }
 
-template<typename A, typename V>
-typename FunctionMaxima<A, V>::iterator FunctionMaxima<A, V>::end() const noexcept {
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::iterator
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::end() const noexcept {
     return function_points.end();
 }
 
-template<typename A, typename V>
-typename FunctionMaxima<A, V>::iterator FunctionMaxima<A, V>::find(const A &a) const {
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::iterator
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::find(const A &a) const {
+    FUNCTION_MAXIMA_COUNT(tree_descents, 1);
     return function_points.find(a);
 }
 
-template<typename A, typename V>
-typename FunctionMaxima<A, V>::mx_iterator FunctionMaxima<A, V>::mx_begin() const noexcept {
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::mx_iterator
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::mx_begin() const noexcept {
     return local_maxima.begin();
 }
 
-template<typename A, typename V>
-typename FunctionMaxima<A, V>::mx_iterator FunctionMaxima<A, V>::mx_end() const noexcept {
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::mx_iterator
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::mx_end() const noexcept {
     return local_maxima.end();
 }
 
-template<typename A, typename V>
-typename FunctionMaxima<A, V>::size_type FunctionMaxima<A, V>::size() const noexcept {
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::mn_iterator
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::mn_begin() const noexcept {
+    static_assert(with_minima, "mn_begin requires LocalMinima.");
+    return local_minima.begin();
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::mn_iterator
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::mn_end() const noexcept {
+    static_assert(with_minima, "mn_end requires LocalMinima.");
+    return local_minima.end();
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::mx_range
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::top_k_maxima(size_type k) const noexcept {
+    if (k >= local_maxima.size())
+        return mx_range(mx_begin(), mx_end());
+
+    return mx_range(mx_begin(), std::next(mx_begin(), static_cast<std::ptrdiff_t>(k)));
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::mx_range
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::maxima_above(const V &threshold) const {
+    FUNCTION_MAXIMA_COUNT(tree_descents, 1);
+    // Maxima are sorted by values descending, so the ones above threshold form a prefix.
+    return mx_range(mx_begin(), local_maxima.lower_bound(ValueBound{threshold}));
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::arg_mx_range
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::maxima_in_range(const A &lo, const A &hi) const {
+    static_assert(indexed, "maxima_in_range requires RangeIndex.");
+    if (hi < lo)
+        return arg_mx_range(arg_mx_iterator(), arg_mx_iterator());
+
+    FUNCTION_MAXIMA_COUNT(tree_descents, 2);
+    auto first = function_points.lower_bound(lo), last = function_points.upper_bound(hi);
+    return arg_mx_range(arg_mx_iterator(ArgumentIndex::first_maximum(first != end() ? &*first : nullptr)),
+                        arg_mx_iterator(ArgumentIndex::first_maximum(last != end() ? &*last : nullptr)));
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::iterator
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::max_in_range(const A &lo, const A &hi) const {
+    static_assert(indexed, "max_in_range requires RangeIndex.");
+    if (hi < lo)
+        return end();
+
+    FUNCTION_MAXIMA_COUNT(tree_descents, 2);
+    auto first = function_points.lower_bound(lo), last = function_points.upper_bound(hi);
+    auto best = arguments.best_in_ranks(rank_of(first), rank_of(last));
+    if (best == nullptr)
+        return end();
+
+    // Points do not know their positions in function_points.
+    FUNCTION_MAXIMA_COUNT(tree_descents, 1);
+    return function_points.find(best->arg());
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::size_type
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::rank(const A &a) const {
+    static_assert(indexed, "rank requires RangeIndex.");
+    FUNCTION_MAXIMA_COUNT(tree_descents, 1);
+    return rank_of(function_points.lower_bound(a));
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::iterator
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::select(size_type k) const {
+    static_assert(indexed, "select requires RangeIndex.");
+    if (k >= size())
+        return end();
+
+    // Points do not know their positions in function_points.
+    FUNCTION_MAXIMA_COUNT(tree_descents, 1);
+    return function_points.find(arguments.select(k)->arg());
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::size_type
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::count_in_range(const A &lo, const A &hi) const {
+    static_assert(indexed, "count_in_range requires RangeIndex.");
+    if (hi < lo)
+        return 0;
+
+    FUNCTION_MAXIMA_COUNT(tree_descents, 2);
+    return rank_of(function_points.upper_bound(hi)) - rank_of(function_points.lower_bound(lo));
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::aggregate_type
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::aggregate(const A &lo, const A &hi) const {
+    static_assert(aggregated, "aggregate requires AggregateIndex.");
+    if (hi < lo)
+        return aggregate_policy::identity();
+
+    FUNCTION_MAXIMA_COUNT(tree_descents, 2);
+    return arguments.summary_in_ranks(rank_of(function_points.lower_bound(lo)),
+                                      rank_of(function_points.upper_bound(hi)));
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::size_type
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::size() const noexcept {
     return function_points.size();
 }
 
-template<typename A, typename V>
-void FunctionMaxima<A, V>::get_info_for_set_value(tpl &p_info, tpl &ln_info,
-                                                  tpl &rn_info, const A &a, const V &v) const {
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::get_info_for_set_value(tpl &p_info, tpl &ln_info,
+                                                                                  tpl &rn_info,
+                                                                                  const iterator &position,
+                                                                                  const A &a, const V &v) const {
     using std::get;
-    p_info = std::make_tuple(end(), false, false, mx_end());
+    p_info = std::make_tuple(end(), false, false, mx_end(), false, false, local_minima.end());
     ln_info = p_info, rn_info = p_info;
 
-    if ((get<0>(p_info) = function_points.find(a)) != end()) {
-        std::tuple<iterator, iterator> aux = std::make_tuple(get<0>(p_info), get<0>(p_info));
-        if (size() != 0) {
-            get<0>(ln_info) = (get<0>(p_info) != begin() ? --get<0>(aux) : end());
-            get<0>(rn_info) = ++get<1>(aux);
-        }
+    std::tuple<iterator, iterator> aux = std::make_tuple(position, position);
+    if (position != end() && !(a < (*position).arg())) {
+        get<0>(p_info) = position; // a already belongs to the domain.
+        get<0>(rn_info) = ++get<1>(aux);
     } else {
-        if (size() != 0) {
-            auto new_point = PointType(a, v);
-            auto aux = function_points.lower_bound(new_point);
-            get<0>(rn_info) = aux;
-            get<0>(ln_info) = (aux != begin() ? --aux : end());
-        }
+        get<0>(rn_info) = position;
     }
+    get<0>(ln_info) = (position != begin() ? --get<0>(aux) : end());
 
-    get<1>(p_info) = (get<0>(p_info) != end() && local_maxima.find(*get<0>(p_info)) != mx_end());
-    get<1>(ln_info) = (get<0>(ln_info) != end() && local_maxima.find(*get<0>(ln_info)) != mx_end());
-    get<1>(rn_info) = (get<0>(rn_info) != end() && local_maxima.find(*get<0>(rn_info)) != mx_end());
+    // Each point knows whether it is a local maximum, so local_maxima is not searched.
+    get<1>(p_info) = (get<0>(p_info) != end() && (*get<0>(p_info)).is_local_maximum);
+    get<1>(ln_info) = (get<0>(ln_info) != end() && (*get<0>(ln_info)).is_local_maximum);
+    get<1>(rn_info) = (get<0>(rn_info) != end() && (*get<0>(rn_info)).is_local_maximum);
+
+    get<3>(p_info) = (get<1>(p_info) ? (*get<0>(p_info)).mx_it : mx_end());
+    get<3>(ln_info) = (get<1>(ln_info) ? (*get<0>(ln_info)).mx_it : mx_end());
+    get<3>(rn_info) = (get<1>(rn_info) ? (*get<0>(rn_info)).mx_it : mx_end());
     get<2>(p_info) = (get<0>(ln_info) == end() || !((v < (*get<0>(ln_info)).value())))
                      && (get<0>(rn_info) == end() || !(v < (*get<0>(rn_info)).value()));
 
-    std::tuple<iterator, iterator> aux = std::make_tuple(get<0>(ln_info), get<0>(rn_info));
+    aux = std::make_tuple(get<0>(ln_info), get<0>(rn_info));
     get<2>(ln_info) = get<0>(ln_info) != end() && (get<0>(ln_info) == begin() ||
                                                    !((*get<0>(ln_info)).value() <
                                                      (*(--get<0>(aux))).value()))
@@ -225,30 +1196,39 @@ void FunctionMaxima<A, V>::get_info_for_set_value(tpl &p_info, tpl &ln_info,
                       (++get<1>(aux) == end() ||
                        !((*get<0>(rn_info)).value() < (*get<1>(aux)).value()));
 
-    get<3>(p_info) = (get<0>(p_info) != end() ? local_maxima.find(*get<0>(p_info)) : mx_end());
-    get<3>(ln_info) = (get<0>(ln_info) != end() ? local_maxima.find(*get<0>(ln_info)) : mx_end());
-    get<3>(rn_info) = (get<0>(rn_info) != end() ? local_maxima.find(*get<0>(rn_info)) : mx_end());
-}
+    if constexpr (with_minima) {
+        // The same for local minima, with the comparisons reversed.
+        for (auto info : {&p_info, &ln_info, &rn_info}) {
+            get<4>(*info) = (get<0>(*info) != end() && (*get<0>(*info)).is_local_minimum);
+            get<6>(*info) = (get<4>(*info) ? (*get<0>(*info)).mn_it : local_minima.end());
+        }
 
-template<typename A, typename V>
-bool FunctionMaxima<A, V>::check_whether_the_same(const A &a, const V &v) const {
-    auto aux = function_points.find(a);
+        auto ln = get<0>(ln_info), rn = get<0>(rn_info);
+        get<5>(p_info) = (ln == end() || !((*ln).value() < v)) && (rn == end() || !((*rn).value() < v));
+        get<5>(ln_info) = ln != end() && (ln == begin() || !((*std::prev(ln)).value() < (*ln).value()))
+                          && !(v < (*ln).value());
+        get<5>(rn_info) = rn != end() && !(v < (*rn).value()) &&
+                          (std::next(rn) == end() || !((*std::next(rn)).value() < (*rn).value()));
+    }
+}
 
-    if (aux != end() && !((v < (*aux).value()) || ((*aux).value() < v))) {
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+bool FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::check_whether_the_same(const iterator &position,
+                                                            const A &a, const V &v) const {
+    if (position != end() && !(a < (*position).arg()) &&
+        !((v < (*position).value()) || ((*position).value() < v))) {
         return true;
     }
 
     return false;
 }
 
-template<typename A, typename V>
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
 void
-FunctionMaxima<A, V>::get_info_for_erase(FunctionMaxima<A, V>::tpl &p_info,
-                                         FunctionMaxima<A, V>::tpl &ln_info,
-                                         FunctionMaxima<A, V>::tpl &rn_info) {
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::get_info_for_erase(tpl &p_info, tpl &ln_info, tpl &rn_info) {
     using std::get;
-    get<3>(p_info) = local_maxima.find(*get<0>(p_info));
-    get<1>(p_info) = get<3>(p_info) != mx_end();
+    get<1>(p_info) = (*get<0>(p_info)).is_local_maximum;
+    get<3>(p_info) = (get<1>(p_info) ? (*get<0>(p_info)).mx_it : mx_end());
 
     if (size() != 0) {
         std::tuple<iterator, iterator> aux = std::make_tuple(get<0>(p_info), get<0>(p_info));
@@ -256,10 +1236,10 @@ FunctionMaxima<A, V>::get_info_for_erase(FunctionMaxima<A, V>::tpl &p_info,
         get<0>(rn_info) = ++get<1>(aux);
     }
 
-    get<3>(ln_info) = (get<0>(ln_info) != end() ? local_maxima.find(*get<0>(ln_info)) : mx_end());
-    get<3>(rn_info) = (get<0>(rn_info) != end() ? local_maxima.find(*get<0>(rn_info)) : mx_end());
-    get<1>(ln_info) = (get<0>(ln_info) != end() && local_maxima.find(*get<0>(ln_info)) != mx_end());
-    get<1>(rn_info) = (get<0>(rn_info) != end() && local_maxima.find(*get<0>(rn_info)) != mx_end());
+    get<1>(ln_info) = (get<0>(ln_info) != end() && (*get<0>(ln_info)).is_local_maximum);
+    get<1>(rn_info) = (get<0>(rn_info) != end() && (*get<0>(rn_info)).is_local_maximum);
+    get<3>(ln_info) = (get<1>(ln_info) ? (*get<0>(ln_info)).mx_it : mx_end());
+    get<3>(rn_info) = (get<1>(rn_info) ? (*get<0>(rn_info)).mx_it : mx_end());
 
     std::tuple<iterator, iterator> aux = std::make_tuple(get<0>(ln_info), get<0>(rn_info));
     get<2>(ln_info) = get<0>(ln_info) != end() && (get<0>(ln_info) == begin() ||
@@ -273,21 +1253,48 @@ FunctionMaxima<A, V>::get_info_for_erase(FunctionMaxima<A, V>::tpl &p_info,
                                                      (*get<0>(ln_info)).value())) &&
                       (++get<1>(aux) == end() ||
                        !((*get<0>(rn_info)).value() < (*get<1>(aux)).value()));
+
+    if constexpr (with_minima) {
+        // The same for local minima, with the comparisons reversed.
+        for (auto info : {&p_info, &ln_info, &rn_info}) {
+            get<4>(*info) = (get<0>(*info) != end() && (*get<0>(*info)).is_local_minimum);
+            get<6>(*info) = (get<4>(*info) ? (*get<0>(*info)).mn_it : local_minima.end());
+        }
+
+        auto ln = get<0>(ln_info), rn = get<0>(rn_info);
+        get<5>(ln_info) = ln != end() && (ln == begin() || !((*std::prev(ln)).value() < (*ln).value()))
+                          && (rn == end() || !((*rn).value() < (*ln).value()));
+        get<5>(rn_info) = rn != end() && (ln == end() || !((*ln).value() < (*rn).value())) &&
+                          (std::next(rn) == end() || !((*std::next(rn)).value() < (*rn).value()));
+    }
 }
 
-template<typename A, typename V>
-void FunctionMaxima<A, V>::erase_aux(const FunctionMaxima::tpl &p_info,
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::erase_aux(const FunctionMaxima::tpl &p_info,
                                      const FunctionMaxima::tpl &ln_info,
                                      const FunctionMaxima::tpl &rn_info) {
     using std::get;
     auto local_maxima_g = LocalMaximaUpdateGuard(&local_maxima);
+    mx_iterator ln_mx_it, rn_mx_it;
 
     if (!get<1>(ln_info) && get<2>(ln_info))
-        local_maxima_g.set_point_it(get<0>(local_maxima.insert(*get<0>(ln_info))));
+        local_maxima_g.set_ln_it(ln_mx_it = insert_local_maximum(*get<0>(ln_info)));
 
     if (!get<1>(rn_info) && get<2>(rn_info))
-        local_maxima_g.set_point_it(get<0>(local_maxima.insert(*get<0>(rn_info))));
+        local_maxima_g.set_rn_it(rn_mx_it = insert_local_maximum(*get<0>(rn_info)));
+
+    auto local_minima_g = LocalMinimaUpdateGuard(&local_minima);
+    mn_iterator ln_mn_it, rn_mn_it;
 
+    if (!get<4>(ln_info) && get<5>(ln_info))
+        local_minima_g.set_ln_it(ln_mn_it = insert_local_minimum(*get<0>(ln_info)));
+
+    if (!get<4>(rn_info) && get<5>(rn_info))
+        local_minima_g.set_rn_it(rn_mn_it = insert_local_minimum(*get<0>(rn_info)));
+
+    if (minimum.load(std::memory_order_relaxed) == &*get<0>(p_info))
+        mark_minimum_outdated();
+    arguments.erase(&*get<0>(p_info));
     function_points.erase(get<0>(p_info));
 
     if (get<1>(p_info))
@@ -299,30 +1306,61 @@ void FunctionMaxima<A, V>::erase_aux(const FunctionMaxima::tpl &p_info,
     if (get<1>(rn_info) && !get<2>(rn_info))
         local_maxima.erase(get<3>(rn_info));
 
+    erase_outdated_minima(p_info, ln_info, rn_info);
+
+    // Nothing can throw anymore, links of the neighbours are updated.
+    update_link(ln_info, ln_mx_it);
+    update_link(rn_info, rn_mx_it);
+    update_minimum_link(ln_info, ln_mn_it);
+    update_minimum_link(rn_info, rn_mn_it);
+    refresh_index(ln_info);
+    refresh_index(rn_info);
+    update_extrema();
+
     local_maxima_g.done();
+    local_minima_g.done();
 }
 
-template<typename A, typename V>
-void FunctionMaxima<A, V>::set_value_aux(const FunctionMaxima<A, V>::tpl &p_info,
-                                         const FunctionMaxima<A, V>::tpl &ln_info,
-                                         const FunctionMaxima<A, V>::tpl &rn_info,
-                                         const typename FunctionMaxima<A, V>::point_type &new_point) {
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::set_value_aux(const tpl &p_info, const tpl &ln_info,
+                                                                  const tpl &rn_info, const point_type &new_point) {
     using std::get;
-    auto point_insertion_g = PointInsertionGuard(get<0>(function_points.insert(new_point)),
-                                                 &function_points);
+    // The new point is placed right next to the old one (if any), so the hint spares another descent.
+    auto hint = (get<0>(p_info) != end() && new_point.value() < (*get<0>(p_info)).value()
+                 ? get<0>(p_info) : get<0>(rn_info));
+    bool new_minimum = precedes_minimum(new_point.arg(), new_point.value());
+    bool raised_minimum = !new_minimum && get<0>(p_info) != end() &&
+                          minimum.load(std::memory_order_relaxed) == &*get<0>(p_info);
+    auto new_point_it = function_points.emplace_hint(hint, new_point);
+    auto point_insertion_g = PointInsertionGuard(new_point_it, &function_points);
     auto local_maxima_g = LocalMaximaUpdateGuard(&local_maxima);
+    mx_iterator point_mx_it, ln_mx_it, rn_mx_it;
 
     if (get<2>(p_info))
-        local_maxima_g.set_point_it(get<0>(local_maxima.insert(new_point)));
+        local_maxima_g.set_point_it(point_mx_it = insert_local_maximum(new_point));
 
     if (!get<1>(ln_info) && get<2>(ln_info))
-        local_maxima_g.set_ln_it(get<0>(local_maxima.insert(*get<0>(ln_info))));
+        local_maxima_g.set_ln_it(ln_mx_it = insert_local_maximum(*get<0>(ln_info)));
 
     if (!get<1>(rn_info) && get<2>(rn_info))
-        local_maxima_g.set_rn_it(get<0>(local_maxima.insert(*get<0>(rn_info))));
+        local_maxima_g.set_rn_it(rn_mx_it = insert_local_maximum(*get<0>(rn_info)));
+
+    auto local_minima_g = LocalMinimaUpdateGuard(&local_minima);
+    mn_iterator point_mn_it, ln_mn_it, rn_mn_it;
+
+    if (get<5>(p_info))
+        local_minima_g.set_point_it(point_mn_it = insert_local_minimum(new_point));
 
-    if (get<0>(p_info) != end())
+    if (!get<4>(ln_info) && get<5>(ln_info))
+        local_minima_g.set_ln_it(ln_mn_it = insert_local_minimum(*get<0>(ln_info)));
+
+    if (!get<4>(rn_info) && get<5>(rn_info))
+        local_minima_g.set_rn_it(rn_mn_it = insert_local_minimum(*get<0>(rn_info)));
+
+    if (get<0>(p_info) != end()) {
+        arguments.erase(&*get<0>(p_info));
         function_points.erase(get<0>(p_info));
+    }
 
     if (get<1>(p_info))
         local_maxima.erase(get<3>(p_info));
@@ -333,16 +1371,492 @@ void FunctionMaxima<A, V>::set_value_aux(const FunctionMaxima<A, V>::tpl &p_info
     if (get<1>(rn_info) && !get<2>(rn_info))
         local_maxima.erase(get<3>(rn_info));
 
+    erase_outdated_minima(p_info, ln_info, rn_info);
+
+    // Nothing can throw anymore, links of the new point and the neighbours are updated.
+    (*new_point_it).is_local_maximum = get<2>(p_info);
+    (*new_point_it).mx_it = point_mx_it;
+    if constexpr (with_minima) {
+        (*new_point_it).is_local_minimum = get<5>(p_info);
+        (*new_point_it).mn_it = point_mn_it;
+    }
+    update_link(ln_info, ln_mx_it);
+    update_link(rn_info, rn_mx_it);
+    update_minimum_link(ln_info, ln_mn_it);
+    update_minimum_link(rn_info, rn_mn_it);
+    arguments.insert(&*new_point_it, (new_point_it != begin() ? &*std::prev(new_point_it) : nullptr));
+    refresh_index(ln_info);
+    refresh_index(rn_info);
+    if (new_minimum)
+        minimum.store(&*new_point_it, std::memory_order_relaxed);
+    else if (raised_minimum)
+        mark_minimum_outdated();
+    update_extrema();
+
     point_insertion_g.done();
     local_maxima_g.done();
+    local_minima_g.done();
 }
 
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+template<typename ForwardIt>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::set_values(ForwardIt first, ForwardIt last) {
+#ifdef FUNCTION_MAXIMA_STATS
+    auto stats_scope = StatsScope(this);
+#endif
+    auto batch = sorted_function_maxima_batch<A>(first, last, [](const auto &point) -> const auto & {
+        return point.first;
+    });
+    auto guard = BatchUpdateGuard(this, batch.size());
+
+    // New points are inserted next to the old ones, which stay until the batch is committed.
+    for (const auto &entry : batch) {
+        const A &a = entry.arg();
+        const V &v = (*entry.it).second;
+        FUNCTION_MAXIMA_COUNT(tree_descents, 1);
+        auto position = function_points.lower_bound(a);
+        if (check_whether_the_same(position, a, v))
+            continue; // Nothing changes if we set the same value for a.
+
+        bool found = position != end() && !(a < (*position).arg());
+        auto new_point = make_point(a, v);
+        auto hint = (found && !(v < (*position).value()) ? std::next(position) : position);
+        guard.add_inserted(function_points.emplace_hint(hint, new_point));
+        if (found)
+            guard.add_outdated(position);
+    }
 
-template<typename A, typename V>
-class FunctionMaxima<A, V>::PointInsertionGuard {
+    batch_update_aux(guard);
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+template<typename Range>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::set_values(const Range &points) {
+    set_values(std::begin(points), std::end(points));
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+template<typename ForwardIt>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::erase_many(ForwardIt first, ForwardIt last) {
+#ifdef FUNCTION_MAXIMA_STATS
+    auto stats_scope = StatsScope(this);
+#endif
+    auto batch = sorted_function_maxima_batch<A>(first, last, [](const auto &argument) -> const auto & {
+        return argument;
+    });
+    auto guard = BatchUpdateGuard(this, batch.size());
+
+    for (const auto &entry : batch) {
+        FUNCTION_MAXIMA_COUNT(tree_descents, 1);
+        auto position = function_points.find(entry.arg());
+        if (position != end())
+            guard.add_outdated(position);
+    }
+
+    batch_update_aux(guard);
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+template<typename Range>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::erase_many(const Range &arguments) {
+    erase_many(std::begin(arguments), std::end(arguments));
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::build_local_maxima() {
+    auto maxima = std::vector<iterator>(), minima = std::vector<iterator>();
+    if constexpr (std::is_arithmetic<V>::value) {
+        // Values are copied into an array, so that the kernel checks all of them at once.
+        auto values = std::vector<V>();
+        values.reserve(size());
+        for (const auto &point : function_points)
+            values.push_back(point.value());
+
+        auto is_maximum = std::vector<unsigned char>(values.size());
+        auto is_minimum = std::vector<unsigned char>(with_minima ? values.size() : 0);
+        LocalExtremaKernel<V>::maxima(values.data(), values.size(), is_maximum.data());
+        if (with_minima)
+            LocalExtremaKernel<V>::minima(values.data(), values.size(), is_minimum.data());
+
+        size_t i = 0;
+        for (auto it = begin(); it != end(); ++it, ++i) {
+            if (is_maximum[i])
+                maxima.push_back(it);
+            if (with_minima && is_minimum[i])
+                minima.push_back(it);
+        }
+    } else {
+        for (auto it = begin(), prev = end(); it != end(); prev = it++) {
+            auto next = std::next(it);
+            if ((prev == end() || !((*it).value() < (*prev).value())) &&
+                (next == end() || !((*it).value() < (*next).value())))
+                maxima.push_back(it);
+            if (with_minima && (prev == end() || !((*prev).value() < (*it).value())) &&
+                (next == end() || !((*next).value() < (*it).value())))
+                minima.push_back(it);
+        }
+    }
+
+    // Maxima are sorted by arguments, a stable sort by values gives the order of local_maxima.
+    std::stable_sort(maxima.begin(), maxima.end(), [](const iterator &lk, const iterator &rk) {
+        return (*rk).value() < (*lk).value();
+    });
+
+    for (const auto &it : maxima) {
+        (*it).mx_it = local_maxima.emplace_hint(mx_end(), static_cast<const PointType &>(*it));
+        (*it).is_local_maximum = true;
+    }
+
+    if constexpr (with_minima) {
+        std::stable_sort(minima.begin(), minima.end(), [](const iterator &lk, const iterator &rk) {
+            return (*lk).value() < (*rk).value();
+        });
+
+        for (const auto &it : minima) {
+            (*it).mn_it = local_minima.emplace_hint(local_minima.end(), *it);
+            (*it).is_local_minimum = true;
+        }
+    }
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::find_local_extrema(const std::vector<iterator> &points,
+                                                                              std::vector<unsigned char> &maxima,
+                                                                              std::vector<unsigned char> &minima) const {
+    maxima.assign(points.size(), 0);
+    minima.assign(with_minima ? points.size() : 0, 0);
+
+    if constexpr (std::is_arithmetic<V>::value) {
+        // A missing neighbour is replaced by the point itself, which never beats it.
+        auto left = std::vector<V>(), values = std::vector<V>(), right = std::vector<V>();
+        left.reserve(points.size());
+        values.reserve(points.size());
+        right.reserve(points.size());
+        for (const auto &it : points) {
+            auto ln = prev_present(it), rn = next_present(it);
+            values.push_back((*it).value());
+            left.push_back(ln != end() ? (*ln).value() : (*it).value());
+            right.push_back(rn != end() ? (*rn).value() : (*it).value());
+        }
+
+        LocalExtremaKernel<V>::maxima(left.data(), values.data(), right.data(), points.size(), maxima.data());
+        if (with_minima)
+            LocalExtremaKernel<V>::minima(left.data(), values.data(), right.data(), points.size(), minima.data());
+    } else {
+        for (size_t i = 0; i < points.size(); ++i) {
+            const auto &it = points[i];
+            auto ln = prev_present(it), rn = next_present(it);
+            maxima[i] = (ln == end() || !((*it).value() < (*ln).value())) &&
+                        (rn == end() || !((*it).value() < (*rn).value()));
+            if (with_minima) {
+                minima[i] = (ln == end() || !((*ln).value() < (*it).value())) &&
+                            (rn == end() || !((*rn).value() < (*it).value()));
+            }
+        }
+    }
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::iterator
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::next_present(iterator it) const noexcept {
+    do {
+        ++it;
+    } while (it != end() && (*it).is_outdated);
+    return it;
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::iterator
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::prev_present(iterator it) const noexcept {
+    while (it != begin()) {
+        if (!(*--it).is_outdated)
+            return it;
+    }
+    return end();
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::batch_update_aux(BatchUpdateGuard &guard) {
+    auto affected = std::vector<iterator>(); // Points which might change their status, sorted by arguments.
+    auto lost = std::vector<iterator>(); // Points which stop being local maxima.
+    auto lost_minima = std::vector<iterator>(); // Points which stop being local minima.
+    affected.reserve(3 * (guard.inserted.size() + guard.outdated.size()));
+    lost.reserve(affected.capacity());
+    if (with_minima)
+        lost_minima.reserve(affected.capacity());
+
+    auto add_affected = [&](const iterator &it) {
+        if (it != end() && (affected.empty() || (*affected.back()).arg() < (*it).arg()))
+            affected.push_back(it);
+    };
+
+    /* Both sequences are sorted, so are the neighbours of their merge. A new point goes before the outdated one
+     * with the same argument, because its neighbours are the first ones not added yet.
+     */
+    auto ins = guard.inserted.begin(), out = guard.outdated.begin();
+    while (ins != guard.inserted.end() || out != guard.outdated.end()) {
+        iterator it;
+        if (out == guard.outdated.end() ||
+            (ins != guard.inserted.end() && !((*(*out)).arg() < (*(*ins)).arg()))) {
+            it = *ins++;
+        } else {
+            it = *out++;
+        }
+
+        add_affected(prev_present(it));
+        if (!(*it).is_outdated)
+            add_affected(it);
+        add_affected(next_present(it));
+    }
+
+    auto will_maxima = std::vector<unsigned char>(), will_minima = std::vector<unsigned char>();
+    find_local_extrema(affected, will_maxima, will_minima);
+
+    for (size_t i = 0; i < affected.size(); ++i) {
+        const auto &it = affected[i];
+        bool will = will_maxima[i];
+
+        if (will && !(*it).is_local_maximum)
+            guard.add_local_maximum(it, insert_local_maximum(*it));
+        else if (!will && (*it).is_local_maximum)
+            lost.push_back(it);
+
+        if constexpr (with_minima) {
+            bool will_min = will_minima[i];
+
+            if (will_min && !(*it).is_local_minimum)
+                guard.add_local_minimum(it, insert_local_minimum(*it));
+            else if (!will_min && (*it).is_local_minimum)
+                lost_minima.push_back(it);
+        }
+    }
+
+    // The first inserted point preceding the kept minimum precedes all the others as well.
+    auto new_minimum = end();
+    for (const auto &it : guard.inserted) {
+        if (precedes_minimum((*it).arg(), (*it).value()) &&
+            (new_minimum == end() || (*it).value() < (*new_minimum).value()))
+            new_minimum = it;
+    }
+
+    // Nothing can throw anymore, the batch is committed. With LocalMinima update_extrema() sets the minimum.
+    if constexpr (!with_minima) {
+        const PointType *kept_minimum = minimum.load(std::memory_order_relaxed);
+        if (new_minimum != end())
+            minimum.store(&*new_minimum, std::memory_order_relaxed);
+        else if (kept_minimum != nullptr && static_cast<const FunctionPoint *>(kept_minimum)->is_outdated)
+            mark_minimum_outdated();
+    }
+
+    for (const auto &it : lost) {
+        local_maxima.erase((*it).mx_it);
+        (*it).is_local_maximum = false;
+    }
+
+    for (const auto &p : guard.maxima) {
+        (*p.first).is_local_maximum = true;
+        (*p.first).mx_it = p.second;
+    }
+
+    if constexpr (with_minima) {
+        for (const auto &it : lost_minima) {
+            local_minima.erase((*it).mn_it);
+            (*it).is_local_minimum = false;
+        }
+
+        for (const auto &p : guard.minima) {
+            (*p.first).is_local_minimum = true;
+            (*p.first).mn_it = p.second;
+        }
+
+        for (const auto &it : guard.outdated) {
+            if ((*it).is_local_minimum)
+                local_minima.erase((*it).mn_it);
+        }
+    }
+
+    // In the order of arguments, so the predecessor of every inserted point is already in the index.
+    for (const auto &it : guard.inserted)
+        arguments.insert(&*it, (it != begin() ? &*std::prev(it) : nullptr));
+
+    for (const auto &it : guard.outdated) {
+        if ((*it).is_local_maximum)
+            local_maxima.erase((*it).mx_it);
+        arguments.erase(&*it);
+        function_points.erase(it);
+    }
+
+    for (const auto &it : lost)
+        arguments.refresh(&*it);
+
+    for (const auto &p : guard.maxima)
+        arguments.refresh(&*p.first);
+
+    update_extrema();
+    guard.done();
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+template<typename Arg, typename Value>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::make_point(Arg &&a, Value &&v) const {
+    return make_point(std::piecewise_construct, std::forward_as_tuple(std::forward<Arg>(a)),
+                      std::forward_as_tuple(std::forward<Value>(v)));
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+template<typename ArgTuple, typename ValueTuple>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::make_point(std::piecewise_construct_t, ArgTuple &&arg_args, ValueTuple &&value_args) const {
+    return PointType(std::forward<ArgTuple>(arg_args), std::forward<ValueTuple>(value_args),
+                     allocator_for<typename PointType::PointData>(function_points.get_allocator()));
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::mx_iterator
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::insert_local_maximum(const PointType &point) {
+    FUNCTION_MAXIMA_COUNT(tree_descents, 1);
+    return std::get<0>(local_maxima.emplace(point));
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::update_link(const tpl &info,
+                                                                       const mx_iterator &mx_it) noexcept {
+    using std::get;
+    if (!get<1>(info) && get<2>(info)) {
+        (*get<0>(info)).is_local_maximum = true;
+        (*get<0>(info)).mx_it = mx_it;
+    } else if (get<1>(info) && !get<2>(info)) {
+        (*get<0>(info)).is_local_maximum = false;
+    }
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::mn_iterator
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::insert_local_minimum(const PointType &point) {
+    FUNCTION_MAXIMA_COUNT(tree_descents, 1);
+    return std::get<0>(local_minima.insert(point));
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::update_minimum_link(const tpl &info,
+                                                                               const mn_iterator &mn_it) noexcept {
+    using std::get;
+    if constexpr (with_minima) {
+        if (!get<4>(info) && get<5>(info)) {
+            (*get<0>(info)).is_local_minimum = true;
+            (*get<0>(info)).mn_it = mn_it;
+        } else if (get<4>(info) && !get<5>(info)) {
+            (*get<0>(info)).is_local_minimum = false;
+        }
+    }
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::erase_outdated_minima(const tpl &p_info, const tpl &ln_info,
+                                                                         const tpl &rn_info) noexcept {
+    using std::get;
+    if (get<4>(p_info))
+        local_minima.erase(get<6>(p_info));
+
+    if (get<4>(ln_info) && !get<5>(ln_info))
+        local_minima.erase(get<6>(ln_info));
+
+    if (get<4>(rn_info) && !get<5>(rn_info))
+        local_minima.erase(get<6>(rn_info));
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+V const &FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::global_max() const {
+    if (maximum == nullptr)
+        throw InvalidArg();
+    return maximum->value();
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+A const &FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::argmax() const {
+    if (maximum == nullptr)
+        throw InvalidArg();
+    return maximum->arg();
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+V const &FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::global_min() const {
+    return minimum_point().value();
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+A const &FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::argmin() const {
+    return minimum_point().arg();
+}
+
+/* Calls racing for an outdated minimum find the same point, it is published before the flag is cleared.
+ * If a comparison throws, nothing is changed.
+ */
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+const typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType &
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::minimum_point() const {
+    if (minimum_outdated.load(std::memory_order_acquire)) {
+        const PointType *result = nullptr;
+        for (const auto &point : function_points) {
+            if (result == nullptr || point.value() < result->value())
+                result = &point;
+        }
+        minimum.store(result, std::memory_order_relaxed);
+        minimum_outdated.store(false, std::memory_order_release);
+    }
+
+    const PointType *result = minimum.load(std::memory_order_relaxed);
+    if (result == nullptr)
+        throw InvalidArg();
+    return *result;
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::size_type
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::rank_of(const iterator &it) const noexcept {
+    return (it != end() ? arguments.rank(&*it) : size());
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::update_extrema() noexcept {
+    maximum = (local_maxima.empty() ? nullptr : &*local_maxima.begin());
+    // The first local minimum is the first point with the smallest value.
+    if constexpr (with_minima)
+        minimum.store(local_minima.empty() ? nullptr : &*local_minima.begin(), std::memory_order_relaxed);
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+bool FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::precedes_minimum(const A &a, const V &v) const {
+    // Local minima keep the minimum by themselves, an outdated one stays so until it is found again.
+    if (with_minima || minimum_outdated.load(std::memory_order_relaxed))
+        return false;
+    const PointType *kept = minimum.load(std::memory_order_relaxed);
+    if (kept == nullptr)
+        return true;
+    return v < kept->value() || (!(kept->value() < v) && !(kept->arg() < a));
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::mark_minimum_outdated() noexcept {
+    if constexpr (!with_minima) {
+        minimum.store(nullptr, std::memory_order_relaxed);
+        minimum_outdated.store(true, std::memory_order_relaxed);
+    }
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::refresh_index(const tpl &info) noexcept {
+    using std::get;
+    if (get<1>(info) != get<2>(info))
+        arguments.refresh(&*get<0>(info));
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+class FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointInsertionGuard {
 public:
     PointInsertionGuard(const iterator &it,
-                        std::set<point_type, FunctionPointsComparator> *fun_points)
+                        function_points_set *fun_points)
             : m_it(it), reverse(true), m_function_points(fun_points) {}
 
     ~PointInsertionGuard() noexcept {
@@ -358,25 +1872,130 @@ public:
 private:
     const iterator m_it;
     bool reverse;
-    std::set<point_type, FunctionPointsComparator> *m_function_points; // It should be a pointer.
+    function_points_set *m_function_points; // It should be a pointer.
 };
 
-template<typename A, typename V>
-class FunctionMaxima<A, V>::FunctionPointsComparator {
+/* Remembers everything a batch update changed before being committed:
+ * inserted points, points marked as outdated and inserted local maxima and minima (with their points).
+ */
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+class FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::BatchUpdateGuard {
+public:
+    // Memory for the whole batch is reserved upfront, so adding to the guard never throws.
+    BatchUpdateGuard(FunctionMaxima *function_maxima, size_type batch_size)
+            : m_function_maxima(function_maxima), reverse(true) {
+        inserted.reserve(batch_size);
+        outdated.reserve(batch_size);
+        maxima.reserve(3 * batch_size);
+        if (with_minima)
+            minima.reserve(3 * batch_size);
+    }
+
+    ~BatchUpdateGuard() noexcept {
+        if (reverse) {
+            for (const auto &p : maxima)
+                m_function_maxima->local_maxima.erase(p.second);
+
+            for (const auto &p : minima)
+                m_function_maxima->local_minima.erase(p.second);
+
+            for (const auto &it : outdated)
+                (*it).is_outdated = false;
+
+            for (const auto &it : inserted)
+                m_function_maxima->function_points.erase(it);
+        }
+    }
+
+    void add_inserted(const iterator &it) noexcept {
+        inserted.push_back(it);
+    }
+
+    void add_outdated(const iterator &it) noexcept {
+        (*it).is_outdated = true;
+        outdated.push_back(it);
+    }
+
+    void add_local_maximum(const iterator &it, const mx_iterator &mx_it) noexcept {
+        maxima.emplace_back(it, mx_it);
+    }
+
+    void add_local_minimum(const iterator &it, const mn_iterator &mn_it) noexcept {
+        minima.emplace_back(it, mn_it);
+    }
+
+    void done() noexcept {
+        reverse = false;
+    }
+
+private:
+    friend class FunctionMaxima;
+
+    FunctionMaxima *m_function_maxima; // It should be a pointer.
+    bool reverse;
+    std::vector<iterator> inserted, outdated; // Both sorted by arguments.
+    std::vector<std::pair<iterator, mx_iterator>> maxima;
+    std::vector<std::pair<iterator, mn_iterator>> minima;
+};
+
+#ifdef FUNCTION_MAXIMA_STATS
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+class FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::StatsScope {
+public:
+    StatsScope(FunctionMaxima *function_maxima) noexcept
+            : m_function_maxima(function_maxima), start(FunctionMaximaStats::thread_counters()) {}
+
+    // Counters are attributed also when the operation throws.
+    ~StatsScope() noexcept {
+        auto difference = FunctionMaximaStats::thread_counters();
+        difference -= start;
+        difference.operations = 1;
+        m_function_maxima->last_stats = difference;
+        m_function_maxima->total_stats += difference;
+    }
+
+private:
+    FunctionMaxima *m_function_maxima; // It should be a pointer.
+    FunctionMaximaStats start;
+};
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+const FunctionMaximaStats &FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::stats() const noexcept {
+    return total_stats;
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+const FunctionMaximaStats &FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::last_operation_stats() const noexcept {
+    return last_stats;
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::reset_stats() noexcept {
+    total_stats = last_stats = FunctionMaximaStats();
+}
+
+#endif // FUNCTION_MAXIMA_STATS
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+class FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::FunctionPointsComparator {
 public:
     using is_transparent = std::true_type;
 
-    bool operator()(const FunctionMaxima<A, V>::PointType &lk,
+    bool operator()(const FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType &lk,
                     const A &fk) const {
+        FUNCTION_MAXIMA_COUNT(comparisons, 1);
         return lk.arg() < fk;
     }
 
-    bool operator()(const A &fk, const FunctionMaxima<A, V>::PointType &lk) const {
+    bool operator()(const A &fk, const FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType &lk) const {
+        FUNCTION_MAXIMA_COUNT(comparisons, 1);
         return fk < lk.arg();
     }
 
-    bool operator()(const FunctionMaxima<A, V>::PointType &fk,
-                    const FunctionMaxima<A, V>::PointType &lk) const {
+    bool operator()(const FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType &fk,
+                    const FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType &lk) const {
+        FUNCTION_MAXIMA_COUNT(comparisons, 1);
         if (lk.arg() < fk.arg() || fk.arg() < lk.arg()) {
             return fk.arg() < lk.arg();
         }
@@ -385,55 +2004,111 @@ public:
     }
 };
 
-template<typename A, typename V>
-class FunctionMaxima<A, V>::LocalMaximaComparator {
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+class FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::LocalMaximaComparator {
 public:
     using is_transparent = std::true_type;
 
-    bool operator()(const FunctionMaxima<A, V>::PointType &fk,
-                    const FunctionMaxima<A, V>::PointType &lk) const {
+    bool operator()(const FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType &fk,
+                    const FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType &lk) const {
+        FUNCTION_MAXIMA_COUNT(comparisons, 1);
         if (lk.value() < fk.value() || fk.value() < lk.value()) {
             return lk.value() < fk.value();
         }
 
         return fk.arg() < lk.arg();
     }
+
+    // A point precedes the bound if its value is greater, the bound precedes points with smaller values.
+    bool operator()(const FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType &fk,
+                    const ValueBound &lk) const {
+        FUNCTION_MAXIMA_COUNT(comparisons, 1);
+        return lk.value < fk.value();
+    }
+
+    bool operator()(const ValueBound &fk,
+                    const FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType &lk) const {
+        FUNCTION_MAXIMA_COUNT(comparisons, 1);
+        return lk.value() < fk.value;
+    }
 };
 
-template<typename A, typename V>
-class FunctionMaxima<A, V>::LocalMaximaUpdateGuard {
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+class FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::LocalMinimaComparator {
+public:
+    bool operator()(const FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType &fk,
+                    const FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType &lk) const {
+        FUNCTION_MAXIMA_COUNT(comparisons, 1);
+        if (lk.value() < fk.value() || fk.value() < lk.value()) {
+            return fk.value() < lk.value();
+        }
+
+        return fk.arg() < lk.arg();
+    }
+};
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+struct FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ValueBound {
+    const V &value;
+};
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+template<typename Iterator>
+class FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::SubRange {
+public:
+    SubRange(Iterator first, Iterator last) noexcept : first(first), last(last) {}
+
+    Iterator begin() const noexcept {
+        return first;
+    }
+
+    Iterator end() const noexcept {
+        return last;
+    }
+
+    bool empty() const noexcept {
+        return first == last;
+    }
+
+private:
+    Iterator first, last;
+};
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+template<typename Set>
+class FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::LocalExtremaUpdateGuard {
 public:
-    LocalMaximaUpdateGuard(std::set<point_type, LocalMaximaComparator> *loc_maxima)
-            : m_local_maxima(loc_maxima), reverse(true),
+    LocalExtremaUpdateGuard(Set *loc_extrema)
+            : m_local_extrema(loc_extrema), reverse(true),
               is_point_it_not_null(false), is_ln_it_not_null(false), is_rn_it_not_null(false) {}
 
-    ~LocalMaximaUpdateGuard() noexcept {
+    ~LocalExtremaUpdateGuard() noexcept {
         if (reverse) {
             if (is_point_it_not_null) {
-                (*m_local_maxima).erase(point_it);
+                (*m_local_extrema).erase(point_it);
             }
 
             if (is_ln_it_not_null) {
-                (*m_local_maxima).erase(ln_it);
+                (*m_local_extrema).erase(ln_it);
             }
 
             if (is_rn_it_not_null) {
-                (*m_local_maxima).erase(rn_it);
+                (*m_local_extrema).erase(rn_it);
             }
         }
     }
 
-    void set_point_it(mx_iterator it) noexcept {
+    void set_point_it(typename Set::iterator it) noexcept {
         point_it = it;
         is_point_it_not_null = true;
     }
 
-    void set_ln_it(mx_iterator it) noexcept {
+    void set_ln_it(typename Set::iterator it) noexcept {
         ln_it = it;
         is_ln_it_not_null = true;
     }
 
-    void set_rn_it(mx_iterator it) noexcept {
+    void set_rn_it(typename Set::iterator it) noexcept {
         rn_it = it;
         is_rn_it_not_null = true;
     }
@@ -443,20 +2118,97 @@ public:
     }
 
 private:
-    mx_iterator point_it, ln_it, rn_it;
-    std::set<point_type, LocalMaximaComparator> *m_local_maxima; // It should be a pointer.
+    typename Set::iterator point_it, ln_it, rn_it;
+    Set *m_local_extrema; // It should be a pointer.
     bool reverse, is_point_it_not_null, is_ln_it_not_null, is_rn_it_not_null;
 };
 
-template<typename A, typename V>
-class FunctionMaxima<A, V>::PointConstructionGuard {
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+class FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType {
 public:
-    PointConstructionGuard(std::shared_ptr<A> *data) : reverse(true), m_data(data) {};
+    // Copying enabled.
+    PointType(const PointType &other) noexcept;
+
+    // Assigning enabled.
+    PointType &operator=(PointType other) noexcept;
+
+    A const &arg() const noexcept;
+
+    V const &value() const noexcept;
+
+    ~PointType() noexcept;
+
+private:
+    friend class FunctionMaxima;
+
+    struct PointData; // Block holding the argument, the value and the counter of points sharing them.
+
+    // A and V of inline points.
+    struct InlineData {
+        A argument;
+        V value;
+    };
+
+    static constexpr bool stored_inline = InlinePoints<A, V>::value;
+
+    // InlinePoints might be specialised, the noexcept assignment swaps A and V of inline points.
+    static_assert(!stored_inline || (std::is_nothrow_move_constructible<A>::value &&
+                                     std::is_nothrow_move_constructible<V>::value &&
+                                     std::is_nothrow_move_assignable<A>::value &&
+                                     std::is_nothrow_move_assignable<V>::value),
+                  "A and V of inline points have to be moved without throwing.");
+
+    using data_allocator = allocator_for<PointData>;
+    using data_traits = std::allocator_traits<data_allocator>;
+    using data_type = std::conditional_t<stored_inline, InlineData, PointData *>;
+
+    // Creating new points is disabled for interface users. A and V are constructed from the elements of the tuples.
+    template<typename ArgTuple, typename ValueTuple>
+    PointType(ArgTuple &&arg_args, ValueTuple &&value_args, const data_allocator &alloc);
+
+    // A and V constructed inline, or a new block holding them.
+    template<typename ArgTuple, typename ValueTuple>
+    static data_type make_data(ArgTuple &&arg_args, ValueTuple &&value_args, const data_allocator &alloc);
+
+    /* Copying objects of A and V might be expensive, therefore they are shared between copies of a point.
+     * Both of them live in one counted block, so creating a point costs a single allocation.
+     * Cheap ones (see InlinePoints) are kept inline, copied together with the point.
+     */
+    data_type point_data;
+};
+
+// The block keeps the allocator it came from (empty allocators take no space), the last point releases it with it.
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+struct FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType::PointData : data_allocator {
+    // A and V are constructed directly in the block (make_from_tuple returns them without a copy).
+    template<typename ArgTuple, typename ValueTuple>
+    PointData(ArgTuple &&arg_args, ValueTuple &&value_args, const data_allocator &alloc)
+            : data_allocator(alloc), argument(std::make_from_tuple<A>(std::forward<ArgTuple>(arg_args))),
+              value(std::make_from_tuple<V>(std::forward<ValueTuple>(value_args))), counter(1) {}
+
+    const A argument;
+    const V value;
+    typename RefCount::counter_type counter; // Number of points sharing this block.
+};
+
+// Releases the memory of a block if constructing it throws.
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+class FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointConstructionGuard {
+    using PointData = typename PointType::PointData;
+    using data_allocator = typename PointType::data_allocator;
+    using data_traits = typename PointType::data_traits;
+
+public:
+    PointConstructionGuard(data_allocator &alloc, PointData *point_data) noexcept
+            : m_alloc(&alloc), point_data(point_data), reverse(true) {}
+
+    PointConstructionGuard(const PointConstructionGuard &other) = delete;
+
+    PointConstructionGuard &operator=(const PointConstructionGuard &other) = delete;
 
     ~PointConstructionGuard() noexcept {
-        if (reverse) {
-            m_data->reset();
-        }
+        if (reverse)
+            data_traits::deallocate(*m_alloc, point_data, 1);
     }
 
     void done() noexcept {
@@ -464,69 +2216,572 @@ public:
     }
 
 private:
+    data_allocator *m_alloc; // It should be a pointer.
+    PointData *point_data;
     bool reverse;
-    std::shared_ptr<A> *m_data; // It should be a pointer, because we don`t want to increase counter for sharing A.
 };
 
-template<typename A, typename V>
-class FunctionMaxima<A, V>::PointType {
-public:
-    // Copying enabled.
-    PointType(const PointType &other) noexcept = default;
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType::PointType(const PointType &other) noexcept
+        : point_data(other.point_data) {
+    if constexpr (!stored_inline)
+        RefCount::increment(point_data->counter);
+}
 
-    // Assigning enabled.
-    PointType &operator=(PointType other) noexcept;
+// Noexcept alignment operator for PointType.
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType &
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType::operator=(PointType other) noexcept {
+    std::swap(point_data, other.point_data); // Swap is noexcept!!
 
-    A const &arg() const noexcept;
+    return *this;
+}
 
-    V const &value() const noexcept;
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+template<typename ArgTuple, typename ValueTuple>
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType::PointType(ArgTuple &&arg_args,
+                                                                           ValueTuple &&value_args,
+                                                                           const data_allocator &alloc)
+        : point_data(make_data(std::forward<ArgTuple>(arg_args), std::forward<ValueTuple>(value_args), alloc)) {}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+template<typename ArgTuple, typename ValueTuple>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType::data_type
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType::make_data(ArgTuple &&arg_args,
+                                                                           ValueTuple &&value_args,
+                                                                           const data_allocator &alloc) {
+    if constexpr (stored_inline) {
+        return InlineData{std::make_from_tuple<A>(std::forward<ArgTuple>(arg_args)),
+                          std::make_from_tuple<V>(std::forward<ValueTuple>(value_args))};
+    } else {
+        auto block_alloc = alloc;
+        PointData *block = data_traits::allocate(block_alloc, 1);
+
+        // Either both A and V are constructed or nothing is allocated.
+        PointConstructionGuard guard(block_alloc, block);
+        data_traits::construct(block_alloc, block, std::forward<ArgTuple>(arg_args),
+                               std::forward<ValueTuple>(value_args), alloc);
+        guard.done();
+        return block;
+    }
+}
 
-    ~PointType() noexcept;
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+A const &FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType::arg() const noexcept {
+    if constexpr (stored_inline)
+        return point_data.argument;
+    else
+        return point_data->argument;
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+V const &FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType::value() const noexcept {
+    if constexpr (stored_inline)
+        return point_data.value;
+    else
+        return point_data->value;
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::PointType::~PointType() noexcept {
+    // Counter decreased, the last point sharing the block releases it.
+    if constexpr (!stored_inline) {
+        if (RefCount::decrement(point_data->counter)) {
+            data_allocator block_alloc = *point_data; // The allocator stored in the block outlives it.
+            data_traits::destroy(block_alloc, point_data);
+            data_traits::deallocate(block_alloc, point_data, 1);
+        }
+    }
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+class FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::FunctionPoint
+        : public PointType, public index_hook, public minima_hook {
+public:
+    explicit FunctionPoint(const PointType &point) noexcept
+            : PointType(point), is_local_maximum(false), is_outdated(false), mx_it() {}
 
 private:
     friend class FunctionMaxima;
 
-    // Creating new points is disabled for interface users.
-    PointType(const A &arg, const V &val);
+    /* Members are not a part of the point's identity, they are only updated when nothing can throw anymore.
+     * mx_it is valid only if is_local_maximum is true. is_outdated is true only while a batch update
+     * is going to erase the point (the guard resets it if the batch fails).
+     */
+    mutable bool is_local_maximum;
+    mutable bool is_outdated;
+    mutable mx_iterator mx_it;
+};
 
-    std::shared_ptr<A> point_argument; // Copying objects of A might be expensive, therefore usage of shared_ptr.
-    std::shared_ptr<V> point_value; // Copying objects of V might be expensive, therefore usage of shared_ptr.
+// mn_it is valid only if is_local_minimum is true, both are updated as the members of FunctionPoint.
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+class FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::MinimaHook {
+public:
+    mutable bool is_local_minimum = false;
+    mutable mn_iterator mn_it;
 };
 
-// Noexcept alignment operator for PointType.
-template<typename A, typename V>
-typename FunctionMaxima<A, V>::PointType &
-FunctionMaxima<A, V>::PointType::operator=(FunctionMaxima<A, V>::PointType other) noexcept {
-    point_argument.swap(other.arg()); // Swap is noexcept!!
-    point_value.swap(other.value()); // Swap is noexcept!!
+// Summary of the subtree, recomputed by queries if summary_dirty is set (like best of IndexHook).
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+class FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::SummaryHook {
+public:
+    mutable aggregate_type summary = aggregate_policy::identity();
+    mutable bool summary_dirty = true;
+};
 
-    return *this;
+/* Members are set by ArgumentIndex only. Numbers of points and local maxima in the subtree are updated
+ * with every change, the point with the greatest value (best) is recomputed by queries if dirty is set.
+ * Queries running at once compute the same best, so it is published atomically and they might share the hook.
+ */
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+class FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::IndexHook : public summary_hook {
+public:
+    IndexHook() noexcept = default;
+
+    // Links are not copied, the index of the copy links its points again.
+    IndexHook(const IndexHook &other) : summary_hook(other) {}
+
+    mutable const FunctionPoint *parent, *left, *right;
+    mutable std::atomic<const FunctionPoint *> best;
+    mutable size_t priority;
+    mutable size_type points, maxima;
+    mutable std::atomic<bool> dirty;
+};
+
+/* Treap ordered by arguments, with parent links. Updates do not compare anything, positions are given by
+ * function_points, so they are noexcept and done only when an operation is being committed.
+ */
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+class FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex {
+public:
+    using node = const FunctionPoint *;
+
+    ArgumentIndex() noexcept : root(nullptr), seed(0x9e3779b97f4a7c15) {}
+
+    ArgumentIndex(ArgumentIndex &&other) noexcept : root(other.root), seed(other.seed) {
+        other.root = nullptr;
+    }
+
+    ArgumentIndex &operator=(const ArgumentIndex &other) = delete;
+
+    void swap(ArgumentIndex &other) noexcept {
+        std::swap(root, other.root);
+        std::swap(seed, other.seed);
+    }
+
+    // Links a point placed in function_points right after predecessor (nullptr if it is the first one).
+    void insert(node point, node predecessor) noexcept;
+
+    void erase(node point) noexcept;
+
+    // Recomputes the counters of the point and of its ancestors, after it changed whether it is a local maximum.
+    void refresh(node point) noexcept;
+
+    // Links all points, sorted by arguments, in O(n).
+    void build(const function_points_set &points);
+
+    // Number of points with smaller arguments.
+    size_type rank(node point) const noexcept;
+
+    // Point with k points before it (k < number of points).
+    node select(size_type k) const noexcept;
+
+    // The first local maximum not before point (nullptr if there is none, or point is nullptr).
+    static node first_maximum(node point) noexcept;
+
+    static node next_maximum(node point) noexcept;
+
+    // Point with the greatest value among the ones with ranks in [lo, hi), nullptr if there is none.
+    node best_in_ranks(size_type lo, size_type hi) const;
+
+    // Combined summaries of the points with ranks in [lo, hi).
+    aggregate_type summary_in_ranks(size_type lo, size_type hi) const;
+
+private:
+    static size_type points(node n) noexcept {
+        return n != nullptr ? n->points : 0;
+    }
+
+    static size_type maxima(node n) noexcept {
+        return n != nullptr ? n->maxima : 0;
+    }
+
+    static void update(node n) noexcept;
+
+    static node leftmost(node n) noexcept;
+
+    static node leftmost_maximum(node n) noexcept;
+
+    // Of two points, lk before rk, returns the one with the greater value (lk if they are equal).
+    static node better(node lk, node rk);
+
+    static node best(node n);
+
+    static node best_in_ranks(node n, size_type lo, size_type hi);
+
+    static aggregate_type summary(node n);
+
+    static aggregate_type summary_in_ranks(node n, size_type lo, size_type hi);
+
+    // Places n in place of its parent, keeping the order of arguments.
+    void rotate_up(node n) noexcept;
+
+    size_t next_priority() noexcept;
+
+    node root;
+    size_t seed; // State of the generator of priorities.
+};
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::insert(node point,
+                                                                                    node predecessor) noexcept {
+    point->left = point->right = nullptr;
+    point->priority = next_priority();
+
+    // The point becomes a leaf just after its predecessor.
+    node parent = nullptr;
+    if (root != nullptr) {
+        parent = (predecessor == nullptr ? leftmost(root)
+                                         : predecessor->right == nullptr ? predecessor : leftmost(predecessor->right));
+        (parent == predecessor ? parent->right : parent->left) = point;
+    } else {
+        root = point;
+    }
+    point->parent = parent;
+    refresh(point);
+
+    // Rotations keep the counters of the subtree they are done in.
+    while (point->parent != nullptr && point->parent->priority < point->priority)
+        rotate_up(point);
 }
 
-template<typename A, typename V>
-FunctionMaxima<A, V>::PointType::PointType(const A &arg, const V &val) {
-    point_argument = std::make_shared<A>(A(arg)); // Copy constructor of A might throw an exception.
-    auto point_construction_guard = PointConstructionGuard(&point_argument);
-    point_value = std::make_shared<V>(V(val)); // Copy constructor of V might throw an exception.
-    point_construction_guard.done(); // No exception thrown, successful creation of a new point.
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::erase(node point) noexcept {
+    // The point goes down until it is a leaf.
+    while (point->left != nullptr || point->right != nullptr) {
+        if (point->right == nullptr || (point->left != nullptr && point->right->priority < point->left->priority))
+            rotate_up(point->left);
+        else
+            rotate_up(point->right);
+    }
+
+    node parent = point->parent;
+    if (parent == nullptr)
+        root = nullptr;
+    else
+        (parent->left == point ? parent->left : parent->right) = nullptr;
+    refresh(parent);
 }
 
-template<typename A, typename V>
-A const &FunctionMaxima<A, V>::PointType::arg() const noexcept {
-    return *point_argument.get();
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::refresh(node point) noexcept {
+    for (; point != nullptr; point = point->parent)
+        update(point);
 }
 
-template<typename A, typename V>
-V const &FunctionMaxima<A, V>::PointType::value() const noexcept {
-    return *point_value.get();
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::build(const function_points_set &points) {
+    /* Right spine of the tree built so far, the usual construction of a treap from sorted points.
+     * Points leaving the spine have their subtrees complete, so their counters are computed then.
+     */
+    auto spine = std::vector<node>();
+    for (const auto &point : points) {
+        node last = nullptr;
+        point.priority = next_priority();
+        point.parent = point.right = nullptr;
+        while (!spine.empty() && spine.back()->priority < point.priority) {
+            last = spine.back();
+            update(last);
+            spine.pop_back();
+        }
+
+        point.left = last;
+        if (last != nullptr)
+            last->parent = &point;
+        if (!spine.empty()) {
+            spine.back()->right = &point;
+            point.parent = spine.back();
+        }
+        spine.push_back(&point);
+    }
+    root = (spine.empty() ? nullptr : spine.front());
+
+    for (auto it = spine.rbegin(); it != spine.rend(); ++it)
+        update(*it);
 }
 
-template<typename A, typename V>
-FunctionMaxima<A, V>::PointType::~PointType() noexcept {
-    // Counters decreased.
-    point_argument.reset();
-    point_value.reset();
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::size_type
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::rank(node point) const noexcept {
+    size_type result = points(point->left);
+    for (; point->parent != nullptr; point = point->parent) {
+        if (point->parent->right == point)
+            result += points(point->parent->left) + 1;
+    }
+    return result;
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::node
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::select(size_type k) const noexcept {
+    node n = root;
+    while (k != points(n->left)) {
+        if (k < points(n->left)) {
+            n = n->left;
+        } else {
+            k -= points(n->left) + 1;
+            n = n->right;
+        }
+    }
+    return n;
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::node
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::first_maximum(node point) noexcept {
+    return (point == nullptr || point->is_local_maximum ? point : next_maximum(point));
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::node
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::next_maximum(node point) noexcept {
+    // Subtrees without local maxima are skipped.
+    if (maxima(point->right) != 0)
+        return leftmost_maximum(point->right);
+
+    for (; point->parent != nullptr; point = point->parent) {
+        if (point->parent->left == point) {
+            if (point->parent->is_local_maximum)
+                return point->parent;
+            if (maxima(point->parent->right) != 0)
+                return leftmost_maximum(point->parent->right);
+        }
+    }
+    return nullptr;
 }
 
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::node
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::best_in_ranks(size_type lo, size_type hi) const {
+    return (lo < hi ? best_in_ranks(root, lo, hi) : nullptr);
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::update(node n) noexcept {
+    n->points = points(n->left) + 1 + points(n->right);
+    n->maxima = maxima(n->left) + (n->is_local_maximum ? 1 : 0) + maxima(n->right);
+    n->dirty.store(true, std::memory_order_relaxed);
+    if constexpr (aggregated)
+        n->summary_dirty = true;
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::node
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::leftmost(node n) noexcept {
+    while (n->left != nullptr)
+        n = n->left;
+    return n;
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::node
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::leftmost_maximum(node n) noexcept {
+    // The subtree of n has at least one local maximum.
+    while (true) {
+        if (maxima(n->left) != 0)
+            n = n->left;
+        else if (n->is_local_maximum)
+            return n;
+        else
+            n = n->right;
+    }
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::node
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::better(node lk, node rk) {
+    if (lk == nullptr || rk == nullptr)
+        return (lk != nullptr ? lk : rk);
+    return (lk->value() < rk->value() ? rk : lk);
+}
+
+/* If a comparison throws, the point stays dirty, the ones computed so far are kept.
+ * Updates are not run together with queries, so queries racing for a dirty point store the same best.
+ */
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::node
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::best(node n) {
+    if (n == nullptr)
+        return nullptr;
+    if (n->dirty.load(std::memory_order_acquire)) {
+        node result = better(better(best(n->left), n), best(n->right));
+        n->best.store(result, std::memory_order_relaxed);
+        n->dirty.store(false, std::memory_order_release);
+        return result;
+    }
+    return n->best.load(std::memory_order_relaxed);
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::node
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::best_in_ranks(node n, size_type lo, size_type hi) {
+    // Ranks are counted within the subtree of n, lo < hi <= points(n).
+    if (lo == 0 && hi == n->points)
+        return best(n);
+
+    size_type middle = points(n->left);
+    node result = nullptr;
+    if (lo < middle)
+        result = best_in_ranks(n->left, lo, std::min(hi, middle));
+    if (lo <= middle && middle < hi)
+        result = better(result, n);
+    if (middle + 1 < hi)
+        result = better(result, best_in_ranks(n->right, std::max(lo, middle + 1) - middle - 1, hi - middle - 1));
+    return result;
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::aggregate_type
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::summary_in_ranks(size_type lo, size_type hi) const {
+    return (lo < hi ? summary_in_ranks(root, lo, hi) : aggregate_policy::identity());
+}
+
+// If anything throws, the point stays dirty, the ones computed so far are kept.
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::aggregate_type
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::summary(node n) {
+    if (n == nullptr)
+        return aggregate_policy::identity();
+    if (n->summary_dirty) {
+        n->summary = aggregate_policy::combine(aggregate_policy::combine(summary(n->left),
+                                                                         aggregate_policy::of(n->arg(), n->value())),
+                                               summary(n->right));
+        n->summary_dirty = false;
+    }
+    return n->summary;
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+typename FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::aggregate_type
+FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::summary_in_ranks(node n, size_type lo, size_type hi) {
+    // The same split as in best_in_ranks, summaries are combined in the order of arguments.
+    if (lo == 0 && hi == n->points)
+        return summary(n);
+
+    size_type middle = points(n->left);
+    auto result = aggregate_policy::identity();
+    if (lo < middle)
+        result = summary_in_ranks(n->left, lo, std::min(hi, middle));
+    if (lo <= middle && middle < hi)
+        result = aggregate_policy::combine(result, aggregate_policy::of(n->arg(), n->value()));
+    if (middle + 1 < hi) {
+        result = aggregate_policy::combine(result, summary_in_ranks(n->right, std::max(lo, middle + 1) - middle - 1,
+                                                                    hi - middle - 1));
+    }
+    return result;
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::rotate_up(node n) noexcept {
+    node parent = n->parent, grandparent = parent->parent;
+    if (parent->left == n) {
+        parent->left = n->right;
+        if (n->right != nullptr)
+            n->right->parent = parent;
+        n->right = parent;
+    } else {
+        parent->right = n->left;
+        if (n->left != nullptr)
+            n->left->parent = parent;
+        n->left = parent;
+    }
+
+    parent->parent = n;
+    n->parent = grandparent;
+    if (grandparent == nullptr)
+        root = n;
+    else
+        (grandparent->left == parent ? grandparent->left : grandparent->right) = n;
+
+    update(parent);
+    update(n);
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+size_t FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentIndex::next_priority() noexcept {
+    // xorshift64*
+    seed ^= seed >> 12;
+    seed ^= seed << 25;
+    seed ^= seed >> 27;
+    return static_cast<size_t>(seed * 0x2545f4914f6cdd1d);
+}
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+class FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::NoArgumentIndex {
+public:
+    using node = const FunctionPoint *;
+
+    void swap(NoArgumentIndex &) noexcept {}
+
+    void insert(node, node) noexcept {}
+
+    void erase(node) noexcept {}
+
+    void refresh(node) noexcept {}
+
+    void build(const function_points_set &) noexcept {}
+};
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+class FunctionMaxima<A, V, RefCount, Alloc, Index, Minima>::ArgumentMaximaIterator {
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = point_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const point_type *;
+    using reference = const point_type &;
+
+    ArgumentMaximaIterator() noexcept : point(nullptr) {}
+
+    reference operator*() const noexcept {
+        return *point;
+    }
+
+    pointer operator->() const noexcept {
+        return point;
+    }
+
+    ArgumentMaximaIterator &operator++() noexcept {
+        point = ArgumentIndex::next_maximum(point);
+        return *this;
+    }
+
+    ArgumentMaximaIterator operator++(int) noexcept {
+        auto result = *this;
+        ++*this;
+        return result;
+    }
+
+    bool operator==(const ArgumentMaximaIterator &other) const noexcept {
+        return point == other.point;
+    }
+
+    bool operator!=(const ArgumentMaximaIterator &other) const noexcept {
+        return point != other.point;
+    }
+
+private:
+    friend class FunctionMaxima;
+
+    explicit ArgumentMaximaIterator(const FunctionPoint *point) noexcept : point(point) {}
+
+    const FunctionPoint *point; // nullptr after the last local maximum.
+};
+
+template<typename A, typename V, typename RefCount, typename Alloc, typename Index, typename Minima>
+void swap(FunctionMaxima<A, V, RefCount, Alloc, Index, Minima> &lhs,
+          FunctionMaxima<A, V, RefCount, Alloc, Index, Minima> &rhs) noexcept {
+    lhs.swap(rhs);
+}
 
 #endif // FUNCTION_MAXIMA_H
@@ -0,0 +1,215 @@
+#ifndef FUNCTION_MAXIMA_SIMD_H
+#define FUNCTION_MAXIMA_SIMD_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if !defined(FUNCTION_MAXIMA_NO_SIMD) && (defined(__AVX2__) || defined(__SSE2__))
+#define FUNCTION_MAXIMA_SIMD
+#include <immintrin.h>
+#endif
+
+// Lanes of one SIMD register of values of V, specialised only for the types compared by single instructions.
+template<typename V, typename = void>
+struct LocalExtremaLanes {
+    static constexpr bool available = false;
+};
+
+#ifdef FUNCTION_MAXIMA_SIMD
+
+template<typename V>
+using simd_signed_integral = std::bool_constant<std::is_integral<V>::value && std::is_signed<V>::value &&
+                                               !std::is_same<V, bool>::value>;
+
+#ifdef __AVX2__
+
+template<>
+struct LocalExtremaLanes<double> {
+    static constexpr bool available = true;
+    static constexpr size_t width = 4;
+
+    // Bit k is set only if lk[k] < rk[k].
+    static unsigned less(const double *lk, const double *rk) noexcept {
+        return static_cast<unsigned>(
+                _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(lk), _mm256_loadu_pd(rk), _CMP_LT_OQ)));
+    }
+};
+
+template<>
+struct LocalExtremaLanes<float> {
+    static constexpr bool available = true;
+    static constexpr size_t width = 8;
+
+    static unsigned less(const float *lk, const float *rk) noexcept {
+        return static_cast<unsigned>(
+                _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(lk), _mm256_loadu_ps(rk), _CMP_LT_OQ)));
+    }
+};
+
+template<typename V>
+struct LocalExtremaLanes<V, std::enable_if_t<simd_signed_integral<V>::value && sizeof(V) == 4>> {
+    static constexpr bool available = true;
+    static constexpr size_t width = 8;
+
+    static unsigned less(const V *lk, const V *rk) noexcept {
+        auto l = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(lk));
+        auto r = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rk));
+        return static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(r, l))));
+    }
+};
+
+template<typename V>
+struct LocalExtremaLanes<V, std::enable_if_t<simd_signed_integral<V>::value && sizeof(V) == 8>> {
+    static constexpr bool available = true;
+    static constexpr size_t width = 4;
+
+    static unsigned less(const V *lk, const V *rk) noexcept {
+        auto l = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(lk));
+        auto r = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rk));
+        return static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(r, l))));
+    }
+};
+
+#else // SSE2
+
+template<>
+struct LocalExtremaLanes<double> {
+    static constexpr bool available = true;
+    static constexpr size_t width = 2;
+
+    static unsigned less(const double *lk, const double *rk) noexcept {
+        return static_cast<unsigned>(_mm_movemask_pd(_mm_cmplt_pd(_mm_loadu_pd(lk), _mm_loadu_pd(rk))));
+    }
+};
+
+template<>
+struct LocalExtremaLanes<float> {
+    static constexpr bool available = true;
+    static constexpr size_t width = 4;
+
+    static unsigned less(const float *lk, const float *rk) noexcept {
+        return static_cast<unsigned>(_mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(lk), _mm_loadu_ps(rk))));
+    }
+};
+
+template<typename V>
+struct LocalExtremaLanes<V, std::enable_if_t<simd_signed_integral<V>::value && sizeof(V) == 4>> {
+    static constexpr bool available = true;
+    static constexpr size_t width = 4;
+
+    static unsigned less(const V *lk, const V *rk) noexcept {
+        auto l = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lk));
+        auto r = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rk));
+        return static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(l, r))));
+    }
+};
+
+#ifdef __SSE4_2__
+
+template<typename V>
+struct LocalExtremaLanes<V, std::enable_if_t<simd_signed_integral<V>::value && sizeof(V) == 8>> {
+    static constexpr bool available = true;
+    static constexpr size_t width = 2;
+
+    static unsigned less(const V *lk, const V *rk) noexcept {
+        auto l = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lk));
+        auto r = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rk));
+        return static_cast<unsigned>(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(r, l))));
+    }
+};
+
+#endif // __SSE4_2__
+
+#endif // __AVX2__
+
+#endif // FUNCTION_MAXIMA_SIMD
+
+// Byte k of local_extrema_spread[bits] is bit k of bits, so a mask of lanes is stored as flags by one copy.
+constexpr std::array<uint64_t, 256> make_local_extrema_spread() noexcept {
+    auto result = std::array<uint64_t, 256>();
+    for (size_t bits = 0; bits < 256; ++bits) {
+        for (size_t k = 0; k < 8; ++k)
+            result[bits] |= static_cast<uint64_t>((bits >> k) & 1) << (8 * k);
+    }
+    return result;
+}
+
+inline constexpr std::array<uint64_t, 256> local_extrema_spread = make_local_extrema_spread();
+
+/* Detection of local maxima and minima of arithmetic values, a whole array at once.
+ * The value values[i] is a local maximum if neither of its neighbours left[i] and right[i] is greater (by <, as in
+ * FunctionMaxima), and a local minimum if neither of them is less. Flags are set to 1 for them and to 0 otherwise.
+ * float, double and signed integers of 4 and 8 bytes are compared with AVX2 or SSE2 instructions, if they are
+ * enabled when compiling (and FUNCTION_MAXIMA_NO_SIMD is not defined), other types by the scalar version.
+ */
+template<typename V>
+class LocalExtremaKernel {
+    static_assert(std::is_arithmetic<V>::value, "LocalExtremaKernel requires arithmetic values.");
+
+public:
+    static constexpr bool vectorized = LocalExtremaLanes<V>::available;
+
+    static void maxima(const V *left, const V *values, const V *right, size_t n, unsigned char *flags) noexcept {
+        detect<false, vectorized>(left, values, right, n, flags);
+    }
+
+    static void minima(const V *left, const V *values, const V *right, size_t n, unsigned char *flags) noexcept {
+        detect<true, vectorized>(left, values, right, n, flags);
+    }
+
+    // Neighbours of values[i] are values[i - 1] and values[i + 1], the first and the last value have only one.
+    static void maxima(const V *values, size_t n, unsigned char *flags) noexcept {
+        detect_sequence<false, vectorized>(values, n, flags);
+    }
+
+    static void minima(const V *values, size_t n, unsigned char *flags) noexcept {
+        detect_sequence<true, vectorized>(values, n, flags);
+    }
+
+    // The same as maxima(values, n, flags), never vectorized (for comparisons).
+    static void scalar_maxima(const V *values, size_t n, unsigned char *flags) noexcept {
+        detect_sequence<false, false>(values, n, flags);
+    }
+
+private:
+    template<bool Minima, bool Vectorized>
+    static void detect(const V *left, const V *values, const V *right, size_t n, unsigned char *flags) noexcept {
+        size_t i = 0;
+        if constexpr (Vectorized) {
+            using lanes = LocalExtremaLanes<V>;
+            constexpr unsigned all = (1u << lanes::width) - 1;
+            for (; i + lanes::width <= n; i += lanes::width) {
+                // Lanes with a neighbour greater (less for minima) than the value.
+                unsigned beaten = (Minima ? lanes::less(left + i, values + i) | lanes::less(right + i, values + i)
+                                          : lanes::less(values + i, left + i) | lanes::less(values + i, right + i));
+                uint64_t bytes = local_extrema_spread[~beaten & all];
+                std::memcpy(flags + i, &bytes, lanes::width); // Lower bytes first, SIMD is used only on x86.
+            }
+        }
+
+        for (; i < n; ++i) {
+            flags[i] = (Minima ? !(left[i] < values[i]) && !(right[i] < values[i])
+                               : !(values[i] < left[i]) && !(values[i] < right[i]));
+        }
+    }
+
+    template<bool Minima, bool Vectorized>
+    static void detect_sequence(const V *values, size_t n, unsigned char *flags) noexcept {
+        if (n == 0)
+            return;
+        if (n == 1) {
+            flags[0] = 1;
+            return;
+        }
+
+        // The missing neighbour of both ends is the value itself, which never beats it.
+        detect<Minima, false>(values, values, values + 1, 1, flags);
+        detect<Minima, Vectorized>(values, values + 1, values + 2, n - 2, flags + 1);
+        detect<Minima, false>(values + n - 2, values + n - 1, values + n - 1, 1, flags + n - 1);
+    }
+};
+
+#endif // FUNCTION_MAXIMA_SIMD_H
@@ -0,0 +1,468 @@
+#ifndef PERSISTENT_FUNCTION_MAXIMA_H
+#define PERSISTENT_FUNCTION_MAXIMA_H
+
+#include "function_maxima.h"
+
+#include <memory>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <utility>
+
+/* Alternative to FunctionMaxima for keeping many versions of the same function.
+ * Both the points and local maxima are kept in persistent AVL trees whose nodes are shared between copies,
+ * so copying takes O(1) and set_value / erase copy only O(log n) nodes on their paths (A and V are never
+ * copied, they are shared by points). Versions are independent: changing one never changes another.
+ * Iterators of a version stay valid as long as any copy of that version is alive, set_value and erase
+ * invalidate the iterators of the instance they are called on (unless a copy keeps its version alive).
+ * Nodes are counted atomically, so versions might be read from many threads at once.
+ * Public interface is the same as the one of FunctionMaxima, with strong exception guarantee of updates.
+ */
+template<typename A, typename V>
+class PersistentFunctionMaxima {
+private:
+    class Node; // Immutable node of both trees, shared between versions.
+
+    using node_ptr = std::shared_ptr<const Node>;
+
+    class ArgumentLess; // Order of points by arguments, also comparing points with arguments.
+
+    class MaximaLess; // Order of local maxima, the same as the one of FunctionMaxima::mx_begin() - mx_end().
+
+    class TreeIterator; // In order iterator over a tree, keeps the path from the root.
+
+public:
+    class PointType;
+
+    using point_type = PointType;
+
+    PersistentFunctionMaxima() = default;
+
+    // Shares all the nodes with other, takes O(1).
+    PersistentFunctionMaxima(const PersistentFunctionMaxima<A, V> &other) = default;
+
+    PersistentFunctionMaxima(PersistentFunctionMaxima<A, V> &&other) noexcept = default;
+
+    PersistentFunctionMaxima &operator=(PersistentFunctionMaxima<A, V> other) noexcept;
+
+    V const &value_at(A const &a) const;
+
+    // Strong exception guarantee, O(log n) nodes are copied.
+    void set_value(A const &a, V const &v);
+
+    // Strong exception guarantee, O(log n) nodes are copied.
+    void erase(A const &a);
+
+    using iterator = TreeIterator;
+
+    iterator begin() const;
+
+    iterator end() const noexcept;
+
+    iterator find(A const &a) const;
+
+    using mx_iterator = TreeIterator;
+
+    mx_iterator mx_begin() const;
+
+    mx_iterator mx_end() const noexcept;
+
+    using size_type = size_t;
+
+    size_type size() const noexcept;
+
+    ~PersistentFunctionMaxima() noexcept = default;
+
+private:
+    // Point with the greatest argument less than a (before is true) or the smallest one greater than a.
+    const PointType *neighbour(const A &a, bool before) const;
+
+    // Returns true only if a point with value v between left and right (null if missing) is a local maximum.
+    static bool is_local_maximum(const V &v, const PointType *left, const PointType *right);
+
+    static node_ptr make_node(const PointType &point, node_ptr left, node_ptr right);
+
+    static int height(const node_ptr &node) noexcept;
+
+    // Joins left, point and right (their heights differ by at most 2) into a balanced tree.
+    static node_ptr balance(const PointType &point, node_ptr left, node_ptr right);
+
+    // Returns the tree with point inserted (or replacing the one equal to key), only the path is copied.
+    template<typename Key, typename Less>
+    static node_ptr insert(const node_ptr &node, const PointType &point, const Key &key, Less less);
+
+    // Returns the tree without the point equal to key, only the path is copied.
+    template<typename Key, typename Less>
+    static node_ptr erase(const node_ptr &node, const Key &key, Less less);
+
+    static node_ptr erase_min(const node_ptr &node);
+
+    // Used for storing all the points ordered by arguments.
+    node_ptr function_points;
+
+    // Used for storing local maxima.
+    node_ptr local_maxima;
+
+    size_type points_count = 0;
+};
+
+template<typename A, typename V>
+class PersistentFunctionMaxima<A, V>::PointType {
+public:
+    A const &arg() const noexcept {
+        return point_data->argument;
+    }
+
+    V const &value() const noexcept {
+        return point_data->value;
+    }
+
+private:
+    friend class PersistentFunctionMaxima;
+
+    struct PointData {
+        PointData(const A &arg, const V &val) : argument(arg), value(val) {}
+
+        const A argument;
+        const V value;
+    };
+
+    // Creating new points is disabled for interface users.
+    PointType(const A &arg, const V &val) : point_data(std::make_shared<const PointData>(arg, val)) {}
+
+    // Shared by all the nodes (of all the versions) holding the point.
+    std::shared_ptr<const PointData> point_data;
+};
+
+template<typename A, typename V>
+class PersistentFunctionMaxima<A, V>::Node {
+public:
+    Node(const PointType &point, node_ptr left, node_ptr right, int height) noexcept
+            : point(point), left(std::move(left)), right(std::move(right)), height(height) {}
+
+    const PointType point;
+    const node_ptr left, right;
+    const int height;
+};
+
+template<typename A, typename V>
+class PersistentFunctionMaxima<A, V>::ArgumentLess {
+public:
+    bool operator()(const PointType &lk, const A &fk) const {
+        return lk.arg() < fk;
+    }
+
+    bool operator()(const A &fk, const PointType &lk) const {
+        return fk < lk.arg();
+    }
+};
+
+template<typename A, typename V>
+class PersistentFunctionMaxima<A, V>::MaximaLess {
+public:
+    bool operator()(const PointType &fk, const PointType &lk) const {
+        if (lk.value() < fk.value() || fk.value() < lk.value())
+            return lk.value() < fk.value();
+        return fk.arg() < lk.arg();
+    }
+};
+
+template<typename A, typename V>
+class PersistentFunctionMaxima<A, V>::TreeIterator {
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = point_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const point_type *;
+    using reference = const point_type &;
+
+    TreeIterator() noexcept = default;
+
+    reference operator*() const noexcept {
+        return path.back()->point;
+    }
+
+    pointer operator->() const noexcept {
+        return &path.back()->point;
+    }
+
+    TreeIterator &operator++() {
+        const Node *node = path.back();
+        path.pop_back();
+        push_left(node->right.get());
+        return *this;
+    }
+
+    TreeIterator operator++(int) {
+        auto copy = *this;
+        ++*this;
+        return copy;
+    }
+
+    friend bool operator==(const TreeIterator &lk, const TreeIterator &rk) noexcept {
+        if (lk.path.empty() || rk.path.empty())
+            return lk.path.empty() && rk.path.empty();
+        return lk.path.back() == rk.path.back();
+    }
+
+    friend bool operator!=(const TreeIterator &lk, const TreeIterator &rk) noexcept {
+        return !(lk == rk);
+    }
+
+private:
+    friend class PersistentFunctionMaxima;
+
+    // Descends to the leftmost node of the subtree.
+    void push_left(const Node *node) {
+        for (; node != nullptr; node = node->left.get())
+            path.push_back(node);
+    }
+
+    /* The current node is at the back, before it there are only its ancestors whose left subtree it is in
+     * (the ones visited next), so a step takes O(1) amortised.
+     */
+    std::vector<const Node *> path;
+};
+
+template<typename A, typename V>
+PersistentFunctionMaxima<A, V> &PersistentFunctionMaxima<A, V>::operator=(PersistentFunctionMaxima<A, V> other)
+noexcept {
+    function_points.swap(other.function_points); // Swapping shared pointers is noexcept.
+    local_maxima.swap(other.local_maxima);
+    std::swap(points_count, other.points_count);
+
+    return *this;
+}
+
+template<typename A, typename V>
+V const &PersistentFunctionMaxima<A, V>::value_at(const A &a) const {
+    // If a does not belong to the domain - InvalidArg is thrown.
+    auto it = find(a);
+    if (it != end())
+        return (*it).value();
+    throw InvalidArg();
+}
+
+template<typename A, typename V>
+void PersistentFunctionMaxima<A, V>::set_value(const A &a, const V &v) {
+    auto it = find(a);
+    const PointType *old_point = (it == end() ? nullptr : &*it);
+    if (old_point != nullptr && !(v < old_point->value()) && !(old_point->value() < v))
+        return; // Nothing changes if we set the same value for a.
+
+    const PointType *left = neighbour(a, true), *right = neighbour(a, false);
+    const PointType *left_left = (left == nullptr ? nullptr : neighbour(left->arg(), true));
+    const PointType *right_right = (right == nullptr ? nullptr : neighbour(right->arg(), false));
+
+    auto new_point = PointType(a, v);
+
+    // Whether the point and its neighbours are local maxima before and after the update.
+    bool was_maximum = old_point != nullptr && is_local_maximum(old_point->value(), left, right);
+    bool left_was_maximum = left != nullptr &&
+                            is_local_maximum(left->value(), left_left, old_point != nullptr ? old_point : right);
+    bool right_was_maximum = right != nullptr &&
+                             is_local_maximum(right->value(), old_point != nullptr ? old_point : left, right_right);
+    bool is_maximum = is_local_maximum(v, left, right);
+    bool left_is_maximum = left != nullptr && is_local_maximum(left->value(), left_left, &new_point);
+    bool right_is_maximum = right != nullptr && is_local_maximum(right->value(), &new_point, right_right);
+
+    // New trees are built aside, this instance is changed only when nothing can throw anymore.
+    auto points = insert(function_points, new_point, a, ArgumentLess());
+    auto maxima = local_maxima;
+    if (was_maximum)
+        maxima = erase(maxima, *old_point, MaximaLess());
+    if (left_was_maximum && !left_is_maximum)
+        maxima = erase(maxima, *left, MaximaLess());
+    if (right_was_maximum && !right_is_maximum)
+        maxima = erase(maxima, *right, MaximaLess());
+    if (is_maximum)
+        maxima = insert(maxima, new_point, new_point, MaximaLess());
+    if (left_is_maximum && !left_was_maximum)
+        maxima = insert(maxima, *left, *left, MaximaLess());
+    if (right_is_maximum && !right_was_maximum)
+        maxima = insert(maxima, *right, *right, MaximaLess());
+
+    // Nodes of the old version (which old_point and the neighbours point into) are released only here.
+    function_points.swap(points);
+    local_maxima.swap(maxima);
+    if (old_point == nullptr)
+        ++points_count;
+}
+
+template<typename A, typename V>
+void PersistentFunctionMaxima<A, V>::erase(const A &a) {
+    auto it = find(a);
+    if (it == end())
+        return;
+    const PointType &old_point = *it;
+
+    const PointType *left = neighbour(a, true), *right = neighbour(a, false);
+    const PointType *left_left = (left == nullptr ? nullptr : neighbour(left->arg(), true));
+    const PointType *right_right = (right == nullptr ? nullptr : neighbour(right->arg(), false));
+
+    bool was_maximum = is_local_maximum(old_point.value(), left, right);
+    bool left_was_maximum = left != nullptr && is_local_maximum(left->value(), left_left, &old_point);
+    bool right_was_maximum = right != nullptr && is_local_maximum(right->value(), &old_point, right_right);
+    bool left_is_maximum = left != nullptr && is_local_maximum(left->value(), left_left, right);
+    bool right_is_maximum = right != nullptr && is_local_maximum(right->value(), left, right_right);
+
+    auto points = erase(function_points, a, ArgumentLess());
+    auto maxima = local_maxima;
+    if (was_maximum)
+        maxima = erase(maxima, old_point, MaximaLess());
+    if (left_was_maximum && !left_is_maximum)
+        maxima = erase(maxima, *left, MaximaLess());
+    if (right_was_maximum && !right_is_maximum)
+        maxima = erase(maxima, *right, MaximaLess());
+    if (left_is_maximum && !left_was_maximum)
+        maxima = insert(maxima, *left, *left, MaximaLess());
+    if (right_is_maximum && !right_was_maximum)
+        maxima = insert(maxima, *right, *right, MaximaLess());
+
+    function_points.swap(points);
+    local_maxima.swap(maxima);
+    --points_count;
+}
+
+template<typename A, typename V>
+typename PersistentFunctionMaxima<A, V>::iterator PersistentFunctionMaxima<A, V>::begin() const {
+    auto it = iterator();
+    it.push_left(function_points.get());
+    return it;
+}
+
+template<typename A, typename V>
+typename PersistentFunctionMaxima<A, V>::iterator PersistentFunctionMaxima<A, V>::end() const noexcept {
+    return iterator();
+}
+
+template<typename A, typename V>
+typename PersistentFunctionMaxima<A, V>::iterator PersistentFunctionMaxima<A, V>::find(const A &a) const {
+    auto it = iterator();
+    for (const Node *node = function_points.get(); node != nullptr;) {
+        if (a < node->point.arg()) {
+            it.path.push_back(node); // Visited after its left subtree.
+            node = node->left.get();
+        } else if (node->point.arg() < a) {
+            node = node->right.get();
+        } else {
+            it.path.push_back(node);
+            return it;
+        }
+    }
+    return end();
+}
+
+template<typename A, typename V>
+typename PersistentFunctionMaxima<A, V>::mx_iterator PersistentFunctionMaxima<A, V>::mx_begin() const {
+    auto it = mx_iterator();
+    it.push_left(local_maxima.get());
+    return it;
+}
+
+template<typename A, typename V>
+typename PersistentFunctionMaxima<A, V>::mx_iterator PersistentFunctionMaxima<A, V>::mx_end() const noexcept {
+    return mx_iterator();
+}
+
+template<typename A, typename V>
+typename PersistentFunctionMaxima<A, V>::size_type PersistentFunctionMaxima<A, V>::size() const noexcept {
+    return points_count;
+}
+
+template<typename A, typename V>
+const typename PersistentFunctionMaxima<A, V>::PointType *
+PersistentFunctionMaxima<A, V>::neighbour(const A &a, bool before) const {
+    const PointType *result = nullptr;
+    for (const Node *node = function_points.get(); node != nullptr;) {
+        if (before ? node->point.arg() < a : a < node->point.arg()) {
+            result = &node->point;
+            node = (before ? node->right : node->left).get();
+        } else {
+            node = (before ? node->left : node->right).get();
+        }
+    }
+    return result;
+}
+
+template<typename A, typename V>
+bool PersistentFunctionMaxima<A, V>::is_local_maximum(const V &v, const PointType *left, const PointType *right) {
+    return (left == nullptr || !(v < left->value())) && (right == nullptr || !(v < right->value()));
+}
+
+template<typename A, typename V>
+typename PersistentFunctionMaxima<A, V>::node_ptr
+PersistentFunctionMaxima<A, V>::make_node(const PointType &point, node_ptr left, node_ptr right) {
+    int node_height = 1 + std::max(height(left), height(right));
+    return std::make_shared<const Node>(point, std::move(left), std::move(right), node_height);
+}
+
+template<typename A, typename V>
+int PersistentFunctionMaxima<A, V>::height(const node_ptr &node) noexcept {
+    return node == nullptr ? 0 : node->height;
+}
+
+template<typename A, typename V>
+typename PersistentFunctionMaxima<A, V>::node_ptr
+PersistentFunctionMaxima<A, V>::balance(const PointType &point, node_ptr left, node_ptr right) {
+    if (height(left) > height(right) + 1) {
+        // Single rotation if the left subtree leans left, otherwise a double one.
+        if (height(left->left) >= height(left->right))
+            return make_node(left->point, left->left, make_node(point, left->right, std::move(right)));
+        return make_node(left->right->point, make_node(left->point, left->left, left->right->left),
+                         make_node(point, left->right->right, std::move(right)));
+    }
+
+    if (height(right) > height(left) + 1) {
+        if (height(right->right) >= height(right->left))
+            return make_node(right->point, make_node(point, std::move(left), right->left), right->right);
+        return make_node(right->left->point, make_node(point, std::move(left), right->left->left),
+                         make_node(right->point, right->left->right, right->right));
+    }
+
+    return make_node(point, std::move(left), std::move(right));
+}
+
+template<typename A, typename V>
+template<typename Key, typename Less>
+typename PersistentFunctionMaxima<A, V>::node_ptr
+PersistentFunctionMaxima<A, V>::insert(const node_ptr &node, const PointType &point, const Key &key, Less less) {
+    if (node == nullptr)
+        return make_node(point, nullptr, nullptr);
+    if (less(key, node->point))
+        return balance(node->point, insert(node->left, point, key, less), node->right);
+    if (less(node->point, key))
+        return balance(node->point, node->left, insert(node->right, point, key, less));
+    return make_node(point, node->left, node->right);
+}
+
+template<typename A, typename V>
+template<typename Key, typename Less>
+typename PersistentFunctionMaxima<A, V>::node_ptr
+PersistentFunctionMaxima<A, V>::erase(const node_ptr &node, const Key &key, Less less) {
+    if (node == nullptr)
+        return node;
+    if (less(key, node->point))
+        return balance(node->point, erase(node->left, key, less), node->right);
+    if (less(node->point, key))
+        return balance(node->point, node->left, erase(node->right, key, less));
+    if (node->left == nullptr)
+        return node->right;
+    if (node->right == nullptr)
+        return node->left;
+
+    // The node is replaced by the first point of its right subtree.
+    const Node *next = node->right.get();
+    while (next->left != nullptr)
+        next = next->left.get();
+    return balance(next->point, node->left, erase_min(node->right));
+}
+
+template<typename A, typename V>
+typename PersistentFunctionMaxima<A, V>::node_ptr PersistentFunctionMaxima<A, V>::erase_min(const node_ptr &node) {
+    if (node->left == nullptr)
+        return node->right;
+    return balance(node->point, erase_min(node->left), node->right);
+}
+
+#endif // PERSISTENT_FUNCTION_MAXIMA_H
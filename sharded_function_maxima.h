@@ -0,0 +1,356 @@
+#ifndef SHARDED_FUNCTION_MAXIMA_H
+#define SHARDED_FUNCTION_MAXIMA_H
+
+#include "function_maxima.h"
+
+#include <mutex>
+#include <shared_mutex>
+#include <optional>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+/* Function shared between threads, partitioned by arguments into shards, each an independent FunctionMaxima
+ * behind its own lock. Bounds b_0 < b_1 < ... < b_{k-1} split the arguments into k + 1 shards:
+ * (-inf, b_0), [b_0, b_1), ..., [b_{k-1}, +inf). Updates lock only the shard of their argument,
+ * so writers of different shards run in parallel, readers of a shard share its lock.
+ * Shards keep local maxima with regard to their own points only. The first and the last point of a shard
+ * have their neighbours in other shards, so they are checked against them when local maxima are read
+ * (a neighbour from another shard might only take away the status of a local maximum, never give it).
+ * Updates keep the strong exception guarantee.
+ */
+template<typename A, typename V, typename Alloc = std::allocator<std::pair<A, V>>,
+        typename Index = NoRangeIndex, typename Minima = NoLocalMinima>
+class ShardedFunctionMaxima {
+public:
+    using function_type = FunctionMaxima<A, V, AtomicRefCount, Alloc, Index, Minima>;
+
+    using point_type = typename function_type::point_type;
+
+    using size_type = typename function_type::size_type;
+
+    class MaximaIterator; // Iterator merging local maxima of all the shards, in the order of mx_begin() - mx_end().
+
+    // Bounds have to be strictly increasing, otherwise InvalidArg is thrown.
+    explicit ShardedFunctionMaxima(std::vector<A> bounds, const Alloc &alloc = Alloc());
+
+    ShardedFunctionMaxima(const ShardedFunctionMaxima &other) = delete;
+
+    ShardedFunctionMaxima &operator=(const ShardedFunctionMaxima &other) = delete;
+
+    size_type shard_count() const noexcept;
+
+    // Index of the shard holding argument a.
+    size_type shard_of(A const &a) const;
+
+    V value_at(A const &a) const;
+
+    // The point with argument a, if there is one.
+    std::optional<point_type> find(A const &a) const;
+
+    // Sum of sizes of the shards, each one read under its own lock.
+    size_type size() const;
+
+    // Local maxima in the order of mx_begin() - mx_end() of the whole function at one moment.
+    std::vector<point_type> maxima() const;
+
+    // The first local maximum of one moment, InvalidArg is thrown if there are no points.
+    point_type maximum() const;
+
+    void set_value(A const &a, V const &v);
+
+    void erase(A const &a);
+
+    /* Calls f(const ShardedFunctionMaxima &) with all the shards locked (shared) and returns its result.
+     * Iterators must not leave f.
+     */
+    template<typename F>
+    decltype(auto) read(F &&f) const;
+
+    // Calls f(function_type &) with shard i locked exclusively, f must not add points from outside of the shard.
+    template<typename F>
+    decltype(auto) write(size_type i, F &&f);
+
+    using mx_iterator = MaximaIterator;
+
+    /* Merged local maxima of the whole function, each step takes O(number of shards).
+     * They are not synchronised, so they might be used only inside read() (or with no writers running).
+     */
+    mx_iterator mx_begin() const;
+
+    mx_iterator mx_end() const noexcept;
+
+private:
+    using shared_lock = std::shared_lock<std::shared_mutex>;
+
+    using unique_lock = std::unique_lock<std::shared_mutex>;
+
+    struct Shard {
+        explicit Shard(const Alloc &alloc) : function(alloc) {}
+
+        mutable std::shared_mutex mutex;
+        function_type function;
+    };
+
+    // Shared locks of all the shards, always taken in the order of shards (writers take only one lock).
+    std::vector<shared_lock> lock_all() const;
+
+    // Whether a local maximum of shard i is also a local maximum of the whole function.
+    bool is_local_maximum(size_type i, const point_type &point) const;
+
+    std::vector<A> bounds;
+
+    std::vector<std::unique_ptr<Shard>> shards; // Pointers, because mutexes are not movable.
+};
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+class ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::MaximaIterator {
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = point_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const point_type *;
+    using reference = const point_type &;
+
+    MaximaIterator() noexcept : owner(nullptr), current(0) {}
+
+    reference operator*() const noexcept {
+        return *heads[current].first;
+    }
+
+    pointer operator->() const noexcept {
+        return &*heads[current].first;
+    }
+
+    MaximaIterator &operator++() {
+        ++heads[current].first;
+        skip(current);
+        select();
+        return *this;
+    }
+
+    MaximaIterator operator++(int) {
+        auto result = *this;
+        ++*this;
+        return result;
+    }
+
+    /* All end iterators are equal. Iterators of different shards are never compared,
+     * they come from different sets, so the shards are compared first.
+     */
+    bool operator==(const MaximaIterator &other) const noexcept {
+        if (at_end() || other.at_end())
+            return at_end() && other.at_end();
+        return current == other.current && heads[current].first == other.heads[other.current].first;
+    }
+
+    bool operator!=(const MaximaIterator &other) const noexcept {
+        return !(*this == other);
+    }
+
+private:
+    friend class ShardedFunctionMaxima;
+
+    using shard_mx_iterator = typename function_type::mx_iterator;
+
+    explicit MaximaIterator(const ShardedFunctionMaxima *owner) : owner(owner), current(0) {
+        heads.reserve(owner->shards.size());
+        for (size_type i = 0; i < owner->shards.size(); ++i) {
+            const auto &function = owner->shards[i]->function;
+            heads.emplace_back(function.mx_begin(), function.mx_end());
+            skip(i);
+        }
+        select();
+    }
+
+    bool at_end() const noexcept {
+        return current == heads.size();
+    }
+
+    // Skips local maxima of shard i which are not local maxima of the whole function.
+    void skip(size_type i) {
+        auto &head = heads[i];
+        while (head.first != head.second && !owner->is_local_maximum(i, *head.first))
+            ++head.first;
+    }
+
+    // Picks the shard whose head goes first in the order of local maxima, heads.size() if there are none.
+    void select() noexcept {
+        current = heads.size();
+        for (size_type i = 0; i < heads.size(); ++i) {
+            if (heads[i].first == heads[i].second)
+                continue;
+            if (current == heads.size() || precedes(*heads[i].first, *heads[current].first))
+                current = i;
+        }
+    }
+
+    // The same order as the one of local maxima inside FunctionMaxima.
+    static bool precedes(const point_type &fk, const point_type &lk) {
+        if (lk.value() < fk.value() || fk.value() < lk.value())
+            return lk.value() < fk.value();
+        return fk.arg() < lk.arg();
+    }
+
+    const ShardedFunctionMaxima *owner;
+    std::vector<std::pair<shard_mx_iterator, shard_mx_iterator>> heads;
+    size_type current;
+};
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::ShardedFunctionMaxima(std::vector<A> bounds,
+                                                                         const Alloc &alloc)
+        : bounds(std::move(bounds)) {
+    for (size_type i = 1; i < this->bounds.size(); ++i) {
+        if (!(this->bounds[i - 1] < this->bounds[i]))
+            throw InvalidArg();
+    }
+
+    shards.reserve(this->bounds.size() + 1);
+    for (size_type i = 0; i <= this->bounds.size(); ++i)
+        shards.push_back(std::make_unique<Shard>(alloc));
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+typename ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::size_type
+ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::shard_count() const noexcept {
+    return shards.size();
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+typename ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::size_type
+ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::shard_of(const A &a) const {
+    return static_cast<size_type>(std::upper_bound(bounds.begin(), bounds.end(), a) - bounds.begin());
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+V ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::value_at(const A &a) const {
+    const auto &shard = *shards[shard_of(a)];
+    auto lock = shared_lock(shard.mutex);
+    return shard.function.value_at(a);
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+std::optional<typename ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::point_type>
+ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::find(const A &a) const {
+    const auto &shard = *shards[shard_of(a)];
+    auto lock = shared_lock(shard.mutex);
+    auto it = shard.function.find(a);
+    if (it == shard.function.end())
+        return std::nullopt;
+    return point_type(*it);
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+typename ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::size_type
+ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::size() const {
+    size_type result = 0;
+    for (const auto &shard : shards) {
+        auto lock = shared_lock(shard->mutex);
+        result += shard->function.size();
+    }
+    return result;
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+std::vector<typename ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::point_type>
+ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::maxima() const {
+    auto result = std::vector<point_type>();
+    auto locks = lock_all();
+    // Copying points only shares their blocks, A and V are not copied.
+    result.assign(mx_begin(), mx_end());
+    return result;
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+typename ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::point_type
+ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::maximum() const {
+    auto locks = lock_all();
+    auto it = mx_begin();
+    if (it == mx_end())
+        throw InvalidArg();
+    return *it;
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+void ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::set_value(const A &a, const V &v) {
+    auto &shard = *shards[shard_of(a)];
+    auto lock = unique_lock(shard.mutex);
+    shard.function.set_value(a, v);
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+void ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::erase(const A &a) {
+    auto &shard = *shards[shard_of(a)];
+    auto lock = unique_lock(shard.mutex);
+    shard.function.erase(a);
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+template<typename F>
+decltype(auto) ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::read(F &&f) const {
+    auto locks = lock_all();
+    return std::forward<F>(f)(*this);
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+template<typename F>
+decltype(auto) ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::write(size_type i, F &&f) {
+    auto lock = unique_lock(shards[i]->mutex);
+    return std::forward<F>(f)(shards[i]->function);
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+typename ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::mx_iterator
+ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::mx_begin() const {
+    return MaximaIterator(this);
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+typename ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::mx_iterator
+ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::mx_end() const noexcept {
+    return MaximaIterator();
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+std::vector<std::shared_lock<std::shared_mutex>> ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::lock_all() const {
+    auto locks = std::vector<shared_lock>();
+    locks.reserve(shards.size());
+    for (const auto &shard : shards)
+        locks.emplace_back(shard->mutex);
+    return locks;
+}
+
+template<typename A, typename V, typename Alloc, typename Index, typename Minima>
+bool ShardedFunctionMaxima<A, V, Alloc, Index, Minima>::is_local_maximum(size_type i, const point_type &point) const {
+    const auto &function = shards[i]->function;
+
+    // Only the first point of the shard has its left neighbour in another shard (the nearest non empty one).
+    if (!((*function.begin()).arg() < point.arg())) {
+        for (size_type j = i; j-- > 0;) {
+            const auto &left = shards[j]->function;
+            if (left.size() != 0) {
+                if (point.value() < (*std::prev(left.end())).value())
+                    return false;
+                break;
+            }
+        }
+    }
+
+    if (!(point.arg() < (*std::prev(function.end())).arg())) {
+        for (size_type j = i + 1; j < shards.size(); ++j) {
+            const auto &right = shards[j]->function;
+            if (right.size() != 0) {
+                if (point.value() < (*right.begin()).value())
+                    return false;
+                break;
+            }
+        }
+    }
+
+    return true;
+}
+
+#endif // SHARDED_FUNCTION_MAXIMA_H
@@ -0,0 +1,327 @@
+// Test of the allocators of FunctionMaxima: every allocation is given back, allocator-extended copies and assignments
+// between different allocators take nothing from the other one, allocators are swapped and propagated as their traits
+// say, and the teardown of nodes from a monotonic allocator (FunctionMaximaArenaAllocator) is skipped only if
+// A, V and the counter are trivially destructible.
+// Build: g++ -std=c++17 -O2 -pthread tests/allocators_test.cpp -o allocators_test
+
+#include "function_maxima_model.h"
+
+#include <random>
+#include <vector>
+
+namespace test {
+    // Blocks given out by one source of memory, the ones still in use are kept to tell where a pointer comes from.
+    struct AllocationLog {
+        explicit AllocationLog(FunctionMaximaArena *arena = nullptr) : arena(arena) {}
+
+        bool owns(const void *p) const {
+            auto address = static_cast<const char *>(p);
+            for (const auto &block : blocks) {
+                if (block.first <= address && address < block.first + block.second)
+                    return true;
+            }
+            return false;
+        }
+
+        FunctionMaximaArena *arena; // Memory is taken from it if set, deallocation then gives nothing back.
+        long allocations = 0, deallocations = 0;
+        std::vector<std::pair<const char *, size_t>> blocks;
+    };
+
+    // Allocator writing to a log, propagated with the function if Propagate and monotonic if Monotonic.
+    template<typename T, bool Propagate, bool Monotonic>
+    class LoggingAllocator {
+    public:
+        using value_type = T;
+        using is_monotonic = std::bool_constant<Monotonic>;
+        using propagate_on_container_copy_assignment = std::bool_constant<Propagate>;
+        using propagate_on_container_move_assignment = std::bool_constant<Propagate>;
+        using propagate_on_container_swap = std::bool_constant<Propagate>;
+
+        template<typename U>
+        struct rebind {
+            using other = LoggingAllocator<U, Propagate, Monotonic>;
+        };
+
+        explicit LoggingAllocator(AllocationLog &log) noexcept : log(&log) {}
+
+        template<typename U>
+        LoggingAllocator(const LoggingAllocator<U, Propagate, Monotonic> &other) noexcept : log(other.log) {}
+
+        T *allocate(size_t n) {
+            void *p = (log->arena != nullptr ? log->arena->allocate(n * sizeof(T), alignof(T))
+                                             : ::operator new(n * sizeof(T)));
+            ++log->allocations;
+            log->blocks.emplace_back(static_cast<const char *>(p), n * sizeof(T));
+            return static_cast<T *>(p);
+        }
+
+        void deallocate(T *p, size_t) noexcept {
+            ++log->deallocations;
+            auto &blocks = log->blocks;
+            for (auto it = blocks.begin(); it != blocks.end(); ++it) {
+                if (it->first == reinterpret_cast<const char *>(p)) {
+                    blocks.erase(it);
+                    break;
+                }
+            }
+            if (log->arena == nullptr)
+                ::operator delete(p);
+        }
+
+        const AllocationLog &written() const noexcept {
+            return *log;
+        }
+
+        template<typename U>
+        bool operator==(const LoggingAllocator<U, Propagate, Monotonic> &other) const noexcept {
+            return log == other.log;
+        }
+
+        template<typename U>
+        bool operator!=(const LoggingAllocator<U, Propagate, Monotonic> &other) const noexcept {
+            return log != other.log;
+        }
+
+    private:
+        template<typename U, bool, bool>
+        friend class LoggingAllocator;
+
+        AllocationLog *log;
+    };
+
+    inline long live_counted = 0; // Instances of Counted constructed and not destroyed yet.
+
+    // Not trivially destructible, every instance is counted.
+    struct Counted {
+        long x;
+
+        explicit Counted(long x) noexcept : x(x) {
+            ++live_counted;
+        }
+
+        Counted(const Counted &other) noexcept : x(other.x) {
+            ++live_counted;
+        }
+
+        Counted &operator=(const Counted &other) noexcept = default;
+
+        ~Counted() {
+            --live_counted;
+        }
+    };
+
+    inline bool operator<(const Counted &lk, const Counted &rk) {
+        return lk.x < rk.x;
+    }
+
+    inline long plain(const Counted &x) {
+        return x.x;
+    }
+}
+
+namespace {
+    using test::AllocationLog;
+    using test::Counted;
+    using test::LoggingAllocator;
+    using test::Model;
+    using test::Throwing;
+    using test::check_against;
+    using test::make;
+
+    constexpr long max_argument = 100;
+
+    template<typename A, typename V, bool Propagate, bool Monotonic = false>
+    using Logged = FunctionMaxima<A, V, AtomicRefCount, LoggingAllocator<std::pair<A, V>, Propagate, Monotonic>>;
+
+    // Random points of f and of the model.
+    template<typename F>
+    void fill(F &f, Model &model, unsigned seed, long steps) {
+        using A = std::decay_t<decltype(std::declval<F>().begin()->arg())>;
+        using V = std::decay_t<decltype(std::declval<F>().begin()->value())>;
+
+        auto rng = std::mt19937(seed);
+        for (long step = 0; step < steps; ++step) {
+            long a = static_cast<long>(rng() % max_argument), v = static_cast<long>(rng() % 6);
+            if (rng() % 4 != 0) {
+                f.set_value(make<A>(a), make<V>(v));
+                model[a] = v;
+            } else {
+                f.erase(make<A>(a));
+                model.erase(a);
+            }
+        }
+    }
+
+    // Whether all the points of f (their nodes or blocks) come from log.
+    template<typename F>
+    bool allocated_from(const F &f, const AllocationLog &log) {
+        for (const auto &point : f) {
+            if (!log.owns(&point.arg()) || !log.owns(&point.value()))
+                return false;
+        }
+        return true;
+    }
+
+    // Whether any point of f comes from log.
+    template<typename F>
+    bool shares_with(const F &f, const AllocationLog &log) {
+        for (const auto &point : f) {
+            if (log.owns(&point.arg()) || log.owns(&point.value()))
+                return true;
+        }
+        return false;
+    }
+
+    /* Copies made with the same allocator share the blocks of points (unless they are kept inline), the ones made
+     * with another allocator take everything from it. Everything is given back to both.
+     */
+    template<typename A, typename V, bool Propagate>
+    void extended_copies(unsigned seed) {
+        using F = Logged<A, V, Propagate>;
+        using Alloc = typename F::allocator_type;
+
+        auto first = AllocationLog(), second = AllocationLog();
+        {
+            auto model = Model();
+            auto f = F(Alloc(first));
+            fill(f, model, seed, 500);
+
+            auto shared = F(f);
+            CHECK(shared.get_allocator() == f.get_allocator());
+            if (!InlinePoints<A, V>::value && f.size() != 0)
+                CHECK(&shared.begin()->arg() == &f.begin()->arg());
+
+            auto copy = F(f, Alloc(second));
+            CHECK(copy.get_allocator() == Alloc(second));
+            CHECK(allocated_from(copy, second) && !shares_with(copy, first));
+            CHECK(allocated_from(f, first) && !shares_with(f, second));
+
+            f = F(Alloc(first));
+            shared = F(Alloc(first));
+            check_against(copy, model, max_argument);
+            CHECK(second.allocations != 0);
+        }
+        CHECK(first.allocations == first.deallocations && first.blocks.empty());
+        CHECK(second.allocations == second.deallocations && second.blocks.empty());
+    }
+
+    /* Allocators propagated on swap and assignment go with the points. The ones which are not stay with their
+     * instances, then assignment copies the points into the allocator of the assigned one.
+     */
+    template<typename A, typename V, bool Propagate>
+    void swaps_and_assignments(unsigned seed) {
+        using F = Logged<A, V, Propagate>;
+        using Alloc = typename F::allocator_type;
+
+        auto first = AllocationLog(), second = AllocationLog();
+        {
+            auto f_model = Model(), g_model = Model();
+            auto f = F(Alloc(first)), g = F(Alloc(second));
+            fill(f, f_model, seed, 300);
+            fill(g, g_model, seed + 1, 300);
+
+            if (Propagate) {
+                f.swap(g);
+                CHECK(f.get_allocator() == Alloc(second) && g.get_allocator() == Alloc(first));
+                check_against(f, g_model, max_argument);
+                check_against(g, f_model, max_argument);
+                f.swap(g);
+            }
+
+            auto h = F(Alloc(first));
+            h = g;
+            CHECK(h.get_allocator() == (Propagate ? Alloc(second) : Alloc(first)));
+            CHECK(allocated_from(h, Propagate ? second : first));
+            check_against(h, g_model, max_argument);
+
+            auto k = F(Alloc(second));
+            k = std::move(f);
+            CHECK(k.get_allocator() == (Propagate ? Alloc(first) : Alloc(second)));
+            CHECK(allocated_from(k, Propagate ? first : second));
+            check_against(k, f_model, max_argument);
+
+            // The source of an assignment might go away, the assigned function keeps its own points.
+            g = F(Alloc(second));
+            f = F(Alloc(first));
+            check_against(h, g_model, max_argument);
+            check_against(k, f_model, max_argument);
+        }
+        CHECK(first.allocations == first.deallocations && first.blocks.empty());
+        CHECK(second.allocations == second.deallocations && second.blocks.empty());
+    }
+
+    /* Destroying a function with a monotonic allocator gives nothing back (and visits no node) only if A, V and
+     * the counter are trivially destructible, otherwise every node is destroyed as usual.
+     */
+    template<typename A, typename V, bool Monotonic>
+    void teardown(unsigned seed, bool skipped) {
+        using F = Logged<A, V, false, Monotonic>;
+        using Alloc = typename F::allocator_type;
+
+        auto arena = FunctionMaximaArena(256);
+        auto log = AllocationLog(Monotonic ? &arena : nullptr);
+        long live = test::live_counted, deallocations;
+        {
+            auto model = Model();
+            auto f = F(Alloc(log));
+            fill(f, model, seed, 400);
+            check_against(f, model, max_argument);
+            deallocations = log.deallocations;
+        }
+        CHECK((log.deallocations == deallocations) == skipped);
+        CHECK(test::live_counted == live);
+        if (!skipped)
+            CHECK(log.allocations == log.deallocations);
+    }
+
+    /* Points copied out of an arena into another one do not refer to the first one, which might be released
+     * as soon as the function built in it is destroyed.
+     */
+    template<typename A, typename V>
+    void arenas(unsigned seed) {
+        using F = FunctionMaxima<A, V, AtomicRefCount, FunctionMaximaArenaAllocator<std::pair<A, V>>>;
+        using Alloc = typename F::allocator_type;
+
+        auto second = FunctionMaximaArena();
+        auto model = Model();
+        auto copy = F(Alloc(second));
+        {
+            auto first = FunctionMaximaArena(64);
+            auto f = F(Alloc(first));
+            fill(f, model, seed, 400);
+            copy = F(f, Alloc(second));
+            CHECK(copy.get_allocator() == Alloc(second));
+            check_against(copy, model, max_argument);
+        }
+        check_against(copy, model, max_argument);
+    }
+}
+
+int main() {
+    for (unsigned seed = 0; seed < 3; ++seed) {
+        extended_copies<long, long, false>(seed);
+        extended_copies<long, long, true>(seed);
+        extended_copies<Throwing, Throwing, false>(seed);
+        extended_copies<Throwing, Throwing, true>(seed);
+
+        swaps_and_assignments<long, long, false>(seed);
+        swaps_and_assignments<long, long, true>(seed);
+        swaps_and_assignments<Throwing, Throwing, false>(seed);
+        swaps_and_assignments<Throwing, Throwing, true>(seed);
+
+        // Throwing is trivially destructible, but kept in counted blocks.
+        teardown<long, long, true>(seed, true);
+        teardown<Throwing, Throwing, true>(seed, true);
+        teardown<Counted, long, true>(seed, false);
+        teardown<long, Counted, true>(seed, false);
+        teardown<long, long, false>(seed, false);
+
+        arenas<long, long>(seed);
+        arenas<Throwing, Throwing>(seed);
+        arenas<Counted, Counted>(seed);
+    }
+    CHECK(test::live_counted == 0);
+
+    std::puts("allocators_test: OK");
+}
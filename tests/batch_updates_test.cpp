@@ -0,0 +1,179 @@
+// Randomized test of the batch updates of FunctionMaxima (set_values, erase_many) and of its construction from
+// a range against a std::map model: batches in any order, with repeated arguments (the last one wins), ranges of types
+// converted to A, and the strong guarantee of a whole batch.
+// Build: g++ -std=c++17 -O2 -pthread tests/batch_updates_test.cpp -o batch_updates_test
+
+#include "function_maxima_model.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+    using test::Model;
+    using test::Throwing;
+    using test::ThrowingAllocator;
+    using test::check_against;
+    using test::make;
+
+    constexpr long max_argument = 200;
+
+    // Random batches of Key and Value converted to the ones of F, every one of them followed by a check.
+    template<typename F, typename Key, typename Value>
+    void random_batches(unsigned seed, long steps) {
+        auto rng = std::mt19937(seed);
+        auto f = F();
+        auto model = Model();
+        for (long step = 0; step < steps; ++step) {
+            // Small batches touch a few neighbourhoods, large ones overlap and repeat arguments.
+            size_t size = (rng() % 4 == 0 ? rng() % 64 : rng() % 6);
+            if (rng() % 3 != 0) {
+                auto batch = std::vector<std::pair<Key, Value>>();
+                for (size_t k = 0; k < size; ++k) {
+                    long a = static_cast<long>(rng() % max_argument), v = static_cast<long>(rng() % 6);
+                    batch.emplace_back(make<Key>(a), make<Value>(v));
+                    model[a] = v;
+                }
+                f.set_values(batch);
+            } else {
+                auto batch = std::vector<Key>();
+                for (size_t k = 0; k < size; ++k) {
+                    long a = static_cast<long>(rng() % max_argument);
+                    batch.push_back(make<Key>(a));
+                    model.erase(a);
+                }
+                f.erase_many(batch.begin(), batch.end());
+            }
+            check_against(f, model, max_argument);
+        }
+
+        // A sorted range of pairs with const arguments.
+        auto points = std::map<Key, Value>();
+        for (long a = 0; a < max_argument; a += 3) {
+            points.emplace(make<Key>(a), make<Value>(a % 4));
+            model[a] = a % 4;
+        }
+        f.set_values(points);
+        check_against(f, model, max_argument);
+    }
+
+    // Constructions from sorted and unsorted ranges of any size, with repeated arguments.
+    template<typename F, typename Key, typename Value>
+    void random_constructions(unsigned seed, long steps) {
+        auto rng = std::mt19937(seed);
+        for (long step = 0; step < steps; ++step) {
+            size_t size = (step < 4 ? static_cast<size_t>(step % 2) : rng() % 100);
+            auto points = std::vector<std::pair<Key, Value>>();
+            auto model = Model();
+            for (size_t k = 0; k < size; ++k) {
+                long a = static_cast<long>(rng() % max_argument), v = static_cast<long>(rng() % 6);
+                points.emplace_back(make<Key>(a), make<Value>(v));
+                model[a] = v;
+            }
+            // Sorted ranges (also with repeated arguments) take the path without sorting.
+            if (step % 2 == 1) {
+                std::stable_sort(points.begin(), points.end(), [](const auto &lk, const auto &rk) {
+                    return lk.first < rk.first;
+                });
+            }
+            check_against(F(points.begin(), points.end()), model, max_argument);
+        }
+    }
+
+    /* Every batch is first made to throw at each of its operations in turn (comparisons, copies and allocations),
+     * the function has to stay as it was, then it is made without throwing.
+     */
+    template<typename F>
+    void batch_strong_guarantee(unsigned seed, long steps) {
+        auto rng = std::mt19937(seed);
+        auto f = F();
+        auto model = Model();
+        for (long step = 0; step < steps; ++step) {
+            auto points = std::vector<std::pair<Throwing, Throwing>>();
+            auto arguments = std::vector<Throwing>();
+            auto updated = model;
+            bool erasing = rng() % 3 == 0;
+            for (size_t k = 0, size = rng() % 8; k < size; ++k) {
+                long a = static_cast<long>(rng() % max_argument), v = static_cast<long>(rng() % 6);
+                if (erasing) {
+                    arguments.emplace_back(a);
+                    updated.erase(a);
+                } else {
+                    points.emplace_back(Throwing(a), Throwing(v));
+                    updated[a] = v;
+                }
+            }
+
+            for (long countdown = 0;; ++countdown) {
+                test::throw_countdown = countdown;
+                try {
+                    if (erasing)
+                        f.erase_many(arguments);
+                    else
+                        f.set_values(points);
+                    test::throw_countdown = -1;
+                    break;
+                } catch (const std::runtime_error &) {
+                    test::throw_countdown = -1;
+                    check_against(f, model, max_argument);
+                }
+            }
+            model = updated;
+            check_against(f, model, max_argument);
+        }
+    }
+
+    // Argument whose order (of decimal strings) differs from the one of the int it is converted from.
+    struct Decimal {
+        std::string digits;
+
+        Decimal(int x) : digits(std::to_string(x)) {}
+
+        bool operator<(const Decimal &other) const {
+            return digits < other.digits;
+        }
+    };
+
+    // Arguments converted from another type are compared as A, not as the type they come from.
+    void converted_arguments() {
+        auto f = FunctionMaxima<std::string, int>();
+        auto points = std::vector<std::pair<const char *, int>>{{"b", 1}, {"a", 2}, {"c", 3}, {"a", 5}};
+        f.set_values(points);
+        CHECK(f.size() == 3 && f.value_at("a") == 5 && f.value_at("b") == 1 && f.value_at("c") == 3);
+        CHECK(f.begin()->arg() == "a" && f.mx_begin()->arg() == "a");
+
+        auto arguments = std::vector<const char *>{"c", "d", "c"};
+        f.erase_many(arguments);
+        CHECK(f.size() == 2 && f.find("c") == f.end());
+
+        // Sorted as ints, but not as Decimal: 9 < 10, "10" < "9".
+        auto sorted = std::vector<std::pair<int, int>>{{8, 0}, {9, 1}, {10, 3}};
+        auto g = FunctionMaxima<Decimal, int>(sorted.begin(), sorted.end());
+        CHECK(g.size() == 3 && g.begin()->arg().digits == "10" && std::prev(g.end())->arg().digits == "9");
+        CHECK(g.value_at(10) == 3 && g.mx_begin()->arg().digits == "10");
+        CHECK(std::next(g.mx_begin())->arg().digits == "9");
+    }
+}
+
+int main() {
+    for (unsigned seed = 0; seed < 3; ++seed) {
+        random_batches<FunctionMaxima<long, long>, long, long>(seed, 2000);
+        random_batches<FunctionMaxima<long, long>, int, int>(seed, 1000);
+        random_batches<FunctionMaxima<long, long, AtomicRefCount, std::allocator<std::pair<long, long>>,
+                                      RangeIndex, LocalMinima>, long, long>(seed, 1000);
+        random_batches<FunctionMaxima<Throwing, Throwing>, Throwing, Throwing>(seed, 1000);
+        random_constructions<FunctionMaxima<long, long>, long, long>(seed, 300);
+        random_constructions<FunctionMaxima<long, long>, int, int>(seed, 300);
+        random_constructions<FunctionMaxima<long, long, AtomicRefCount, std::allocator<std::pair<long, long>>,
+                                            RangeIndex, LocalMinima>, long, long>(seed, 300);
+        random_constructions<FunctionMaxima<Throwing, Throwing>, Throwing, Throwing>(seed, 300);
+    }
+    converted_arguments();
+
+    batch_strong_guarantee<FunctionMaxima<Throwing, Throwing, AtomicRefCount,
+                                          ThrowingAllocator<std::pair<Throwing, Throwing>>>>(8, 300);
+    batch_strong_guarantee<FunctionMaxima<Throwing, Throwing, AtomicRefCount,
+                                          ThrowingAllocator<std::pair<Throwing, Throwing>>, RangeIndex>>(9, 300);
+
+    std::puts("batch_updates_test: OK");
+}
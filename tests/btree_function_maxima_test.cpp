@@ -0,0 +1,47 @@
+// Randomized test of BTreeFunctionMaxima against a std::map model, for several node sizes and both storages
+// of the indices, and of the strong exception guarantee of its updates.
+// Build: g++ -std=c++17 -O2 -pthread tests/btree_function_maxima_test.cpp -o btree_function_maxima_test
+
+#include "function_maxima_model.h"
+#include "../btree_function_maxima.h"
+
+#include <random>
+#include <string>
+
+namespace {
+    using test::Throwing;
+    using test::ThrowingAllocator;
+    using test::random_updates;
+    using test::strong_guarantee;
+
+    constexpr long max_argument = 200;
+
+    template<typename A, typename V, size_t PointsNodeBytes, size_t MaximaNodeBytes>
+    using BTrees = BTreeFunctionMaxima<A, V, std::allocator<std::pair<A, V>>,
+                                       BTreeStorage<PointsNodeBytes>, BTreeStorage<MaximaNodeBytes>>;
+
+    // Allocations of nodes and of blocks of points might throw as well.
+    template<typename A, typename V, typename PointsStorage, typename MaximaStorage>
+    using Allocating = BTreeFunctionMaxima<A, V, ThrowingAllocator<std::pair<A, V>>, PointsStorage, MaximaStorage>;
+}
+
+int main() {
+    for (unsigned seed = 0; seed < 2; ++seed) {
+        // Small nodes split and merge often, inline points (long, long) fill the nodes themselves.
+        random_updates<BTrees<long, long, 64, 64>>(seed, 3000, max_argument);
+        random_updates<BTrees<long, long, 256, 128>>(seed, 3000, max_argument);
+        random_updates<BTreeFunctionMaxima<long, long>>(seed, 3000, max_argument);
+        random_updates<BTreeFunctionMaxima<long, long, std::allocator<std::pair<long, long>>,
+                                           SetStorage, BTreeStorage<64>>>(seed, 2000, max_argument);
+        random_updates<BTreeFunctionMaxima<long, long, std::allocator<std::pair<long, long>>,
+                                           BTreeStorage<64>, SetStorage>>(seed, 2000, max_argument);
+        random_updates<BTrees<Throwing, Throwing, 128, 96>>(seed, 2000, max_argument);
+    }
+
+    strong_guarantee<Allocating<Throwing, Throwing, BTreeStorage<64>, BTreeStorage<64>>>(1, 400, max_argument);
+    strong_guarantee<Allocating<Throwing, Throwing, SetStorage, BTreeStorage<64>>>(2, 400, max_argument);
+    strong_guarantee<Allocating<Throwing, Throwing, BTreeStorage<96>, SetStorage>>(3, 400, max_argument);
+    strong_guarantee<Allocating<Throwing, Throwing, SetStorage, SetStorage>>(4, 400, max_argument);
+
+    std::puts("btree_function_maxima_test: OK");
+}
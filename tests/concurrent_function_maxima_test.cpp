@@ -0,0 +1,235 @@
+// Test of ConcurrentFunctionMaxima: snapshots taken between updates have to stay as they were (single-threaded,
+// against a std::map model), and readers running at the same time as a writer have to see consistent versions only.
+// Worth building also with -fsanitize=thread.
+// Build: g++ -std=c++17 -O2 -pthread tests/concurrent_function_maxima_test.cpp -o concurrent_function_maxima_test
+
+#include "function_maxima_model.h"
+#include "../concurrent_function_maxima.h"
+
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+    using test::Model;
+    using test::check_against;
+
+    constexpr long max_argument = 200;
+
+    template<typename C>
+    struct Snapshot {
+        typename C::snapshot_type function;
+        Model model;
+    };
+
+    /* Random single and batch updates, every one of them checked through copy(), with snapshots taken from time
+     * to time. All the snapshots are checked again and again, so an update made on a version still read is noticed.
+     */
+    template<typename C>
+    void snapshots(unsigned seed, long steps) {
+        auto rng = std::mt19937(seed);
+        auto c = C();
+        auto model = Model();
+        auto taken = std::vector<Snapshot<C>>();
+        for (long step = 0; step < steps; ++step) {
+            long a = static_cast<long>(rng() % max_argument), v = static_cast<long>(rng() % 6);
+            switch (rng() % 5) {
+                case 0: {
+                    c.erase(a);
+                    model.erase(a);
+                    break;
+                }
+                case 1: {
+                    auto points = std::vector<std::pair<long, long>>{{a, v}, {(a + 1) % max_argument, v + 1}};
+                    c.set_values(points);
+                    for (const auto &point : points)
+                        model[point.first] = point.second;
+                    break;
+                }
+                case 2: {
+                    auto arguments = std::vector<long>{a, (a + 2) % max_argument};
+                    c.erase_many(arguments);
+                    for (long b : arguments)
+                        model.erase(b);
+                    break;
+                }
+                default: {
+                    c.set_value(a, v);
+                    model[a] = v;
+                    break;
+                }
+            }
+            CHECK(c.size() == model.size());
+
+            // Several snapshots of one version share it, the next update copies it once.
+            if (rng() % 16 == 0) {
+                for (int k = 0, count = 1 + static_cast<int>(rng() % 2); k < count; ++k)
+                    taken.push_back({c.snapshot(), model});
+            }
+            if (rng() % 8 == 0 && !taken.empty())
+                taken.erase(taken.begin() + static_cast<std::ptrdiff_t>(rng() % taken.size()));
+
+            if (step % 50 == 0) {
+                check_against(c.copy(), model, max_argument);
+                for (const auto &snapshot : taken)
+                    check_against(*snapshot.function, snapshot.model, max_argument);
+            }
+        }
+        check_against(c.copy(), model, max_argument);
+        for (const auto &snapshot : taken)
+            check_against(*snapshot.function, snapshot.model, max_argument);
+    }
+
+    // Points written by writers have values congruent to their arguments, whatever version readers see.
+    long value_of(long a, long level) {
+        return level * max_argument + a;
+    }
+
+    bool is_written(long a, long v) {
+        return a >= 0 && a < max_argument && v % max_argument == a;
+    }
+
+    // Whatever version is read, it has to be consistent: its points, local maxima and extrema agree with each other.
+    template<typename F>
+    void check_version(const F &f) {
+        auto model = Model();
+        for (const auto &point : f) {
+            CHECK(is_written(point.arg(), point.value()));
+            model[point.arg()] = point.value();
+        }
+        check_against(f, model, max_argument);
+        if (!model.empty()) {
+            auto min = model.begin();
+            for (auto it = model.begin(); it != model.end(); ++it) {
+                if (it->second < min->second)
+                    min = it;
+            }
+            CHECK(f.argmin() == min->first && f.global_min() == min->second);
+        }
+    }
+
+    /* One writer updates the function while readers call every const method of it and check what they get.
+     * Readers check whole versions through read() and snapshot(), so the lazily found minimum is also published
+     * by several threads at once, as is the lazily computed data of RangeIndex by max_in_range() if ranged.
+     */
+    template<typename C, bool ranged>
+    void readers_and_writer(unsigned seed, long steps, int readers) {
+        auto c = C();
+        auto done = std::atomic<bool>(false);
+        auto started = std::atomic<int>(0);
+
+        auto threads = std::vector<std::thread>();
+        for (int r = 0; r < readers; ++r) {
+            threads.emplace_back([&c, &done, &started, seed, r] {
+                auto rng = std::mt19937(seed * 31 + static_cast<unsigned>(r));
+                started.fetch_add(1, std::memory_order_relaxed);
+                do {
+                    long a = static_cast<long>(rng() % max_argument);
+                    switch (rng() % 6) {
+                        case 0: {
+                            try {
+                                CHECK(is_written(a, c.value_at(a)));
+                            } catch (const InvalidArg &) {}
+                            auto point = c.find(a);
+                            CHECK(!point || (point->arg() == a && is_written(a, point->value())));
+                            break;
+                        }
+                        case 1: {
+                            auto maxima = c.maxima();
+                            for (size_t k = 0; k < maxima.size(); ++k) {
+                                CHECK(is_written(maxima[k].arg(), maxima[k].value()));
+                                CHECK(k == 0 || !(maxima[k - 1].value() < maxima[k].value()));
+                            }
+                            break;
+                        }
+                        case 2: {
+                            try {
+                                auto maximum = c.maximum();
+                                CHECK(is_written(maximum.arg(), maximum.value()));
+                                auto minimum = c.minimum();
+                                CHECK(is_written(minimum.arg(), minimum.value()));
+                            } catch (const InvalidArg &) {}
+                            if constexpr (ranged) {
+                                long b = a + static_cast<long>(rng() % 20);
+                                auto point = c.max_in_range(a, b);
+                                CHECK(!point || (a <= point->arg() && point->arg() <= b &&
+                                                 is_written(point->arg(), point->value())));
+                            }
+                            break;
+                        }
+                        case 3: {
+                            c.read([](const auto &f) {
+                                check_version(f);
+                            });
+                            break;
+                        }
+                        default: {
+                            auto snapshot = c.snapshot();
+                            check_version(*snapshot);
+                            break;
+                        }
+                    }
+                } while (!done.load(std::memory_order_acquire));
+            });
+        }
+
+        // Updates start once all the readers run, so that they overlap.
+        while (started.load(std::memory_order_relaxed) < readers)
+            std::this_thread::yield();
+
+        auto rng = std::mt19937(seed);
+        auto model = Model();
+        for (long step = 0; step < steps; ++step) {
+            long a = static_cast<long>(rng() % max_argument), v = value_of(a, static_cast<long>(rng() % 6));
+            switch (rng() % 5) {
+                case 0: {
+                    c.erase(a);
+                    model.erase(a);
+                    break;
+                }
+                case 1: {
+                    long b = (a + 1) % max_argument;
+                    auto points = std::vector<std::pair<long, long>>{{a, v}, {b, value_of(b, step % 6)}};
+                    c.set_values(points);
+                    for (const auto &point : points)
+                        model[point.first] = point.second;
+                    break;
+                }
+                case 2: {
+                    auto arguments = std::vector<long>{a, (a + 3) % max_argument};
+                    c.erase_many(arguments);
+                    for (long b : arguments)
+                        model.erase(b);
+                    break;
+                }
+                default: {
+                    c.set_value(a, v);
+                    model[a] = v;
+                    break;
+                }
+            }
+        }
+        done.store(true, std::memory_order_release);
+        for (auto &thread : threads)
+            thread.join();
+
+        check_against(c.copy(), model, max_argument);
+        check_version(*c.snapshot());
+    }
+}
+
+int main() {
+    using Concurrent = ConcurrentFunctionMaxima<long, long>;
+    using ConcurrentWithMinima = ConcurrentFunctionMaxima<long, long, std::allocator<std::pair<long, long>>,
+                                                          RangeIndex, LocalMinima>;
+    for (unsigned seed = 0; seed < 2; ++seed) {
+        snapshots<Concurrent>(seed, 3000);
+        snapshots<ConcurrentWithMinima>(seed, 3000);
+    }
+
+    readers_and_writer<Concurrent, false>(5, 3000, 4);
+    readers_and_writer<ConcurrentWithMinima, true>(6, 3000, 4);
+
+    std::puts("concurrent_function_maxima_test: OK");
+}
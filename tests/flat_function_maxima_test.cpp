@@ -0,0 +1,122 @@
+// Randomized test of FlatFunctionMaxima against a std::map model, for each way of shifting points inside the array
+// (moving, swapping, copying), of its construction from a range and of the strong exception guarantee of its updates.
+// Build: g++ -std=c++17 -O2 -pthread tests/flat_function_maxima_test.cpp -o flat_function_maxima_test
+
+#include "function_maxima_model.h"
+#include "../flat_function_maxima.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+namespace test {
+    // Copies might throw, but swapping never does, so points of it are shifted by swaps.
+    struct Swappable {
+        long x;
+
+        explicit Swappable(long x) : x(x) {}
+
+        Swappable(const Swappable &other) : x(other.x) {
+            may_throw();
+        }
+
+        Swappable &operator=(const Swappable &other) {
+            may_throw();
+            x = other.x;
+            return *this;
+        }
+
+        friend void swap(Swappable &lk, Swappable &rk) noexcept {
+            std::swap(lk.x, rk.x);
+        }
+    };
+
+    inline bool operator<(const Swappable &lk, const Swappable &rk) {
+        may_throw();
+        return lk.x < rk.x;
+    }
+
+    inline long plain(const Swappable &x) {
+        return x.x;
+    }
+}
+
+namespace {
+    using test::Model;
+    using test::Swappable;
+    using test::Throwing;
+    using test::check_against;
+    using test::make;
+    using test::random_updates;
+    using test::strong_guarantee;
+
+    constexpr long max_argument = 200;
+
+    // Constructions from sorted and unsorted ranges of any size, with repeated arguments.
+    template<typename F, typename Key, typename Value>
+    void random_constructions(unsigned seed, long steps) {
+        auto rng = std::mt19937(seed);
+        for (long step = 0; step < steps; ++step) {
+            size_t size = (step < 4 ? static_cast<size_t>(step % 2) : rng() % 100);
+            auto points = std::vector<std::pair<Key, Value>>();
+            auto model = Model();
+            for (size_t k = 0; k < size; ++k) {
+                long a = static_cast<long>(rng() % max_argument), v = static_cast<long>(rng() % 6);
+                points.emplace_back(make<Key>(a), make<Value>(v));
+                model[a] = v;
+            }
+            if (step % 2 == 1) {
+                std::stable_sort(points.begin(), points.end(), [](const auto &lk, const auto &rk) {
+                    return lk.first < rk.first;
+                });
+            }
+            auto f = F(points.begin(), points.end());
+            check_against(f, model, max_argument);
+
+            // Points built from a range are updated like any others.
+            for (int k = 0; k < 10; ++k) {
+                long a = static_cast<long>(rng() % max_argument), v = static_cast<long>(rng() % 6);
+                f.set_value(make<Key>(a), make<Value>(v));
+                model[a] = v;
+            }
+            check_against(f, model, max_argument);
+        }
+    }
+
+    // Argument whose order (of decimal strings) differs from the one of the int it is converted from.
+    struct Decimal {
+        std::string digits;
+
+        Decimal(int x) : digits(std::to_string(x)) {}
+
+        bool operator<(const Decimal &other) const {
+            return digits < other.digits;
+        }
+    };
+
+    // Points of a range sorted as ints, but not as Decimal, have to be sorted again.
+    void converted_arguments() {
+        auto points = std::vector<std::pair<int, int>>{{8, 0}, {9, 1}, {10, 3}};
+        auto f = FlatFunctionMaxima<Decimal, int>(points.begin(), points.end());
+        CHECK(f.size() == 3 && f.begin()->arg().digits == "10" && std::prev(f.end())->arg().digits == "9");
+        CHECK(f.value_at(8) == 0 && f.value_at(9) == 1 && f.value_at(10) == 3);
+        CHECK(f.find(11) == f.end());
+    }
+}
+
+int main() {
+    for (unsigned seed = 0; seed < 2; ++seed) {
+        // Points of long are moved, of Swappable swapped and of Throwing copied when the array is shifted.
+        random_updates<FlatFunctionMaxima<long, long>>(seed, 3000, max_argument);
+        random_updates<FlatFunctionMaxima<Swappable, Swappable>>(seed, 2000, max_argument);
+        random_updates<FlatFunctionMaxima<Throwing, Throwing>>(seed, 2000, max_argument);
+        random_constructions<FlatFunctionMaxima<long, long>, long, long>(seed, 300);
+        random_constructions<FlatFunctionMaxima<long, long>, int, int>(seed, 300);
+    }
+    converted_arguments();
+
+    strong_guarantee<FlatFunctionMaxima<Swappable, Swappable>>(10, 400, max_argument);
+    strong_guarantee<FlatFunctionMaxima<Throwing, Throwing>>(11, 400, max_argument);
+
+    std::puts("flat_function_maxima_test: OK");
+}
@@ -0,0 +1,226 @@
+#ifndef FUNCTION_MAXIMA_MODEL_H
+#define FUNCTION_MAXIMA_MODEL_H
+
+// Helpers shared by the tests: a std::map model of a function, checks of a backend against it, types which throw
+// on demand, random updates checked against the model and a check of the strong guarantee of updates built on them.
+
+#include "../function_maxima.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// Unlike assert, checks are not compiled out with -DNDEBUG.
+#define CHECK(condition)                                                                  \
+    do {                                                                                  \
+        if (!(condition)) {                                                               \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            std::abort();                                                                 \
+        }                                                                                 \
+    } while (false)
+
+namespace test {
+    using Model = std::map<long, long>;
+
+    // Number of operations of Throwing and ThrowingAllocator left before one throws, negative means never.
+    inline long throw_countdown = -1;
+
+    inline void may_throw() {
+        if (throw_countdown >= 0 && throw_countdown-- == 0)
+            throw std::runtime_error("thrown on demand");
+    }
+
+    // Comparisons and copies might throw, so points of it are never kept inline.
+    struct Throwing {
+        long x;
+
+        explicit Throwing(long x) : x(x) {}
+
+        Throwing(const Throwing &other) : x(other.x) {
+            may_throw();
+        }
+
+        Throwing &operator=(const Throwing &other) {
+            may_throw();
+            x = other.x;
+            return *this;
+        }
+    };
+
+    inline bool operator<(const Throwing &lk, const Throwing &rk) {
+        may_throw();
+        return lk.x < rk.x;
+    }
+
+    template<typename T>
+    struct ThrowingAllocator {
+        using value_type = T;
+
+        ThrowingAllocator() noexcept = default;
+
+        template<typename U>
+        ThrowingAllocator(const ThrowingAllocator<U> &) noexcept {}
+
+        T *allocate(size_t n) {
+            may_throw();
+            return std::allocator<T>().allocate(n);
+        }
+
+        void deallocate(T *p, size_t n) noexcept {
+            std::allocator<T>().deallocate(p, n);
+        }
+
+        template<typename U>
+        bool operator==(const ThrowingAllocator<U> &) const noexcept {
+            return true;
+        }
+
+        template<typename U>
+        bool operator!=(const ThrowingAllocator<U> &) const noexcept {
+            return false;
+        }
+    };
+
+    inline long plain(long x) {
+        return x;
+    }
+
+    inline long plain(const Throwing &x) {
+        return x.x;
+    }
+
+    template<typename T>
+    T make(long x) {
+        return T(x);
+    }
+
+    // Local maxima of the model, sorted by values descending, then by arguments.
+    inline std::vector<std::pair<long, long>> local_maxima(const Model &model) {
+        auto result = std::vector<std::pair<long, long>>();
+        for (auto it = model.begin(); it != model.end(); ++it) {
+            auto next = std::next(it);
+            if ((it == model.begin() || !(it->second < std::prev(it)->second)) &&
+                (next == model.end() || !(it->second < next->second)))
+                result.push_back(*it);
+        }
+        std::stable_sort(result.begin(), result.end(), [](const auto &lk, const auto &rk) {
+            return rk.second < lk.second;
+        });
+        return result;
+    }
+
+    // Compares begin() - end(), mx_begin() - mx_end(), find and value_at of f with the model.
+    template<typename F>
+    void check_against(const F &f, const Model &model, long max_argument) {
+        using A = std::decay_t<decltype(f.begin()->arg())>;
+
+        CHECK(f.size() == model.size());
+        auto it = f.begin();
+        for (const auto &point : model) {
+            CHECK(it != f.end());
+            CHECK(plain(it->arg()) == point.first && plain(it->value()) == point.second);
+            ++it;
+        }
+        CHECK(it == f.end());
+
+        auto mx = f.mx_begin();
+        for (const auto &point : local_maxima(model)) {
+            CHECK(mx != f.mx_end());
+            CHECK(plain(mx->arg()) == point.first && plain(mx->value()) == point.second);
+            ++mx;
+        }
+        CHECK(mx == f.mx_end());
+
+        for (long a = -1; a <= max_argument; ++a) {
+            auto found = f.find(make<A>(a));
+            auto point = model.find(a);
+            if (point == model.end()) {
+                CHECK(found == f.end());
+                bool thrown = false;
+                try {
+                    f.value_at(make<A>(a));
+                } catch (const InvalidArg &) {
+                    thrown = true;
+                }
+                CHECK(thrown);
+            } else {
+                CHECK(found != f.end() && plain(found->arg()) == a);
+                CHECK(plain(f.value_at(make<A>(a))) == point->second);
+            }
+        }
+    }
+
+    // Random updates, every one of them followed by a check of the whole function, then copies and assignments.
+    template<typename F>
+    void random_updates(unsigned seed, long steps, long max_argument) {
+        using A = std::decay_t<decltype(std::declval<F>().begin()->arg())>;
+        using V = std::decay_t<decltype(std::declval<F>().begin()->value())>;
+
+        auto rng = std::mt19937(seed);
+        auto f = F();
+        auto model = Model();
+        for (long step = 0; step < steps; ++step) {
+            // Few distinct values, so that plateaus and ties among local maxima are common.
+            long a = static_cast<long>(rng() % max_argument), v = static_cast<long>(rng() % 6);
+            if (rng() % 3 != 0) {
+                f.set_value(make<A>(a), make<V>(v));
+                model[a] = v;
+            } else {
+                f.erase(make<A>(a));
+                model.erase(a);
+            }
+            check_against(f, model, max_argument);
+        }
+
+        auto copy = F(f);
+        check_against(copy, model, max_argument);
+        auto assigned = F();
+        assigned = copy;
+        copy.erase(make<A>(model.begin()->first));
+        check_against(assigned, model, max_argument);
+    }
+
+    /* Every update is first made to throw at each of its operations in turn (comparisons, copies
+     * and allocations), the function has to stay as it was, then it is made without throwing.
+     */
+    template<typename F>
+    void strong_guarantee(unsigned seed, long steps, long max_argument) {
+        using A = std::decay_t<decltype(std::declval<F>().begin()->arg())>;
+        using V = std::decay_t<decltype(std::declval<F>().begin()->value())>;
+
+        auto rng = std::mt19937(seed);
+        auto f = F();
+        auto model = Model();
+        for (long step = 0; step < steps; ++step) {
+            long a = static_cast<long>(rng() % max_argument), v = static_cast<long>(rng() % 6);
+            bool erasing = rng() % 3 == 0;
+            for (long countdown = 0;; ++countdown) {
+                throw_countdown = countdown;
+                try {
+                    if (erasing)
+                        f.erase(make<A>(a));
+                    else
+                        f.set_value(make<A>(a), make<V>(v));
+                    throw_countdown = -1;
+                    break;
+                } catch (const std::runtime_error &) {
+                    throw_countdown = -1;
+                    check_against(f, model, max_argument);
+                }
+            }
+            if (erasing)
+                model.erase(a);
+            else
+                model[a] = v;
+            check_against(f, model, max_argument);
+        }
+    }
+}
+
+#endif // FUNCTION_MAXIMA_MODEL_H
@@ -0,0 +1,92 @@
+// Test of the work done by single updates of FunctionMaxima, counted with FUNCTION_MAXIMA_STATS: set_value and erase
+// descend once in function_points and search local_maxima (and local_minima) at most once for every affected point,
+// only to insert the ones which become local maxima (minima), all the others are reached through stored iterators.
+// Build: g++ -std=c++17 -O2 -pthread tests/function_maxima_stats_test.cpp -o function_maxima_stats_test
+
+#define FUNCTION_MAXIMA_STATS
+
+#include "function_maxima_model.h"
+
+#include <random>
+
+namespace {
+    using test::Model;
+    using test::check_against;
+
+    constexpr long max_argument = 200;
+
+    // Whether the point at it is a local maximum (minimum) of the model.
+    bool is_extremum(const Model &model, Model::const_iterator it, bool minimum) {
+        auto beats = [&](Model::const_iterator other) {
+            return minimum ? other->second < it->second : it->second < other->second;
+        };
+        return (it == model.begin() || !beats(std::prev(it))) &&
+               (std::next(it) == model.end() || !beats(std::next(it)));
+    }
+
+    /* Searches of local maxima (and minima) needed to update the model from before to after: one for every
+     * affected point (a and its neighbours) which is an extremum after the update, unless it was one before
+     * with the same value, then its entry is kept.
+     */
+    size_t expected_insertions(const Model &before, const Model &after, long a, bool with_minima) {
+        auto affected = std::vector<long>{a};
+        for (const auto *model : {&before, &after}) {
+            auto it = model->lower_bound(a);
+            if (it != model->begin())
+                affected.push_back(std::prev(it)->first);
+            if (it != model->end() && it->first == a)
+                ++it;
+            if (it != model->end())
+                affected.push_back(it->first);
+        }
+        std::sort(affected.begin(), affected.end());
+        affected.erase(std::unique(affected.begin(), affected.end()), affected.end());
+
+        size_t result = 0;
+        for (long b : affected) {
+            auto now = after.find(b), was = before.find(b);
+            if (now == after.end())
+                continue;
+            for (bool minimum : {false, true}) {
+                if (minimum && !with_minima)
+                    continue;
+                bool kept = was != before.end() && was->second == now->second && is_extremum(before, was, minimum);
+                if (is_extremum(after, now, minimum) && !kept)
+                    ++result;
+            }
+        }
+        return result;
+    }
+
+    template<typename F>
+    void count_descents(unsigned seed, long steps, bool with_minima) {
+        auto rng = std::mt19937(seed);
+        auto f = F();
+        auto model = Model();
+        for (long step = 0; step < steps; ++step) {
+            long a = static_cast<long>(rng() % max_argument), v = static_cast<long>(rng() % 6);
+            auto before = model;
+            if (rng() % 3 != 0) {
+                f.set_value(a, v);
+                model[a] = v;
+            } else {
+                f.erase(a);
+                model.erase(a);
+            }
+            // One descent in function_points (even if nothing changes), then only insertions of extrema.
+            CHECK(f.last_operation_stats().operations == 1);
+            CHECK(f.last_operation_stats().tree_descents == 1 + expected_insertions(before, model, a, with_minima));
+            check_against(f, model, max_argument);
+        }
+    }
+}
+
+int main() {
+    for (unsigned seed = 0; seed < 3; ++seed) {
+        count_descents<FunctionMaxima<long, long>>(seed, 3000, false);
+        count_descents<FunctionMaxima<long, long, AtomicRefCount, std::allocator<std::pair<long, long>>,
+                                      NoRangeIndex, LocalMinima>>(seed, 3000, true);
+    }
+
+    std::puts("function_maxima_stats_test: OK");
+}
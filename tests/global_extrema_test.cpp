@@ -0,0 +1,168 @@
+// Randomized test of global_max, argmax, global_min and argmin of FunctionMaxima against a std::map model, with and
+// without LocalMinima, after single and batch updates, copies, moves and swaps, read after every update or rarely
+// (so that the minimum kept without LocalMinima is both kept by updates and found again) and after updates which
+// throw.
+// Build: g++ -std=c++17 -O2 -pthread tests/global_extrema_test.cpp -o global_extrema_test
+
+#include "function_maxima_model.h"
+
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace {
+    using test::Model;
+    using test::Throwing;
+    using test::check_against;
+    using test::make;
+    using test::plain;
+
+    constexpr long max_argument = 200;
+
+    template<typename F>
+    void check_extrema(const F &f, const Model &model) {
+        if (model.empty()) {
+            for (int k = 0; k < 4; ++k) {
+                bool thrown = false;
+                try {
+                    switch (k) {
+                        case 0: f.global_max(); break;
+                        case 1: f.argmax(); break;
+                        case 2: f.global_min(); break;
+                        default: f.argmin(); break;
+                    }
+                } catch (const InvalidArg &) {
+                    thrown = true;
+                }
+                CHECK(thrown);
+            }
+            return;
+        }
+
+        // The first point with the greatest (smallest) value.
+        auto max = model.begin(), min = model.begin();
+        for (auto it = model.begin(); it != model.end(); ++it) {
+            if (max->second < it->second)
+                max = it;
+            if (it->second < min->second)
+                min = it;
+        }
+        CHECK(plain(f.global_max()) == max->second && plain(f.argmax()) == max->first);
+        CHECK(plain(f.global_min()) == min->second && plain(f.argmin()) == min->first);
+    }
+
+    // Random single and batch updates, extrema are read after every period-th of them.
+    template<typename F>
+    void random_updates(unsigned seed, long steps, long period) {
+        using A = std::decay_t<decltype(std::declval<F>().begin()->arg())>;
+        using V = std::decay_t<decltype(std::declval<F>().begin()->value())>;
+
+        auto rng = std::mt19937(seed);
+        auto f = F();
+        auto model = Model();
+        check_extrema(f, model);
+        for (long step = 0; step < steps; ++step) {
+            long a = static_cast<long>(rng() % max_argument), v = static_cast<long>(rng() % 10);
+            switch (rng() % 6) {
+                case 0: {
+                    f.erase(make<A>(a));
+                    model.erase(a);
+                    break;
+                }
+                case 1: {
+                    auto points = std::vector<std::pair<A, V>>();
+                    for (size_t k = 0, size = rng() % 6; k < size; ++k) {
+                        long b = static_cast<long>(rng() % max_argument), w = static_cast<long>(rng() % 10);
+                        points.emplace_back(make<A>(b), make<V>(w));
+                        model[b] = w;
+                    }
+                    f.set_values(points);
+                    break;
+                }
+                case 2: {
+                    auto arguments = std::vector<A>();
+                    for (size_t k = 0, size = rng() % 6; k < size; ++k) {
+                        long b = static_cast<long>(rng() % max_argument);
+                        arguments.push_back(make<A>(b));
+                        model.erase(b);
+                    }
+                    f.erase_many(arguments);
+                    break;
+                }
+                default: {
+                    f.set_value(make<A>(a), make<V>(v));
+                    model[a] = v;
+                    break;
+                }
+            }
+            if (step % period == 0)
+                check_extrema(f, model);
+
+            // Copies find their own minimum, moved and swapped instances take the kept one with their points.
+            if (step % 97 == 0) {
+                auto copy = F(f);
+                check_extrema(copy, model);
+                auto moved = F(std::move(copy));
+                check_extrema(moved, model);
+                auto other = F();
+                other.swap(moved);
+                check_extrema(other, model);
+                check_extrema(moved, Model());
+                f = other;
+                check_extrema(f, model);
+            }
+        }
+        check_against(f, model, max_argument);
+    }
+
+    // Updates which throw leave the kept minimum as it was, extrema are read before every update.
+    template<typename F>
+    void strong_guarantee(unsigned seed, long steps) {
+        auto rng = std::mt19937(seed);
+        auto f = F();
+        auto model = Model();
+        for (long step = 0; step < steps; ++step) {
+            long a = static_cast<long>(rng() % max_argument), v = static_cast<long>(rng() % 10);
+            bool erasing = rng() % 3 == 0;
+            check_extrema(f, model);
+            for (long countdown = 0;; ++countdown) {
+                test::throw_countdown = countdown;
+                try {
+                    if (erasing)
+                        f.erase(Throwing(a));
+                    else
+                        f.set_value(Throwing(a), Throwing(v));
+                    test::throw_countdown = -1;
+                    break;
+                } catch (const std::runtime_error &) {
+                    test::throw_countdown = -1;
+                    check_extrema(f, model);
+                }
+            }
+            if (erasing)
+                model.erase(a);
+            else
+                model[a] = v;
+        }
+        check_extrema(f, model);
+        check_against(f, model, max_argument);
+    }
+}
+
+int main() {
+    using LongWithMinima = FunctionMaxima<long, long, AtomicRefCount, std::allocator<std::pair<long, long>>,
+                                          NoRangeIndex, LocalMinima>;
+    for (unsigned seed = 0; seed < 3; ++seed) {
+        for (long period : {1, 7}) {
+            random_updates<FunctionMaxima<long, long>>(seed, 4000, period);
+            random_updates<LongWithMinima>(seed, 4000, period);
+            random_updates<FunctionMaxima<Throwing, Throwing>>(seed, 1000, period);
+        }
+    }
+
+    strong_guarantee<FunctionMaxima<Throwing, Throwing>>(12, 1000);
+    strong_guarantee<FunctionMaxima<Throwing, Throwing, AtomicRefCount, std::allocator<std::pair<Throwing, Throwing>>,
+                                    NoRangeIndex, LocalMinima>>(13, 1000);
+
+    std::puts("global_extrema_test: OK");
+}
@@ -0,0 +1,121 @@
+// Test of LocalExtremaKernel against the definition of local maxima and minima, for every type it vectorizes
+// (and a few it does not), lengths around the width of the lanes, ties and NaN, and of the bulk paths of
+// FunctionMaxima and FlatFunctionMaxima using it.
+// Build: g++ -std=c++17 -O2 -march=native -pthread tests/local_extrema_kernel_test.cpp -o local_extrema_kernel_test
+// (without -march=native only SSE2 is enabled, with -DFUNCTION_MAXIMA_NO_SIMD only the scalar version).
+
+#include "function_maxima_model.h"
+#include "../flat_function_maxima.h"
+
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace {
+    using test::Model;
+    using test::check_against;
+
+    constexpr long max_argument = 200;
+
+    template<typename V>
+    V random_value(std::mt19937 &rng) {
+        // Few distinct values, so that ties are common.
+        if constexpr (std::numeric_limits<V>::has_quiet_NaN) {
+            if (rng() % 16 == 0)
+                return std::numeric_limits<V>::quiet_NaN();
+        }
+        return static_cast<V>(static_cast<long>(rng() % 5) - 2);
+    }
+
+    // Flags of values[i] with neighbours left[i] and right[i], straight from the definition.
+    template<typename V>
+    unsigned char expected(bool minima, V left, V value, V right) {
+        return minima ? !(left < value) && !(right < value) : !(value < left) && !(value < right);
+    }
+
+    template<typename V>
+    void check_kernel(unsigned seed) {
+        using kernel = LocalExtremaKernel<V>;
+
+        auto rng = std::mt19937(seed);
+        for (size_t n = 0; n <= 70; ++n) {
+            for (int repeat = 0; repeat < 20; ++repeat) {
+                auto left = std::vector<V>(n), values = std::vector<V>(n), right = std::vector<V>(n);
+                for (size_t i = 0; i < n; ++i) {
+                    left[i] = random_value<V>(rng);
+                    values[i] = random_value<V>(rng);
+                    right[i] = random_value<V>(rng);
+                }
+
+                // One more flag than needed, which must not be written.
+                auto maxima = std::vector<unsigned char>(n + 1, 2), minima = std::vector<unsigned char>(n + 1, 2);
+                kernel::maxima(left.data(), values.data(), right.data(), n, maxima.data());
+                kernel::minima(left.data(), values.data(), right.data(), n, minima.data());
+                for (size_t i = 0; i < n; ++i) {
+                    CHECK(maxima[i] == expected(false, left[i], values[i], right[i]));
+                    CHECK(minima[i] == expected(true, left[i], values[i], right[i]));
+                }
+                CHECK(maxima[n] == 2 && minima[n] == 2);
+
+                // Neighbours within the sequence, the missing ones of both ends never beat the value.
+                auto scalar = std::vector<unsigned char>(n + 1, 2);
+                kernel::maxima(values.data(), n, maxima.data());
+                kernel::minima(values.data(), n, minima.data());
+                kernel::scalar_maxima(values.data(), n, scalar.data());
+                for (size_t i = 0; i < n; ++i) {
+                    V l = (i == 0 ? values[i] : values[i - 1]), r = (i + 1 == n ? values[i] : values[i + 1]);
+                    CHECK(maxima[i] == expected(false, l, values[i], r));
+                    CHECK(minima[i] == expected(true, l, values[i], r));
+                    CHECK(scalar[i] == maxima[i]);
+                }
+                CHECK(maxima[n] == 2 && minima[n] == 2 && scalar[n] == 2);
+            }
+        }
+    }
+
+    // Building from a range and batches of updates find local maxima with the kernel.
+    template<typename F>
+    void check_bulk(unsigned seed) {
+        auto rng = std::mt19937(seed);
+        auto points = std::vector<std::pair<long, double>>();
+        auto model = Model();
+        for (long a = 0; a < max_argument; a += 1 + static_cast<long>(rng() % 3)) {
+            long v = static_cast<long>(rng() % 5);
+            points.emplace_back(a, static_cast<double>(v));
+            model[a] = v;
+        }
+        auto f = F(points.begin(), points.end());
+        check_against(f, model, max_argument);
+
+        if constexpr (std::is_same<F, FunctionMaxima<long, double>>::value) {
+            for (int batch = 0; batch < 50; ++batch) {
+                auto updates = std::vector<std::pair<long, double>>();
+                for (int k = 0; k < 8; ++k) {
+                    long a = static_cast<long>(rng() % max_argument), v = static_cast<long>(rng() % 5);
+                    updates.emplace_back(a, static_cast<double>(v));
+                    model[a] = v;
+                }
+                f.set_values(updates);
+                check_against(f, model, max_argument);
+            }
+        }
+    }
+}
+
+int main() {
+    for (unsigned seed = 0; seed < 3; ++seed) {
+        check_kernel<float>(seed);
+        check_kernel<double>(seed);
+        check_kernel<int32_t>(seed);
+        check_kernel<int64_t>(seed);
+        check_kernel<int16_t>(seed);
+        check_kernel<uint32_t>(seed);
+
+        check_bulk<FunctionMaxima<long, double>>(seed);
+        check_bulk<FlatFunctionMaxima<long, double>>(seed);
+    }
+
+    std::puts(LocalExtremaKernel<double>::vectorized ? "local_extrema_kernel_test: OK"
+                                                     : "local_extrema_kernel_test: OK (scalar only)");
+}
@@ -0,0 +1,172 @@
+// Randomized test of the local minima of FunctionMaxima (mn_begin() - mn_end()) against a std::map model, with and
+// without RangeIndex: after single and batch updates, construction from a range, copies and updates which throw.
+// Build: g++ -std=c++17 -O2 -pthread tests/local_minima_test.cpp -o local_minima_test
+
+#include "function_maxima_model.h"
+
+#include <random>
+#include <vector>
+
+namespace {
+    using test::Model;
+    using test::Throwing;
+    using test::check_against;
+    using test::make;
+    using test::plain;
+
+    constexpr long max_argument = 200;
+
+    template<typename A, typename V, typename Index>
+    using WithMinima = FunctionMaxima<A, V, AtomicRefCount, std::allocator<std::pair<A, V>>, Index, LocalMinima>;
+
+    // Local minima of the model, sorted by values ascending, then by arguments.
+    std::vector<std::pair<long, long>> local_minima(const Model &model) {
+        auto result = std::vector<std::pair<long, long>>();
+        for (auto it = model.begin(); it != model.end(); ++it) {
+            auto next = std::next(it);
+            if ((it == model.begin() || !(std::prev(it)->second < it->second)) &&
+                (next == model.end() || !(next->second < it->second)))
+                result.push_back(*it);
+        }
+        std::stable_sort(result.begin(), result.end(), [](const auto &lk, const auto &rk) {
+            return lk.second < rk.second;
+        });
+        return result;
+    }
+
+    // Compares mn_begin() - mn_end() with the model, then everything else.
+    template<typename F>
+    void check_minima(const F &f, const Model &model) {
+        auto mn = f.mn_begin();
+        for (const auto &point : local_minima(model)) {
+            CHECK(mn != f.mn_end());
+            CHECK(plain(mn->arg()) == point.first && plain(mn->value()) == point.second);
+            ++mn;
+        }
+        CHECK(mn == f.mn_end());
+        check_against(f, model, max_argument);
+    }
+
+    /* Random single and batch updates, every one of them followed by a check. From time to time the function is
+     * built again from its points (in a random order) or copied, and the new one is updated further.
+     */
+    template<typename F>
+    void random_updates(unsigned seed, long steps) {
+        using A = std::decay_t<decltype(std::declval<F>().begin()->arg())>;
+        using V = std::decay_t<decltype(std::declval<F>().begin()->value())>;
+
+        auto rng = std::mt19937(seed);
+        auto f = F();
+        auto model = Model();
+        for (long step = 0; step < steps; ++step) {
+            // Few distinct values, so that plateaus and points both minima and maxima are common.
+            long a = static_cast<long>(rng() % max_argument), v = static_cast<long>(rng() % 4);
+            switch (rng() % 6) {
+                case 0: {
+                    f.erase(make<A>(a));
+                    model.erase(a);
+                    break;
+                }
+                case 1: {
+                    auto points = std::vector<std::pair<A, V>>();
+                    for (size_t k = 0, size = rng() % 8; k < size; ++k) {
+                        long b = static_cast<long>(rng() % max_argument), w = static_cast<long>(rng() % 4);
+                        points.emplace_back(make<A>(b), make<V>(w));
+                        model[b] = w;
+                    }
+                    f.set_values(points);
+                    break;
+                }
+                case 2: {
+                    auto arguments = std::vector<A>();
+                    for (size_t k = 0, size = rng() % 8; k < size; ++k) {
+                        long b = static_cast<long>(rng() % max_argument);
+                        arguments.push_back(make<A>(b));
+                        model.erase(b);
+                    }
+                    f.erase_many(arguments);
+                    break;
+                }
+                default: {
+                    f.set_value(make<A>(a), make<V>(v));
+                    model[a] = v;
+                    break;
+                }
+            }
+            check_minima(f, model);
+
+            if (step % 101 == 0) {
+                auto points = std::vector<std::pair<A, V>>();
+                for (const auto &point : model)
+                    points.emplace_back(make<A>(point.first), make<V>(point.second));
+                std::shuffle(points.begin(), points.end(), rng);
+                f = F(points.begin(), points.end());
+                check_minima(f, model);
+            } else if (step % 101 == 50) {
+                auto copy = F(f);
+                check_minima(copy, model);
+                f = std::move(copy);
+            }
+        }
+    }
+
+    // Single updates and batches which throw leave local minima as they were.
+    template<typename F>
+    void strong_guarantee(unsigned seed, long steps) {
+        auto rng = std::mt19937(seed);
+        auto f = F();
+        auto model = Model();
+        for (long step = 0; step < steps; ++step) {
+            auto points = std::vector<std::pair<Throwing, Throwing>>();
+            auto updated = model;
+            bool batch = rng() % 2 == 0, erasing = rng() % 3 == 0;
+            for (size_t k = 0, size = (batch ? rng() % 6 : 1); k < size; ++k) {
+                long a = static_cast<long>(rng() % max_argument), v = static_cast<long>(rng() % 4);
+                points.emplace_back(Throwing(a), Throwing(v));
+                if (erasing)
+                    updated.erase(a);
+                else
+                    updated[a] = v;
+            }
+
+            for (long countdown = 0;; ++countdown) {
+                test::throw_countdown = countdown;
+                try {
+                    if (batch && erasing) {
+                        auto arguments = std::vector<Throwing>();
+                        for (const auto &point : points)
+                            arguments.push_back(point.first);
+                        f.erase_many(arguments);
+                    } else if (batch) {
+                        f.set_values(points);
+                    } else if (erasing) {
+                        f.erase(points.front().first);
+                    } else {
+                        f.set_value(points.front().first, points.front().second);
+                    }
+                    test::throw_countdown = -1;
+                    break;
+                } catch (const std::runtime_error &) {
+                    test::throw_countdown = -1;
+                    check_minima(f, model);
+                }
+            }
+            model = updated;
+            check_minima(f, model);
+        }
+    }
+}
+
+int main() {
+    for (unsigned seed = 0; seed < 3; ++seed) {
+        random_updates<WithMinima<long, long, NoRangeIndex>>(seed, 2000);
+        random_updates<WithMinima<long, long, RangeIndex>>(seed, 2000);
+        random_updates<WithMinima<Throwing, Throwing, NoRangeIndex>>(seed, 400);
+        random_updates<WithMinima<Throwing, Throwing, RangeIndex>>(seed, 400);
+    }
+
+    strong_guarantee<WithMinima<Throwing, Throwing, NoRangeIndex>>(14, 100);
+    strong_guarantee<WithMinima<Throwing, Throwing, RangeIndex>>(15, 100);
+
+    std::puts("local_minima_test: OK");
+}
@@ -0,0 +1,99 @@
+// Randomized test of top_k_maxima and maxima_above of FunctionMaxima against a std::map model: k = 0, k up to and
+// past the number of local maxima, thresholds below, between, above and equal to values of local maxima (ties).
+// Build: g++ -std=c++17 -O2 -pthread tests/maxima_queries_test.cpp -o maxima_queries_test
+
+#include "function_maxima_model.h"
+
+#include <random>
+#include <vector>
+
+namespace {
+    using test::Model;
+    using test::Throwing;
+    using test::check_against;
+    using test::make;
+    using test::plain;
+
+    constexpr long max_argument = 100;
+    constexpr long max_value = 6;
+
+    // Compares a subrange of mx_begin() - mx_end() with the expected points.
+    template<typename Range>
+    void check_range(const Range &range, const std::vector<std::pair<long, long>> &expected) {
+        CHECK(range.empty() == expected.empty());
+        auto it = range.begin();
+        for (const auto &point : expected) {
+            CHECK(it != range.end());
+            CHECK(plain(it->arg()) == point.first && plain(it->value()) == point.second);
+            ++it;
+        }
+        CHECK(it == range.end());
+    }
+
+    template<typename F>
+    void check_queries(const F &f, const Model &model) {
+        using V = std::decay_t<decltype(std::declval<F>().begin()->value())>;
+
+        // Ranges are prefixes of mx_begin() - mx_end(), which might be iterated as any other points.
+        auto maxima = test::local_maxima(model);
+        size_t count = 0;
+        for (typename F::iterator it = f.mx_begin(); it != f.mx_end(); ++it, ++count) {
+            const typename F::point_type &point = *it;
+            CHECK(count < maxima.size());
+            CHECK(plain(point.arg()) == maxima[count].first && plain(point.value()) == maxima[count].second);
+        }
+        CHECK(count == maxima.size());
+
+        for (size_t k = 0; k <= maxima.size() + 2; ++k) {
+            auto top = f.top_k_maxima(k);
+            CHECK(top.begin() == f.mx_begin());
+            check_range(top, std::vector<std::pair<long, long>>(maxima.begin(),
+                                                                maxima.begin() + std::min(k, maxima.size())));
+        }
+
+        // Only values strictly greater than threshold, maxima equal to it (often several) are left out.
+        for (long threshold = -1; threshold <= max_value; ++threshold) {
+            auto above = std::vector<std::pair<long, long>>();
+            for (const auto &point : maxima) {
+                if (threshold < point.second)
+                    above.push_back(point);
+            }
+            auto range = f.maxima_above(make<V>(threshold));
+            CHECK(range.begin() == f.mx_begin());
+            check_range(range, above);
+        }
+    }
+
+    template<typename F>
+    void random_queries(unsigned seed, long steps) {
+        using A = std::decay_t<decltype(std::declval<F>().begin()->arg())>;
+        using V = std::decay_t<decltype(std::declval<F>().begin()->value())>;
+
+        auto rng = std::mt19937(seed);
+        auto f = F();
+        auto model = Model();
+        check_queries(f, model);
+        for (long step = 0; step < steps; ++step) {
+            // Few distinct values, so that ties among local maxima are common.
+            long a = static_cast<long>(rng() % max_argument), v = static_cast<long>(rng() % max_value);
+            if (rng() % 3 != 0) {
+                f.set_value(make<A>(a), make<V>(v));
+                model[a] = v;
+            } else {
+                f.erase(make<A>(a));
+                model.erase(a);
+            }
+            check_queries(f, model);
+        }
+        check_against(f, model, max_argument);
+    }
+}
+
+int main() {
+    for (unsigned seed = 0; seed < 3; ++seed) {
+        random_queries<FunctionMaxima<long, long>>(seed, 1500);
+        random_queries<FunctionMaxima<Throwing, Throwing>>(seed, 500);
+    }
+
+    std::puts("maxima_queries_test: OK");
+}
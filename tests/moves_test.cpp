@@ -0,0 +1,184 @@
+// Test of set_value(A &&, V &&) and emplace_value of FunctionMaxima: a and v are moved (never copied) exactly when
+// the value changes, move-only A and V are enough, and emplace_value keeps the strong guarantee when constructing
+// the point (or anything after it) throws.
+// Build: g++ -std=c++17 -O2 -pthread tests/moves_test.cpp -o moves_test
+
+#include "function_maxima_model.h"
+
+#include <random>
+#include <tuple>
+
+namespace test {
+    inline long copies = 0, moves = 0; // Copies and moves of MoveCounting made so far.
+
+    // Moved-from instances are marked with -1, copies might throw, so points of it are never kept inline.
+    struct MoveCounting {
+        long x;
+
+        explicit MoveCounting(long x) : x(x) {}
+
+        MoveCounting(const MoveCounting &other) : x(other.x) {
+            may_throw();
+            ++copies;
+        }
+
+        MoveCounting(MoveCounting &&other) noexcept : x(other.x) {
+            other.x = -1;
+            ++moves;
+        }
+
+        MoveCounting &operator=(const MoveCounting &other) = delete;
+
+        MoveCounting &operator=(MoveCounting &&other) = delete;
+    };
+
+    inline bool operator<(const MoveCounting &lk, const MoveCounting &rk) {
+        return lk.x < rk.x;
+    }
+
+    inline long plain(const MoveCounting &x) {
+        return x.x;
+    }
+
+    // Neither copied nor assigned at all.
+    struct MoveOnly {
+        long x;
+
+        explicit MoveOnly(long x) noexcept : x(x) {}
+
+        MoveOnly(const MoveOnly &other) = delete;
+
+        MoveOnly(MoveOnly &&other) noexcept : x(other.x) {
+            other.x = -1;
+        }
+
+        MoveOnly &operator=(const MoveOnly &other) = delete;
+
+        MoveOnly &operator=(MoveOnly &&other) = delete;
+    };
+
+    inline bool operator<(const MoveOnly &lk, const MoveOnly &rk) {
+        return lk.x < rk.x;
+    }
+
+    inline long plain(const MoveOnly &x) {
+        return x.x;
+    }
+
+    // Constructing it from a long might throw (as any of its copies and comparisons).
+    struct ThrowingConstruction {
+        long x;
+
+        explicit ThrowingConstruction(long x) : x(x) {
+            may_throw();
+        }
+
+        ThrowingConstruction(const ThrowingConstruction &other) : x(other.x) {
+            may_throw();
+        }
+
+        ThrowingConstruction &operator=(const ThrowingConstruction &other) = delete;
+    };
+
+    inline bool operator<(const ThrowingConstruction &lk, const ThrowingConstruction &rk) {
+        may_throw();
+        return lk.x < rk.x;
+    }
+
+    inline long plain(const ThrowingConstruction &x) {
+        return x.x;
+    }
+}
+
+namespace {
+    using test::Model;
+    using test::MoveCounting;
+    using test::MoveOnly;
+    using test::ThrowingConstruction;
+    using test::check_against;
+
+    constexpr long max_argument = 100;
+
+    /* Random updates by set_value(A &&, V &&) and erase. If the value changes, a and v are moved from and nothing
+     * is copied, otherwise they are left as they were.
+     */
+    template<typename F, typename T>
+    void random_moves(unsigned seed, long steps, bool counted) {
+        auto rng = std::mt19937(seed);
+        auto f = F();
+        auto model = Model();
+        for (long step = 0; step < steps; ++step) {
+            long a = static_cast<long>(rng() % max_argument), v = static_cast<long>(rng() % 4);
+            if (rng() % 4 == 0) {
+                f.erase(T(a));
+                model.erase(a);
+            } else {
+                bool changes = model.count(a) == 0 || model[a] != v;
+                auto arg = T(a), value = T(v);
+                long copies = test::copies, moves = test::moves;
+                f.set_value(std::move(arg), std::move(value));
+                model[a] = v;
+                CHECK(arg.x == (changes ? -1 : a) && value.x == (changes ? -1 : v));
+                if (counted) {
+                    CHECK(test::copies == copies);
+                    CHECK((test::moves != moves) == changes);
+                }
+            }
+            check_against(f, model, max_argument);
+        }
+    }
+
+    /* Points emplaced from longs, every update is first made to throw at each of its operations in turn (including
+     * the constructors of A and V), the function has to stay as it was.
+     */
+    void emplace_strong_guarantee(unsigned seed, long steps) {
+        using F = FunctionMaxima<ThrowingConstruction, ThrowingConstruction>;
+
+        auto rng = std::mt19937(seed);
+        auto f = F();
+        auto model = Model();
+        for (long step = 0; step < steps; ++step) {
+            long a = static_cast<long>(rng() % max_argument), v = static_cast<long>(rng() % 4);
+            for (long countdown = 0;; ++countdown) {
+                test::throw_countdown = countdown;
+                try {
+                    f.emplace_value(std::piecewise_construct, std::make_tuple(a), std::make_tuple(v));
+                    test::throw_countdown = -1;
+                    break;
+                } catch (const std::runtime_error &) {
+                    test::throw_countdown = -1;
+                    check_against(f, model, max_argument);
+                }
+            }
+            model[a] = v;
+            check_against(f, model, max_argument);
+        }
+    }
+
+    // Points emplaced from the arguments of constructors of move-only A and V.
+    void emplace_move_only() {
+        auto f = FunctionMaxima<MoveOnly, MoveOnly>();
+        auto model = Model();
+        for (long a = 0; a < max_argument; ++a) {
+            f.emplace_value(std::piecewise_construct, std::forward_as_tuple(a), std::forward_as_tuple(a % 7));
+            model[a] = a % 7;
+        }
+        // The same value again changes nothing.
+        f.emplace_value(std::piecewise_construct, std::forward_as_tuple(3), std::forward_as_tuple(3));
+        check_against(f, model, max_argument);
+    }
+}
+
+int main() {
+    for (unsigned seed = 0; seed < 3; ++seed) {
+        random_moves<FunctionMaxima<MoveCounting, MoveCounting>, MoveCounting>(seed, 1000, true);
+        random_moves<FunctionMaxima<MoveOnly, MoveOnly>, MoveOnly>(seed, 1000, false);
+        random_moves<FunctionMaxima<MoveOnly, MoveOnly, AtomicRefCount, std::allocator<std::pair<MoveOnly, MoveOnly>>,
+                                    RangeIndex, LocalMinima>, MoveOnly>(seed, 1000, false);
+    }
+    emplace_move_only();
+
+    emplace_strong_guarantee(16, 300);
+
+    std::puts("moves_test: OK");
+}
@@ -0,0 +1,83 @@
+// Randomized test of PersistentFunctionMaxima against a std::map model: every version kept by a copy has to stay
+// as it was while the others are updated, and updates have the strong exception guarantee.
+// Build: g++ -std=c++17 -O2 -pthread tests/persistent_function_maxima_test.cpp -o persistent_function_maxima_test
+
+#include "function_maxima_model.h"
+#include "../persistent_function_maxima.h"
+
+#include <random>
+#include <vector>
+
+namespace {
+    using test::Model;
+    using test::Throwing;
+    using test::check_against;
+    using test::make;
+    using test::strong_guarantee;
+
+    constexpr long max_argument = 200;
+
+    template<typename A, typename V>
+    struct Version {
+        PersistentFunctionMaxima<A, V> f;
+        Model model;
+        // Iterator to the first local maximum, taken when the version was kept, has to stay valid with it.
+        typename PersistentFunctionMaxima<A, V>::mx_iterator first_maximum;
+    };
+
+    /* Random updates of one of the kept versions (or of a copy of it), each followed by a check of the updated one.
+     * From time to time all the kept versions are checked, so an update sharing nodes wrongly is noticed.
+     */
+    template<typename A, typename V>
+    void random_versions(unsigned seed, long steps) {
+        auto rng = std::mt19937(seed);
+        auto versions = std::vector<Version<A, V>>(1);
+        for (long step = 0; step < steps; ++step) {
+            auto &version = versions[rng() % versions.size()];
+            if (rng() % 8 == 0 && versions.size() < 32) {
+                auto copy = version;
+                copy.first_maximum = copy.f.mx_begin();
+                versions.push_back(std::move(copy));
+                continue;
+            }
+
+            long a = static_cast<long>(rng() % max_argument), v = static_cast<long>(rng() % 6);
+            if (rng() % 3 != 0) {
+                version.f.set_value(make<A>(a), make<V>(v));
+                version.model[a] = v;
+            } else {
+                version.f.erase(make<A>(a));
+                version.model.erase(a);
+            }
+            version.first_maximum = version.f.mx_begin();
+            check_against(version.f, version.model, max_argument);
+
+            if (step % 64 == 0) {
+                for (const auto &kept : versions) {
+                    check_against(kept.f, kept.model, max_argument);
+                    CHECK(kept.first_maximum == kept.f.mx_begin());
+                    auto maxima = test::local_maxima(kept.model);
+                    if (!maxima.empty())
+                        CHECK(test::plain(kept.first_maximum->arg()) == maxima.front().first);
+                }
+            }
+        }
+
+        // Assignment shares the version, the source might be updated afterwards.
+        auto assigned = PersistentFunctionMaxima<A, V>();
+        assigned = versions.front().f;
+        versions.front().f.set_value(make<A>(max_argument), make<V>(0));
+        check_against(assigned, versions.front().model, max_argument);
+    }
+}
+
+int main() {
+    for (unsigned seed = 0; seed < 3; ++seed) {
+        random_versions<long, long>(seed, 2000);
+        random_versions<Throwing, Throwing>(seed, 600);
+    }
+
+    strong_guarantee<PersistentFunctionMaxima<Throwing, Throwing>>(7, 400, max_argument);
+
+    std::puts("persistent_function_maxima_test: OK");
+}
@@ -0,0 +1,163 @@
+// Randomized test of the queries of RangeIndex and AggregateIndex (maxima_in_range, max_in_range, rank, select,
+// count_in_range, aggregate) against brute force over a std::map model, and of the strong guarantee of their updates.
+// Build: g++ -std=c++17 -O2 -pthread tests/range_index_test.cpp -o range_index_test
+
+#include "function_maxima_model.h"
+
+#include <cstdint>
+#include <random>
+#include <set>
+
+namespace {
+    using test::Model;
+    using test::Throwing;
+    using test::check_against;
+    using test::make;
+    using test::strong_guarantee;
+
+    constexpr long max_argument = 200;
+
+    // Polynomial hash of the sequence of points, so combining summaries in a wrong order is noticed.
+    struct SequenceHash {
+        struct value_type {
+            std::uint64_t hash, power;
+
+            bool operator==(const value_type &other) const {
+                return hash == other.hash && power == other.power;
+            }
+        };
+
+        static value_type identity() {
+            return {0, 1};
+        }
+
+        static value_type of(long a, long v) {
+            return {static_cast<std::uint64_t>(a) * 1000003u + static_cast<std::uint64_t>(v) + 1, 1000000007u};
+        }
+
+        static value_type combine(const value_type &lk, const value_type &rk) {
+            return {lk.hash * rk.power + rk.hash, lk.power * rk.power};
+        }
+    };
+
+    // Compares the queries of the index of f with brute force over the model, for all ranges [lo, hi]
+    // starting at lo (including empty and reversed ones), aggregate only if F has AggregateIndex<SequenceHash>.
+    template<bool aggregated, typename F>
+    void check_ranges(const F &f, const Model &model, long lo) {
+        auto maxima = std::set<long>();
+        for (const auto &point : test::local_maxima(model))
+            maxima.insert(point.first);
+
+        for (long hi = lo - 1; hi <= max_argument; ++hi) {
+            // Local maxima in the range, in the order of arguments.
+            auto mx = f.maxima_in_range(lo, hi).begin();
+            for (const auto &point : model) {
+                if (point.first < lo || hi < point.first || maxima.count(point.first) == 0)
+                    continue;
+                CHECK(mx != f.maxima_in_range(lo, hi).end());
+                CHECK(mx->arg() == point.first && mx->value() == point.second);
+                ++mx;
+            }
+            CHECK(mx == f.maxima_in_range(lo, hi).end());
+
+            auto best = model.end();
+            auto count = typename F::size_type(0);
+            auto summary = SequenceHash::identity();
+            for (auto it = model.lower_bound(lo); it != model.end() && it->first <= hi; ++it) {
+                if (best == model.end() || best->second < it->second)
+                    best = it;
+                ++count;
+                summary = SequenceHash::combine(summary, SequenceHash::of(it->first, it->second));
+            }
+            auto max = f.max_in_range(lo, hi);
+            if (best == model.end())
+                CHECK(max == f.end());
+            else
+                CHECK(max != f.end() && max->arg() == best->first && max->value() == best->second);
+            CHECK(f.count_in_range(lo, hi) == count);
+            if constexpr (aggregated)
+                CHECK(f.aggregate(lo, hi) == summary);
+        }
+    }
+
+    template<typename F>
+    void check_order_statistics(const F &f, const Model &model) {
+        for (long a = -1; a <= max_argument + 1; ++a)
+            CHECK(f.rank(a) == static_cast<typename F::size_type>(std::distance(model.begin(), model.lower_bound(a))));
+
+        auto k = typename F::size_type(0);
+        for (const auto &point : model) {
+            auto it = f.select(k++);
+            CHECK(it != f.end() && it->arg() == point.first && it->value() == point.second);
+        }
+        CHECK(f.select(k) == f.end());
+        CHECK(f.select(k + 1) == f.end());
+    }
+
+    // Random updates, every one of them followed by the checks of all points and of the index.
+    template<typename F, bool aggregated>
+    void random_updates(unsigned seed, long steps) {
+        auto rng = std::mt19937(seed);
+        auto f = F();
+        auto model = Model();
+        for (long step = 0; step < steps; ++step) {
+            long a = static_cast<long>(rng() % max_argument), v = static_cast<long>(rng() % 6);
+            if (rng() % 3 != 0) {
+                f.set_value(a, v);
+                model[a] = v;
+            } else {
+                f.erase(a);
+                model.erase(a);
+            }
+            check_against(f, model, max_argument);
+            check_order_statistics(f, model);
+            // Ranges starting at a few arguments, all of them would make the test quadratic in max_argument.
+            check_ranges<aggregated>(f, model, static_cast<long>(rng() % (max_argument + 2)) - 1);
+            check_ranges<aggregated>(f, model, a);
+        }
+
+        // Copies have their own index.
+        auto copy = F(f);
+        f.erase(model.begin()->first);
+        check_order_statistics(copy, model);
+        check_ranges<aggregated>(copy, model, -1);
+    }
+
+    // Maximum of the values of the points, which does not depend on the order of combining.
+    struct MaxValue {
+        using value_type = long;
+
+        static value_type identity() {
+            return -1;
+        }
+
+        static value_type of(const Throwing &, const Throwing &v) {
+            return v.x;
+        }
+
+        static value_type combine(const value_type &lk, const value_type &rk) {
+            return std::max(lk, rk);
+        }
+    };
+
+    template<typename A, typename V>
+    using Aggregated = FunctionMaxima<A, V, AtomicRefCount, std::allocator<std::pair<A, V>>,
+                                      AggregateIndex<SequenceHash>>;
+}
+
+int main() {
+    for (unsigned seed = 0; seed < 2; ++seed) {
+        random_updates<FunctionMaxima<long, long, AtomicRefCount, std::allocator<std::pair<long, long>>, RangeIndex>,
+                       false>(seed, 1500);
+        random_updates<Aggregated<long, long>, true>(seed, 1500);
+    }
+
+    // Updates of the index compare arguments as well, which might throw.
+    strong_guarantee<FunctionMaxima<Throwing, Throwing, AtomicRefCount,
+                                    std::allocator<std::pair<Throwing, Throwing>>, RangeIndex>>(5, 400, max_argument);
+    strong_guarantee<FunctionMaxima<Throwing, Throwing, AtomicRefCount,
+                                    std::allocator<std::pair<Throwing, Throwing>>, AggregateIndex<MaxValue>>>(
+            6, 400, max_argument);
+
+    std::puts("range_index_test: OK");
+}
@@ -0,0 +1,128 @@
+// Randomized test of ShardedFunctionMaxima against FunctionMaxima and a std::map model: local maxima merged from
+// the shards (mx_begin() - mx_end(), maxima(), maximum()) have to be the ones of the whole function, also with points
+// next to the bounds of the shards, shards of one argument and shards which stay empty. Worth building also with
+// -D_GLIBCXX_DEBUG, which rejects comparisons of iterators of different sets.
+// Build: g++ -std=c++17 -O2 -pthread tests/sharded_function_maxima_test.cpp -o sharded_function_maxima_test
+
+#include "function_maxima_model.h"
+#include "../sharded_function_maxima.h"
+
+#include <random>
+#include <vector>
+
+namespace {
+    using test::Model;
+    using test::check_against;
+
+    constexpr long max_argument = 200;
+
+    using Sharded = ShardedFunctionMaxima<long, long>;
+
+    // Compares mx_begin() - mx_end() of s with the ones of f, which has the same points. Takes no locks.
+    void check_merged(const Sharded &s, const FunctionMaxima<long, long> &f) {
+        auto expected = f.mx_begin();
+        auto it = s.mx_begin();
+        for (; it != s.mx_end(); ++it, ++expected) {
+            CHECK(expected != f.mx_end());
+            CHECK(it->arg() == expected->arg() && it->value() == expected->value());
+            // A copy stands at the same point, the next one does not (even if it comes from another shard).
+            auto copy = it;
+            CHECK(copy == it && !(copy != it));
+            CHECK(++copy != it);
+        }
+        CHECK(expected == f.mx_end());
+        CHECK(s.mx_end() == Sharded::mx_iterator() && (s.mx_begin() == s.mx_end()) == (f.size() == 0));
+    }
+
+    // The same through maxima() and maximum(), which lock the shards themselves.
+    void check_maxima(const Sharded &s, const FunctionMaxima<long, long> &f, const Model &model) {
+        CHECK(s.size() == model.size());
+        s.read([&](const Sharded &whole) {
+            check_merged(whole, f);
+        });
+
+        auto maxima = s.maxima();
+        auto mx = test::local_maxima(model);
+        CHECK(maxima.size() == mx.size());
+        for (size_t k = 0; k < mx.size(); ++k)
+            CHECK(maxima[k].arg() == mx[k].first && maxima[k].value() == mx[k].second);
+
+        bool thrown = false;
+        try {
+            auto maximum = s.maximum();
+            CHECK(!mx.empty() && maximum.arg() == mx.front().first && maximum.value() == mx.front().second);
+        } catch (const InvalidArg &) {
+            thrown = true;
+        }
+        CHECK(thrown == model.empty());
+    }
+
+    /* Random updates of a sharded function and of a FunctionMaxima. Most of the arguments are next to the bounds,
+     * so the first and the last points of shards are often local maxima and plateaus go across shards.
+     */
+    void random_updates(const std::vector<long> &bounds, unsigned seed, long steps) {
+        auto rng = std::mt19937(seed);
+        auto s = Sharded(bounds);
+        auto f = FunctionMaxima<long, long>();
+        auto model = Model();
+        CHECK(s.shard_count() == bounds.size() + 1);
+        check_maxima(s, f, model);
+        for (long step = 0; step < steps; ++step) {
+            long a = static_cast<long>(rng() % max_argument), v = static_cast<long>(rng() % 4);
+            if (rng() % 2 == 0 && !bounds.empty()) {
+                long bound = bounds[rng() % bounds.size()];
+                a = std::clamp(bound - 2 + static_cast<long>(rng() % 4), 0L, max_argument - 1);
+            }
+            if (rng() % 3 != 0) {
+                s.set_value(a, v);
+                f.set_value(a, v);
+                model[a] = v;
+            } else {
+                s.erase(a);
+                f.erase(a);
+                model.erase(a);
+            }
+            CHECK(s.shard_of(a) == static_cast<size_t>(std::upper_bound(bounds.begin(), bounds.end(), a) -
+                                                        bounds.begin()));
+            CHECK(s.find(a).has_value() == (model.count(a) == 1));
+            if (model.count(a) == 1)
+                CHECK(s.value_at(a) == model[a] && s.find(a)->value() == model[a]);
+            check_maxima(s, f, model);
+        }
+        check_against(f, model, max_argument);
+
+        // Shards are written one at a time, the merge sees the whole function again.
+        for (size_t i = 0; i < s.shard_count(); ++i) {
+            s.write(i, [&](Sharded::function_type &shard) {
+                while (shard.size() != 0) {
+                    long a = shard.begin()->arg();
+                    shard.erase(a);
+                    f.erase(a);
+                    model.erase(a);
+                }
+            });
+            check_maxima(s, f, model);
+        }
+        CHECK(model.empty());
+    }
+}
+
+int main() {
+    // Shards of one argument ([100, 101)), shards which stay empty (before -10, [-10, 0) and from 300).
+    auto bounds = std::vector<std::vector<long>>{{}, {100}, {50, 100, 101, 150}, {-10, 0, 60, 61, 62, 300},
+                                                 {1, 2, 3, 4, 5, 6, 7, 8, 9, 10}};
+    for (unsigned seed = 0; seed < 3; ++seed) {
+        for (const auto &b : bounds)
+            random_updates(b, seed, 1500);
+    }
+
+    bool thrown = false;
+    try {
+        Sharded(std::vector<long>{1, 5, 5});
+    } catch (const InvalidArg &) {
+        thrown = true;
+    }
+    CHECK(thrown);
+
+    std::puts("sharded_function_maxima_test: OK");
+}